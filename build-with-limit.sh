@@ -1,6 +1,39 @@
 #!/bin/bash
-# Set virtual memory limit to 512000 KB (~500 MB)
-ulimit -v 512000
+# Builds the release binaries and runs every solution under memory_harness: address
+# space capped like `ulimit -v 512000` (~500 MB), with peak RSS and page faults
+# reported against the 500 MB budget (per phase for modified_main). The AddressSpaceLimit
+# ctests check modified_main under the same cap on every build.
+#
+# Usage: ./build-with-limit.sh [input size, default 1g] [extra harness options...]
+# e.g.   ./build-with-limit.sh 2g --rss-limit=500m
+set -euo pipefail
 
-cd cmake-build-release-wsl
-./main_exec
+SIZE=${1:-1g}
+shift || true
+BUILD_DIR=cmake-build-release
+LIMIT=512000k
+BUDGET=500m
+
+cmake -S . -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release >/dev/null
+cmake --build "$BUILD_DIR" -j --target generator memory_harness
+
+BIN=$(cd "$BUILD_DIR" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK"
+"$BIN/generator" input.txt "$SIZE" >/dev/null
+
+status=0
+for solution in std_main modified_main ai_main; do
+    echo "== $solution"
+    if ! cmake --build "$BIN" -j --target "$solution" >/dev/null; then
+        echo "build failed, skipped"
+        status=1
+        continue
+    fi
+    phases=()
+    [ "$solution" = modified_main ] && phases=(--phases)
+    "$BIN/memory_harness" --as-limit=$LIMIT --budget=$BUDGET "${phases[@]}" "$@" -- "$BIN/$solution" || status=1
+    rm -f b*.txt c*.txt output.txt
+done
+exit $status
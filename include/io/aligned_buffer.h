@@ -0,0 +1,78 @@
+#ifndef ALIGNED_BUFFER_H
+#define ALIGNED_BUFFER_H
+
+// Heap buffer whose start is aligned for direct (cache-bypassing) I/O.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+  #include <malloc.h>
+#endif
+
+// O_DIRECT wants the buffer address, the file offset and the length aligned
+// to the device's logical block size. 4 KiB covers both 512-byte and 4K devices.
+constexpr std::size_t DIRECT_IO_ALIGNMENT = 4096;
+
+constexpr std::uint64_t align_down(std::uint64_t v) { return v & ~std::uint64_t(DIRECT_IO_ALIGNMENT - 1); }
+constexpr std::uint64_t align_up(std::uint64_t v) { return align_down(v + DIRECT_IO_ALIGNMENT - 1); }
+
+inline bool is_aligned(const void* p) {
+    return (reinterpret_cast<std::uintptr_t>(p) & (DIRECT_IO_ALIGNMENT - 1)) == 0;
+}
+
+// Fixed-size, uninitialised, DIRECT_IO_ALIGNMENT-aligned byte buffer. Move-only.
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(std::size_t size) : size_(size) {
+        if (size == 0) return;
+#ifdef _WIN32
+        data_ = static_cast<char*>(_aligned_malloc(size, DIRECT_IO_ALIGNMENT));
+        if (!data_) throw std::bad_alloc();
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, DIRECT_IO_ALIGNMENT, size) != 0) throw std::bad_alloc();
+        data_ = static_cast<char*>(p);
+#endif
+    }
+    ~AlignedBuffer() { release(); }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+        if (this != &other) {
+            release();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    char* data() noexcept { return data_; }
+    const char* data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+private:
+    void release() noexcept {
+#ifdef _WIN32
+        _aligned_free(data_);
+#else
+        std::free(data_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+#endif // ALIGNED_BUFFER_H
@@ -0,0 +1,31 @@
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+
+#include <cstddef>
+#include <string>
+
+// Small order-0 entropy codec used for compressed temporary run blocks.
+//
+// Generator lines are mostly digits, '-', '/' and lowercase letters, so a
+// per-block canonical Huffman code takes them to roughly 4-5 bits per byte.
+// The stream is
+//
+//   [mode byte][128 bytes of 4-bit code lengths][LSB-first bit stream]   (MODE_HUFFMAN)
+//   [mode byte][raw bytes]                                               (MODE_STORED)
+//
+// Codes are limited to MAX_CODE_BITS so decoding is a single table lookup per
+// symbol. No external dependency is needed.
+namespace block_codec {
+
+constexpr unsigned MAX_CODE_BITS = 11;
+
+// Appends the compressed form of src[0..len) to out.
+void compress(const char* src, std::size_t len, std::string& out);
+
+// Decodes src[0..len) into exactly dst_len bytes at dst.
+// Throws std::runtime_error on malformed input.
+void decompress(const char* src, std::size_t len, char* dst, std::size_t dst_len);
+
+} // namespace block_codec
+
+#endif // BLOCK_CODEC_H
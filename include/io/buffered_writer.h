@@ -2,6 +2,7 @@
 #define BUFFERED_WRITER_H
 
 #include "writer.h"
+#include "metrics.h"
 #include <vector>
 #include <string>
 #include <memory>
@@ -52,7 +53,7 @@ public:
 
         // If the data is larger than the entire buffer, write it directly.
         if (len > buffer_.size()) {
-            writer_.write_all(data, len);
+            write_out(data, len);
         } else {
             // Otherwise, copy the data into the buffer.
             std::copy(data, data + len, buffer_.data() + current_pos_);
@@ -75,7 +76,7 @@ public:
 
         // If the data is larger than the entire buffer, write it directly.
         if (len > buffer_.size()) {
-            writer_.write_all(data, len);
+            write_out(data, len);
         } else {
             // Otherwise, copy the data into the buffer.
             std::copy(data, data + len, buffer_.data() + current_pos_);
@@ -88,12 +89,19 @@ public:
      */
     void flush() {
         if (current_pos_ > 0) {
-            writer_.write_all(buffer_.data(), current_pos_);
+            write_out(buffer_.data(), current_pos_);
             current_pos_ = 0;
         }
     }
 
 private:
+    // Every write to the file is a flush of a buffer, this one's or the caller's.
+    void write_out(const char* data, size_t len) {
+        metrics::ScopedOp op(metrics::Op::WriterFlush);
+        op.add_bytes(len);
+        writer_.write_all(data, len);
+    }
+
     Writer writer_;
     std::vector<char> buffer_;
     size_t current_pos_{0};
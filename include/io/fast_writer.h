@@ -22,6 +22,15 @@ struct FastWriterWrapper {
         if (outbuf.size() >= buffer_limit) flush();
     }
 
+    // Applies a new limit; a buffer far above it is written out and reallocated.
+    void set_buffer_limit(std::size_t limit_bytes) {
+        buffer_limit = limit_bytes;
+        if (outbuf.capacity() <= 2 * buffer_limit) return;
+        if (!outbuf.empty()) writer.write(outbuf);
+        std::string().swap(outbuf);
+        outbuf.reserve(std::min<std::size_t>(64 * 1024, buffer_limit));
+    }
+
     void flush() {
         if (!outbuf.empty()) {
             writer.write(outbuf);
@@ -7,6 +7,9 @@
 #include <string>
 #include <system_error>
 #include <cstdint>
+#include <memory>
+
+#include "aligned_buffer.h"
 
 #ifdef _WIN32
   #define WIN32_LEAN_AND_MEAN
@@ -17,6 +20,8 @@
 using native_handle_t = int;
 #endif
 
+class TempQuota;
+
 class FileManager {
 public:
     // Open file at path. create_if_missing==true -> create if not exists.
@@ -24,6 +29,42 @@ public:
     FileManager(const std::string& path, bool create_if_missing = true, unsigned mode = 0644);
     ~FileManager();
 
+    // The process's standard input/output, on a duplicated handle that the
+    // FileManager owns. They may be pipes or terminals, see is_seekable().
+    static FileManager standard_input();
+    static FileManager standard_output();
+
+    // Scratch file kept in anonymous memory (memfd_create) while `quota` has room.
+    // A write that would exceed the quota first moves the file to spill_path on
+    // disk, keeping the handle and cursor; clear() brings it back to memory. Where
+    // memfd is unavailable the file lives at spill_path from the start. A spilled
+    // file is deleted with its FileManager.
+    static FileManager temporary(const std::string& spill_path, std::shared_ptr<TempQuota> quota);
+
+    // True while a temporary() file is held in memory.
+    bool in_memory() const noexcept;
+
+    // Called before len bytes are written at the cursor (Writer, copy_to): charges
+    // a temporary() file's growth to its quota, spilling it to disk if needed.
+    void will_write(std::uint64_t len);
+
+    // Direct I/O: bulk transfers bypass the page cache (O_DIRECT on a second
+    // descriptor), so a large sort does not evict other processes' data and is not
+    // double-buffered under our own buffers. Aligned parts of a transfer go direct
+    // through an aligned bounce buffer, or straight from the caller's buffer when it
+    // is aligned; the unaligned head and tail of a write go through the cache, so
+    // file sizes stay exact. Reader, RunReader, Writer, read_at() and copy_to()
+    // switch over by themselves. Returns false, leaving the file buffered, where
+    // unsupported: pipes, temporary() files, filesystems refusing O_DIRECT
+    // (tmpfs), platforms other than Linux.
+    bool set_direct_io(bool enable);
+    bool direct_io() const noexcept;
+
+    // direct_io() files only. Read up to len bytes at the cursor / write all len
+    // bytes at the cursor, advancing it. direct_read() returns 0 at end of file.
+    std::size_t direct_read(char* dst, std::size_t len);
+    void direct_write(const char* src, std::size_t len);
+
     // non-copyable
     FileManager(const FileManager&) = delete;
     FileManager& operator=(const FileManager&) = delete;
@@ -48,19 +89,61 @@ public:
     // Reset cursor to start
     void reset_cursor();
 
+    // Move cursor to the end, for appending
+    void seek_to_end();
+
     // Return file size in bytes
     std::uint64_t size() const;
 
     // Tests whether file is empty (size == 0)
     bool is_empty() const;
 
+    // False for pipes, sockets and terminals. Such streams are read or written
+    // front to back only: clear(), reset_cursor() and seek_to_end() fail on them
+    // and size() does not count their contents.
+    bool is_seekable() const;
+
+    // Reserves disk blocks for len bytes without changing the file size, so a large
+    // sequential write does not fragment or fail halfway on a full disk.
+    // Best effort: silently does nothing where unsupported.
+    void preallocate(std::uint64_t len);
+
+    // Reads up to len bytes at offset without moving the cursor, so several
+    // threads can share one handle. Returns the bytes read, 0 at end of file.
+    std::size_t read_at(char* dst, std::size_t len, std::uint64_t offset) const;
+
+    // Copies len bytes from this file's cursor to dst's cursor, advancing both.
+    // Uses copy_file_range so the data stays in the kernel where supported, and
+    // falls back to a read/write loop otherwise. Returns the bytes copied, which
+    // is less than len only at end of file.
+    std::uint64_t copy_to(FileManager& dst, std::uint64_t len);
+
+    // Replaces dst's contents with this whole file. Shares the extents (reflink)
+    // where the filesystem allows it and uses copy_to otherwise. Resets both cursors.
+    void clone_to(FileManager& dst);
+
 private:
     native_handle_t handle_;
     std::string path_;
     unsigned mode_;
     bool opened_;
+    // temporary() files only: the memory allowance and the bytes charged to it.
+    std::shared_ptr<TempQuota> quota_;
+    std::uint64_t charged_ = 0;
+    bool in_memory_ = false;
+    // direct_io() only: the O_DIRECT descriptor and the bounce buffer of cursor I/O.
+    native_handle_t direct_handle_{};
+    bool direct_ = false;
+    AlignedBuffer bounce_;
+    FileManager(native_handle_t handle, std::string name);
     void open_impl(bool create_if_missing);
     void close_impl() noexcept;
+    void spill_to_disk();
+    void release_quota() noexcept;
+    void discard() noexcept;
+    void close_direct() noexcept;
+    std::uint64_t cursor() const;
+    void set_cursor(std::uint64_t offset);
 };
 
 #endif // MANAGER_H
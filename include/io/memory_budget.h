@@ -0,0 +1,86 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+// Memory a sort may spend on its buffers, following the container it runs in.
+//
+// The budget starts from a fixed ceiling (500 MB unless set_ceiling() says
+// otherwise) and is lowered to what the memory cgroup still leaves free: the
+// smallest memory.max / memory.high of the process's cgroup and its ancestors
+// (memory.limit_in_bytes on cgroup v1), minus what the rest of the group uses.
+// While the kernel reports memory stalls (PSI "some avg10", from the cgroup's
+// memory.pressure or /proc/pressure/memory) it is scaled down further, to a
+// quarter at 60% stall time. Under an address-space limit (RLIMIT_AS, `ulimit -v`)
+// it also stays within what the limit leaves beyond the mappings that are not
+// resident memory: libraries, thread stacks and reserved but untouched capacity.
+// Without a cgroup limit, PSI or RLIMIT_AS that part is skipped; off Linux the
+// budget is the ceiling.
+//
+// The files are re-read at most every POLL_INTERVAL; in between current() is a
+// clock read and an atomic load, cheap enough for every segment refill. Cuts
+// apply at once, growth is limited to a quarter per poll, so a short lull in
+// pressure does not make buffers bounce.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+class MemoryBudget {
+public:
+    static constexpr std::uint64_t DEFAULT_CEILING = 500ull * 1024 * 1024;
+    // Floor of the budget: below this the merges only get slower, not smaller.
+    static constexpr std::uint64_t MIN_BUDGET = 16ull * 1024 * 1024;
+    static constexpr std::chrono::milliseconds POLL_INTERVAL{500};
+
+    // What the cgroup and PSI files said at one poll.
+    struct Reading {
+        std::uint64_t limit = 0;  // effective cgroup limit in bytes; 0 if there is none
+        std::uint64_t others = 0; // group usage that is neither reclaimable page cache nor this process
+        double pressure = 0;      // PSI "some avg10", percent of time stalled on memory
+        std::uint64_t address_space = 0; // RLIMIT_AS in bytes; 0 if there is none
+        std::uint64_t unbacked = 0;      // mapped but not resident anonymous memory (VmSize - RssAnon)
+    };
+
+    explicit MemoryBudget(std::uint64_t ceiling = DEFAULT_CEILING);
+
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+    // Changes the ceiling and polls again at once.
+    void set_ceiling(std::uint64_t ceiling);
+    std::uint64_t ceiling() const noexcept { return ceiling_.load(std::memory_order_relaxed); }
+
+    // Bytes the sort may use now. Thread-safe; polls the files when due.
+    std::uint64_t current();
+
+    // Polls now, without the growth limit.
+    void refresh();
+
+    Reading last_reading() const;
+
+    // The budget a reading leaves under `ceiling`, before smoothing.
+    static std::uint64_t target(const Reading& reading, std::uint64_t ceiling);
+
+private:
+    void poll(bool smooth);
+    Reading read() const;
+
+    std::atomic<std::uint64_t> ceiling_;
+    std::atomic<std::uint64_t> budget_;
+    std::atomic<std::int64_t> next_poll_{0}; // steady_clock ticks
+    mutable std::mutex mutex_;               // guards reading_ and serialises polls
+    Reading reading_;
+
+    // Found once: the process's memory cgroup, the mount point of its hierarchy
+    // (ancestors are walked up to it) and the PSI file to read.
+    std::string cgroup_dir_;
+    std::string cgroup_root_;
+    bool cgroup_v2_ = false;
+    std::string pressure_path_;
+};
+
+// The budget of this process, shared by all solutions; main() sets its ceiling.
+MemoryBudget& memory_budget();
+
+#endif // MEMORY_BUDGET_H
@@ -0,0 +1,185 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Built-in counters and timers for a sort, reported as JSON, and an optional
+// timeline of the same hooks in Chrome trace-event format.
+//
+// Off by default. While off, every hook is a relaxed load of one flag: no clock
+// reads, no shared writes. enable() and enable_trace() turn them on for the rest
+// of the process.
+//
+// Operations (Reader fills, run file reads, Writer writes, buffer flushes, segment
+// refills, kernel copies) accumulate calls, bytes and wall time from any thread.
+// A phase (run formation, each merge pass, the fast paths) records its own wall
+// time, runs produced and peak RSS, plus the difference of all operation stats,
+// counters and page faults between its start and its end. The peak RSS is the
+// kernel's high-water mark when the phase raised it, else the highest of VmRSS
+// samples taken every few milliseconds while the phase runs.
+//
+// With tracing on, every operation call and phase also becomes a span on its
+// thread's timeline (kept in a buffer per thread), for chrome://tracing or Perfetto.
+//
+// enable_hardware_counters() adds CPU counters (perf_event_open, Linux only) to
+// the report's totals and phases, user space only. Each thread has counters of its
+// own: the calling thread, and those that call count_thread() as they start (the
+// ThreadPool workers and the sort's stage threads). A phase sums them all.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace metrics {
+
+enum class Op : unsigned {
+    ReaderFill,    // Reader::fill_buffer
+    RunRead,       // BasicRunReader reads from a run file
+    WriterWrite,   // Writer::write_all
+    WriterFlush,   // a BufferedWriter or RunWriter buffer written out; Writer::flush (fsync)
+    FileCopy,      // FileManager::copy_to
+    SegmentRefill, // a merge segment reloaded from its run reader
+    PrefetchWait,  // a merge waiting for a run reader's prefetch thread
+    Count_
+};
+
+enum class Counter : unsigned {
+    HeapOps,     // priority-queue pushes and pops in k-way merges
+    Comparisons, // record comparisons made by those queues and by galloping
+    GallopRecords, // records a merge moved in galloping spans, without heap work
+    TwoWayRecords, // records a merge down to two inputs ordered by merge_two_runs()
+    Count_
+};
+
+enum class Hw : unsigned {
+    Cycles,
+    Instructions,
+    LlcMisses,    // last-level cache misses (the kernel's generic cache-misses event)
+    BranchMisses,
+    TaskClock,    // CPU time in nanoseconds; a software event, so also available in VMs
+    Count_
+};
+
+constexpr std::size_t OP_COUNT = static_cast<std::size_t>(Op::Count_);
+constexpr std::size_t COUNTER_COUNT = static_cast<std::size_t>(Counter::Count_);
+constexpr std::size_t HW_COUNT = static_cast<std::size_t>(Hw::Count_);
+
+using Clock = std::chrono::steady_clock;
+
+constexpr unsigned COLLECT = 1; // counters and phases for write_report()
+constexpr unsigned TRACE = 2;   // spans for write_trace()
+
+extern std::atomic<unsigned> g_mode;
+
+inline unsigned mode() noexcept { return g_mode.load(std::memory_order_relaxed); }
+inline bool enabled() noexcept { return (mode() & COLLECT) != 0; }
+inline bool tracing() noexcept { return (mode() & TRACE) != 0; }
+
+// Turn on collection / tracing. The first of them starts the clock that the
+// report's total and the trace timestamps are measured from.
+void enable();
+void enable_trace();
+
+// Opens the Hw counters and turns collection on. Call before starting threads.
+// Returns how many counters could be opened: none without a PMU or with
+// kernel.perf_event_paranoid too strict. Unavailable ones are reported as null.
+std::size_t enable_hardware_counters();
+
+// Opens Hw counters for the calling thread, if enable_hardware_counters() was called.
+// Their counts stay in the report after the thread exits.
+void count_thread();
+
+const char* op_name(Op op) noexcept;
+
+// Adds one call of `op` that moved `bytes` in `nanos`.
+void record(Op op, std::uint64_t bytes, std::uint64_t nanos) noexcept;
+
+// Adds n to a counter. Callers batch: one call per merge, not per record.
+void add(Counter counter, std::uint64_t n) noexcept;
+
+// Appends a span to the calling thread's timeline; dropped if memory runs out.
+void trace_span(const char* name, const char* category, Clock::time_point start, Clock::time_point end,
+                std::uint64_t bytes) noexcept;
+
+inline std::uint64_t nanos_since(Clock::time_point start) noexcept {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+// Times its scope as one call of an operation.
+class ScopedOp {
+public:
+    explicit ScopedOp(Op op) noexcept : op_(op), mode_(mode()) {
+        if (mode_) start_ = Clock::now();
+    }
+    ~ScopedOp() {
+        if (!mode_) return;
+        const Clock::time_point end = Clock::now();
+        if (mode_ & COLLECT) {
+            record(op_, bytes_, static_cast<std::uint64_t>(
+                                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count()));
+        }
+        if (mode_ & TRACE) trace_span(op_name(op_), "io", start_, end, bytes_);
+    }
+    ScopedOp(const ScopedOp&) = delete;
+    ScopedOp& operator=(const ScopedOp&) = delete;
+
+    void add_bytes(std::uint64_t n) noexcept { bytes_ += n; }
+
+private:
+    Op op_;
+    unsigned mode_;
+    std::uint64_t bytes_ = 0;
+    Clock::time_point start_{};
+};
+
+// Totals of all operations and counters at one moment.
+struct Snapshot {
+    std::array<std::uint64_t, OP_COUNT> calls{};
+    std::array<std::uint64_t, OP_COUNT> bytes{};
+    std::array<std::uint64_t, OP_COUNT> nanos{};
+    std::array<std::uint64_t, COUNTER_COUNT> counters{};
+    std::array<std::uint64_t, HW_COUNT> hardware{};
+    std::uint64_t minor_faults = 0;
+    std::uint64_t major_faults = 0;
+};
+
+Snapshot snapshot() noexcept;
+
+// Records its scope as a phase of the report, in completion order.
+class ScopedPhase {
+public:
+    explicit ScopedPhase(const char* name);
+    ~ScopedPhase();
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+    // Runs written by the phase, reported when set.
+    void set_runs(std::uint64_t runs) noexcept { runs_ = runs; has_runs_ = true; }
+
+private:
+    class RssSampler;
+
+    const char* name_;
+    unsigned mode_;
+    bool has_runs_ = false;
+    std::uint64_t runs_ = 0;
+    Clock::time_point start_{};
+    Snapshot before_{};
+    std::unique_ptr<RssSampler> sampler_;
+};
+
+// Writes the report collected so far as one JSON object.
+void write_report(std::ostream& out);
+// Same, to a file; "-" means standard error, keeping stdout free for sorted output.
+void write_report(const std::string& path);
+
+// Writes the spans of all threads as a Chrome trace-event JSON file. Call once
+// the threads that record spans have finished.
+void write_trace(const std::string& path);
+
+} // namespace metrics
+
+#endif // METRICS_H
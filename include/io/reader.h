@@ -4,7 +4,9 @@
 #include <string>
 #include <string_view>
 #include <vector>
+#include <cstdint>
 #include <cstdio> // FILE*
+#include "aligned_buffer.h"
 #include "manager.h"
 
 class Reader {
@@ -22,13 +24,20 @@ public:
     bool get_line(std::string_view& view);
     bool is_end() const;
 
+    // Copies up to len bytes of the input to dst, fewer only at its end, without
+    // splitting lines; for callers that split whole blocks themselves.
+    size_t read_raw(char* dst, size_t len);
+
 private:
     void fill_buffer();
 
     static constexpr size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+    // Direct reads get no kernel read-ahead, so they are issued in larger pieces.
+    static constexpr size_t DIRECT_BUFFER_SIZE = 1024 * 1024;
 
     FILE* file_handle_ = nullptr;
-    std::vector<char> buffer_;
+    FileManager* direct_source_ = nullptr; // set for direct_io() files, read without FILE*
+    AlignedBuffer buffer_;
     size_t buffer_pos_ = 0;
     size_t buffer_end_ = 0;
     bool eof_reached_ = false;
@@ -37,4 +46,9 @@ private:
     std::string line_buffer_;
 };
 
+// First line start at or after `offset` of a seekable source, read with
+// read_at(); file_size if no line starts there. For cutting a file into
+// line-aligned byte ranges.
+std::uint64_t next_line_start(const FileManager& source, std::uint64_t offset, std::uint64_t file_size);
+
 #endif // READER_H
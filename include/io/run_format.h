@@ -0,0 +1,168 @@
+#ifndef RUN_FORMAT_H
+#define RUN_FORMAT_H
+
+// Binary layout of temporary run files (b*/c*).
+//
+// A run file is a sequence of blocks:
+//
+//   [BlockHeader][record][record]...
+//
+// and every record is
+//
+//   [key][varint (payload_len << 2 | has_count << 1 | run_start)][varint count][payload bytes]
+//
+// where the count is present only if has_count is set and defaults to 1
+// otherwise; it is the number of input lines a record stands for once
+// duplicates have been collapsed.
+// The key is an int32 or int64 cached from the line by the sort-key policy
+// (solution/key.h), so merge passes rarely touch the text again. Each run file
+// carries one key width, fixed by the policy at compile time. `run_start` marks
+// the first record of a sorted run.
+// Integers are stored in host byte order: run files are scratch data that never
+// leave the machine that produced them.
+//
+// A block with BLOCK_COMPRESSED set stores its records column-wise instead:
+//
+//   [zigzag varint key deltas][varint column tags][varint counts][block_codec stream of all payloads]
+//
+// A column tag is (stored_len << 3 | has_count << 2 | key_elided << 1 | run_start),
+// and the counts column holds one entry per record with has_count set. When the
+// payload starts with the canonical decimal form of its key, those digits are
+// dropped (key_elided) and rebuilt from the key on decoding. Readers expand
+// compressed blocks back to the plain record layout above.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <type_traits>
+
+namespace run_format {
+
+struct BlockHeader {
+    std::uint32_t payload_size; // bytes of record data following the header
+    std::uint32_t record_count;
+    std::uint32_t flags;
+};
+
+static_assert(sizeof(BlockHeader) == 12, "BlockHeader must stay packed");
+
+constexpr std::uint32_t BLOCK_COMPRESSED = 1u << 0;
+constexpr std::uint32_t BLOCK_OPENS_RUN = 1u << 1;  // first record starts a run
+constexpr std::uint32_t BLOCK_MIXED_RUNS = 1u << 2; // a later record starts a run
+
+// A block with neither flag holds only records of the run that is already open,
+// so it can be copied verbatim when that run has nothing to be merged with.
+inline bool continues_run(std::uint32_t flags) {
+    return (flags & (BLOCK_OPENS_RUN | BLOCK_MIXED_RUNS)) == 0;
+}
+
+// Key widths a run file can carry; RunWriter and RunReader are instantiated for both.
+template <class Key>
+constexpr bool is_run_key_v = std::is_same_v<Key, std::int32_t> || std::is_same_v<Key, std::int64_t>;
+
+constexpr std::size_t MAX_VARINT_SIZE = 10;
+// Longest canonical decimal key: "-9223372036854775808".
+constexpr std::size_t MAX_KEY_DIGITS = 20;
+
+template <class Key>
+struct Record {
+    Key key;
+    bool run_start;
+    std::uint64_t count;
+    std::string_view payload;
+};
+
+inline void append_varint(std::string& out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline char* write_varint(char* p, std::uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    *p++ = static_cast<char>(v);
+    return p;
+}
+
+inline const char* read_varint(const char* p, const char* end, std::uint64_t& v) {
+    v = 0;
+    unsigned shift = 0;
+    while (p < end) {
+        const auto byte = static_cast<unsigned char>(*p++);
+        v |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return p;
+        shift += 7;
+        if (shift >= 64) break;
+    }
+    throw std::runtime_error("Corrupted run file: bad varint.");
+}
+
+inline std::uint64_t zigzag(std::int64_t v) {
+    return (static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63);
+}
+
+inline std::int64_t unzigzag(std::uint64_t v) {
+    return static_cast<std::int64_t>(v >> 1) ^ -static_cast<std::int64_t>(v & 1);
+}
+
+// Writes the canonical decimal form of key into buf (at least MAX_KEY_DIGITS bytes), returns its length.
+inline std::size_t format_key(std::int64_t key, char* buf) {
+    std::uint64_t v = key < 0 ? 0u - static_cast<std::uint64_t>(key) : static_cast<std::uint64_t>(key);
+    char tmp[MAX_KEY_DIGITS];
+    std::size_t n = 0;
+    do {
+        tmp[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    std::size_t len = 0;
+    if (key < 0) buf[len++] = '-';
+    while (n > 0) buf[len++] = tmp[--n];
+    return len;
+}
+
+template <class Key>
+inline void append_record(std::string& out, Key key, bool run_start, std::string_view payload,
+                          std::uint64_t count = 1) {
+    static_assert(is_run_key_v<Key>, "unsupported run key type");
+    char key_bytes[sizeof(Key)];
+    std::memcpy(key_bytes, &key, sizeof(Key));
+    out.append(key_bytes, sizeof(Key));
+    const bool has_count = count != 1;
+    append_varint(out, (static_cast<std::uint64_t>(payload.size()) << 2) | (has_count ? 2u : 0u)
+                       | (run_start ? 1u : 0u));
+    if (has_count) append_varint(out, count);
+    out.append(payload.data(), payload.size());
+}
+
+template <class Key>
+inline const char* decode_record(const char* p, const char* end, Record<Key>& rec) {
+    static_assert(is_run_key_v<Key>, "unsupported run key type");
+    if (static_cast<std::size_t>(end - p) < sizeof(Key)) {
+        throw std::runtime_error("Corrupted run file: truncated record.");
+    }
+    std::memcpy(&rec.key, p, sizeof(Key));
+    p += sizeof(Key);
+    std::uint64_t tag = 0;
+    p = read_varint(p, end, tag);
+    rec.count = 1;
+    if (tag & 2u) p = read_varint(p, end, rec.count);
+    const std::size_t len = static_cast<std::size_t>(tag >> 2);
+    if (static_cast<std::size_t>(end - p) < len) {
+        throw std::runtime_error("Corrupted run file: truncated payload.");
+    }
+    rec.run_start = (tag & 1u) != 0;
+    rec.payload = std::string_view(p, len);
+    return p + len;
+}
+
+} // namespace run_format
+
+#endif // RUN_FORMAT_H
@@ -0,0 +1,111 @@
+#ifndef RUN_READER_H
+#define RUN_READER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "aligned_buffer.h"
+#include "manager.h"
+#include "thread_pool.h"
+
+/**
+ * @class BasicRunReader
+ * @brief Sequentially reads blocks of a temporary run file written by BasicRunWriter<Key>.
+ *
+ * The reader hands out whole blocks: the record bytes of each block are appended
+ * to a caller-owned buffer, so a segment can be filled with many blocks and then
+ * decoded in one sweep. Compressed blocks are expanded to the plain record layout.
+ *
+ * With prefetch_bytes > 0 tasks on the shared ThreadPool read and expand blocks
+ * ahead of the caller, keeping up to prefetch_bytes of decoded data ready, so that
+ * I/O and decompression overlap with merging. A task ends once the read-ahead is
+ * full and the next is queued as the caller drains it; if the caller runs dry
+ * while the task is still queued behind other work, it loads the block itself.
+ */
+template <class Key>
+class BasicRunReader {
+public:
+    static constexpr std::size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+
+    explicit BasicRunReader(FileManager& fm,
+                            std::size_t buffer_size = DEFAULT_BUFFER_SIZE,
+                            std::size_t prefetch_bytes = 0);
+    ~BasicRunReader();
+
+    BasicRunReader(const BasicRunReader&) = delete;
+    BasicRunReader& operator=(const BasicRunReader&) = delete;
+
+    // Appends the record bytes of the next block to `out` and stores its record count.
+    // Returns false when the file is exhausted.
+    bool read_block(std::string& out, std::uint32_t& record_count);
+
+    // True once every block has been handed out.
+    bool is_end();
+
+    // Most decoded bytes kept ready ahead of the caller; 0 without prefetching.
+    std::size_t prefetch_bytes() const noexcept { return prefetch_bytes_; }
+
+    // True if the next block only continues the current run (see run_format.h).
+    // Always false while prefetching, since blocks are already decoded by then.
+    bool next_block_continues_run();
+
+    // Copies the next block, header included, to the cursor of `out` without
+    // decoding it; bytes not yet buffered are moved with FileManager::copy_to.
+    bool copy_block_to(FileManager& out);
+
+private:
+    struct DecodedBlock {
+        std::string data;
+        std::uint32_t record_count;
+    };
+
+    bool load_block(std::string& out, std::uint32_t& record_count);
+    void expand_compressed(const char* data, std::size_t len, std::uint32_t record_count, std::string& out);
+    bool file_is_end();
+    bool ensure_buffered(std::size_t len);
+    void fill_buffer();
+    void read_more();
+    void read_exact(char* dst, std::size_t len);
+    void schedule_prefetch();
+    void prefetch_task();
+    bool load_next(std::unique_lock<std::mutex>& lk);
+    void wait_for_block(std::unique_lock<std::mutex>& lk);
+
+    FileManager& fm_;
+    native_handle_t handle_;
+    AlignedBuffer buffer_; // aligned so that direct_io() reads can land in it
+    std::size_t buffer_pos_ = 0;
+    std::size_t buffer_end_ = 0;
+    bool eof_reached_ = false;
+
+    // Scratch space for compressed blocks.
+    std::string compressed_;
+    std::string payloads_;
+    std::string expanded_;
+    std::vector<Key> keys_;
+    std::vector<std::uint64_t> tags_;
+    std::vector<std::uint64_t> counts_;
+
+    // Prefetch state, guarded by mutex_. Whoever sets loader_ to Running owns the
+    // file position until it resets it.
+    enum class Loader { Idle, Queued, Running };
+    std::size_t prefetch_bytes_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<DecodedBlock> ready_;
+    std::size_t ready_bytes_ = 0;
+    Loader loader_ = Loader::Idle;
+    bool exhausted_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    TaskGroup prefetch_tasks_{TaskPriority::High};
+};
+
+using RunReader = BasicRunReader<std::int32_t>;
+
+#endif // RUN_READER_H
@@ -0,0 +1,106 @@
+#ifndef RUN_WRITER_H
+#define RUN_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "manager.h"
+#include "thread_pool.h"
+#include "writer.h"
+
+template <class Key>
+class BasicRunReader;
+
+/**
+ * @class BasicRunWriter
+ * @brief Appends key/payload records to a temporary run file in the binary block format.
+ *
+ * Key is the cached run key type, int32_t or int64_t (see run_format.h).
+ * Records are packed into blocks of roughly block_size bytes (see run_format.h).
+ * Sealed blocks are collected in memory and, once half of flush_size is pending,
+ * handed to a write-behind task on the shared ThreadPool while the next half
+ * fills; flush() and destruction wait for it. At most one write is in flight,
+ * so the file is written in order and about flush_size bytes are held in all.
+ * With compression enabled every block is stored column-wise: delta-encoded keys,
+ * tags, and the payload bytes run through block_codec.
+ */
+template <class Key>
+class BasicRunWriter {
+public:
+    static constexpr std::size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+    static constexpr std::size_t DEFAULT_FLUSH_SIZE = 1 << 20;
+
+    explicit BasicRunWriter(FileManager& fm,
+                            bool compress = false,
+                            std::size_t flush_size = DEFAULT_FLUSH_SIZE,
+                            std::size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~BasicRunWriter();
+
+    BasicRunWriter(const BasicRunWriter&) = delete;
+    BasicRunWriter& operator=(const BasicRunWriter&) = delete;
+
+    // Marks the next pushed record as the first record of a new sorted run.
+    // Calling it again before any push is a no-op, so empty runs are never counted.
+    void begin_run() { run_pending_ = true; }
+
+    // count > 1 marks a record that stands for that many collapsed input lines.
+    void push(Key key, std::string_view payload, std::uint64_t count = 1);
+
+    // Seals the open block and writes everything pending, waiting for the
+    // write-behind task. Does not fsync.
+    void flush();
+
+    // Changes the flush size, e.g. when the memory budget moves. A pending buffer
+    // far above the new size writes its sealed blocks and is reallocated smaller.
+    void set_flush_size(std::size_t flush_size);
+
+    // Appends the reader's next block unchanged, without decoding it, if that block
+    // only continues the current run (see run_format::continues_run). The current
+    // run must already have received a record. Returns false if nothing was copied.
+    bool copy_block_from(BasicRunReader<Key>& reader);
+
+    // Appends `count` records already in the plain record layout (run_format.h),
+    // e.g. a span of a merge input, with one copy per block instead of a push()
+    // per record. None of them may start a run. Returns false, appending
+    // nothing, in compressed mode or while a run is pending; the caller then
+    // pushes the records one by one.
+    bool append_records(std::string_view records, std::uint32_t count);
+
+    // Number of runs that received at least one record.
+    std::size_t runs() const { return runs_; }
+
+private:
+    void open_block();
+    void seal_block();
+    void seal_compressed_block();
+    void write_pending();
+
+    FileManager& fm_;
+    Writer writer_;
+    std::string out_;
+    bool compress_;
+    std::size_t flush_size_;
+    std::size_t block_size_;
+    std::size_t block_start_ = 0;
+    std::uint32_t block_records_ = 0;
+    std::uint32_t block_flags_ = 0;
+    bool block_open_ = false;
+    bool run_pending_ = true;
+    std::size_t runs_ = 0;
+
+    // Column buffers of the open block in compressed mode.
+    std::vector<Key> col_keys_;
+    std::vector<std::uint64_t> col_tags_;
+    std::vector<std::uint64_t> col_counts_;
+    std::string col_payload_;
+
+    // Bytes being written by the write-behind task.
+    std::string in_flight_;
+    TaskGroup writes_{TaskPriority::Low};
+};
+
+using RunWriter = BasicRunWriter<std::int32_t>;
+
+#endif // RUN_WRITER_H
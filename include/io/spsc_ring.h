@@ -0,0 +1,89 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+// Bounded single-producer single-consumer queue between two pipeline stages.
+//
+// Meant for few, large items (input blocks, sorted chunks): push() and pop() are
+// lock-free while the ring is neither full nor empty; otherwise the caller sleeps
+// until the other side moves or the ring is closed. Items are moved in and out,
+// so buffers can circulate between two rings without reallocation.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template <class T>
+class SpscRing {
+public:
+    explicit SpscRing(std::size_t capacity) : slots_(capacity > 0 ? capacity : 1) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Moves item in, waiting while the ring is full. Returns false, leaving item
+    // alone, once the ring is closed.
+    bool push(T& item) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        auto room = [&] { return tail - head_.load() < slots_.size(); };
+        if (!wait_for(room, producer_waiting_) || closed_.load()) return false;
+        slots_[tail % slots_.size()] = std::move(item);
+        tail_.store(tail + 1);
+        wake(consumer_waiting_);
+        return true;
+    }
+
+    // Moves the oldest item out, waiting while the ring is empty. Returns false
+    // once the ring is closed and drained.
+    bool pop(T& item) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        auto any = [&] { return tail_.load() != head; };
+        if (!wait_for(any, consumer_waiting_)) return false;
+        item = std::move(slots_[head % slots_.size()]);
+        head_.store(head + 1);
+        wake(producer_waiting_);
+        return true;
+    }
+
+    // Ends the stream: pending and later push() calls fail, pop() drains what is
+    // left. Either side may close, e.g. to stop the other after an error.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_.store(true);
+        }
+        cv_.notify_all();
+    }
+
+private:
+    // Sequentially consistent flag and position accesses make sure a sleeper
+    // either sees the other side's move or is seen waiting and woken.
+    template <class Ready>
+    bool wait_for(Ready ready, std::atomic<bool>& waiting) {
+        if (ready()) return true;
+        std::unique_lock<std::mutex> lock(mutex_);
+        waiting.store(true);
+        cv_.wait(lock, [&] { return ready() || closed_.load(); });
+        waiting.store(false);
+        return ready();
+    }
+
+    void wake(std::atomic<bool>& waiting) {
+        if (!waiting.load()) return;
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        cv_.notify_all();
+    }
+
+    std::vector<T> slots_;
+    std::atomic<std::size_t> head_{0}; // next slot to pop, written by the consumer
+    std::atomic<std::size_t> tail_{0}; // next slot to push, written by the producer
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> producer_waiting_{false};
+    std::atomic<bool> consumer_waiting_{false};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
+
+#endif // SPSC_RING_H
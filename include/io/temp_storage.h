@@ -0,0 +1,70 @@
+#ifndef TEMP_STORAGE_H
+#define TEMP_STORAGE_H
+
+// Where the temporary runs of a sort live: anonymous memory up to a quota,
+// files in one or more spill directories beyond it.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "manager.h"
+
+// Bytes of memory that the FileManager::temporary() files sharing it may hold together.
+class TempQuota {
+public:
+    explicit TempQuota(std::uint64_t limit) : limit_(limit) {}
+
+    // Takes len bytes if they still fit under the limit.
+    bool try_charge(std::uint64_t len) noexcept {
+        std::uint64_t used = used_.load(std::memory_order_relaxed);
+        do {
+            if (len > limit_ - used) return false;
+        } while (!used_.compare_exchange_weak(used, used + len, std::memory_order_relaxed));
+        return true;
+    }
+
+    void release(std::uint64_t len) noexcept { used_.fetch_sub(len, std::memory_order_relaxed); }
+
+    std::uint64_t used() const noexcept { return used_.load(std::memory_order_relaxed); }
+    std::uint64_t limit() const noexcept { return limit_; }
+
+private:
+    const std::uint64_t limit_;
+    std::atomic<std::uint64_t> used_{0};
+};
+
+// Creates the bucket files of a sort, striped over one or more directories.
+// With a memory quota they are FileManager::temporary() files sharing it and
+// spill into their directory; with 0 they are plain files there.
+//
+// The directories are grouped by device and the devices split into two sides;
+// successive buckets alternate sides, so the bucket a merge pass reads and the
+// one it writes sit on different devices. Within a side, the files of a bucket
+// take its directories round-robin. With a single device every bucket uses all
+// directories.
+//
+// direct_io puts the plain (quota 0) files into FileManager::set_direct_io()
+// mode where the filesystem allows it.
+class TempStorage {
+public:
+    explicit TempStorage(std::vector<std::string> dirs = {"."}, std::uint64_t memory_quota = 0,
+                         bool direct_io = false);
+
+    // Files <dir>/<prefix>0.txt ... <prefix><count-1>.txt; leftovers of an
+    // earlier run are removed first.
+    std::vector<FileManager> make_bucket(const std::string& prefix, std::size_t count);
+
+    // Bytes currently held in memory by the files of this storage.
+    std::uint64_t memory_used() const;
+
+private:
+    std::vector<std::string> sides_[2];
+    std::size_t buckets_made_ = 0;
+    std::shared_ptr<TempQuota> quota_;
+    bool direct_io_;
+};
+
+#endif // TEMP_STORAGE_H
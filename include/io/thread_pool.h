@@ -0,0 +1,131 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Work-stealing task scheduler shared by the whole sort.
+//
+// Every worker owns one deque per priority. Tasks submitted from a worker go to
+// the back of its own deque and are taken back LIFO, so nested work stays warm in
+// its cache; tasks from other threads go to a shared injection queue. An idle
+// worker takes the highest priority first: its own deque, then the injection
+// queue, then the front (oldest end) of the other workers' deques.
+//
+// Threads that wait for tasks (TaskGroup::wait) run queued tasks meanwhile, so a
+// task may wait for tasks it submitted without tying up a worker for nothing.
+// Tasks should be short: a loop that blocks for long belongs in a chain of tasks
+// that each do one step and resubmit (see BasicRunReader's prefetch).
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class TaskPriority : unsigned {
+    High,   // someone is waiting for it now: segment refills, prefetch a merge starves on
+    Normal, // parsing, sorting, merging
+    Low,    // background: write-behind flushes
+    Count_
+};
+
+constexpr std::size_t TASK_PRIORITY_COUNT = static_cast<std::size_t>(TaskPriority::Count_);
+
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // threads == 0: one per core.
+    explicit ThreadPool(unsigned threads = 0);
+    // Runs the tasks still queued, then joins the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const noexcept { return static_cast<unsigned>(workers_.size()); }
+
+    // Queues a task. It must not throw; TaskGroup catches and forwards exceptions.
+    void submit(Task task, TaskPriority priority = TaskPriority::Normal);
+
+    // Runs one queued task on the calling thread; false if there was none.
+    bool run_one();
+
+    // The pool of the process, started on first use.
+    static ThreadPool& shared();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::array<std::deque<Task>, TASK_PRIORITY_COUNT> tasks;
+    };
+
+    void worker_loop(std::size_t index);
+    bool take(std::size_t self, Task& task);
+
+    // queues_[i] belongs to worker i; the last one is the injection queue.
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> queued_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false; // guarded by sleep_mutex_
+};
+
+// Tasks that are waited for together. wait() rethrows the first exception a task
+// threw; the destructor waits too, but drops exceptions.
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskPriority priority = TaskPriority::Normal, ThreadPool& pool = ThreadPool::shared())
+        : pool_(pool), priority_(priority) {}
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    void run(std::function<void()> task);
+    void run(std::function<void()> task, TaskPriority priority);
+
+    // Returns once every task has finished, running queued tasks meanwhile.
+    void wait();
+
+    // True while no task of the group is queued or running.
+    bool idle();
+
+private:
+    ThreadPool& pool_;
+    TaskPriority priority_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::size_t pending_ = 0;
+    std::exception_ptr error_;
+};
+
+// Runs task(0..count-1) on the pool, the first on the calling thread, and
+// rethrows the first exception once all have finished.
+template <class Task>
+void parallel_for(std::size_t count, Task task, TaskPriority priority = TaskPriority::Normal) {
+    if (count == 0) return;
+    TaskGroup group(priority);
+    for (std::size_t i = 1; i < count; ++i) {
+        group.run([&task, i] { task(i); });
+    }
+    std::exception_ptr first;
+    try {
+        task(0);
+    } catch (...) {
+        first = std::current_exception();
+    }
+    try {
+        group.wait();
+    } catch (...) {
+        if (!first) first = std::current_exception();
+    }
+    if (first) std::rethrow_exception(first);
+}
+
+#endif // THREAD_POOL_H
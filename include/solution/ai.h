@@ -1,23 +1,29 @@
 #pragma once
 
 #include "common.h"
+#include "key.h"
 #include <queue>
 #include <vector>
 #include <string>
 #include <memory>
 #include <functional>
 
-class AiSolution : public Solution {
+/**
+ * @brief Replacement-selection sort; KeyPolicy (see key.h) orders the lines.
+ * The default, WholeLineKey, compares complete lines bytewise.
+ */
+template <class KeyPolicy = WholeLineKey>
+class BasicAiSolution : public Solution {
 public:
     /**
-     * @brief Constructs an AiSolution instance.
+     * @brief Constructs a BasicAiSolution instance.
      * @param first_bucket A reference to the first bucket of temporary files.
      * @param second_bucket A reference to the second bucket of temporary files.
      * @param memory_limit_bytes The strict upper bound for in-memory data structures.
      */
-    AiSolution(std::vector<FileManager>& first_bucket,
-               std::vector<FileManager>& second_bucket,
-               std::size_t memory_limit_bytes);
+    BasicAiSolution(std::vector<FileManager>& first_bucket,
+                    std::vector<FileManager>& second_bucket,
+                    std::size_t memory_limit_bytes);
 
     /**
      * @brief Phase 1: Generates initial sorted runs using the Replacement Selection algorithm.
@@ -46,12 +52,21 @@ private:
      */
     bool is_sorted() const;
 
+    /**
+     * @brief Orders lines by their KeyPolicy keys, greatest first, for use in min-heaps.
+     */
+    struct LineGreater {
+        bool operator()(const std::string& a, const std::string& b) const {
+            return KeyPolicy::less(KeyPolicy::extract(b), KeyPolicy::extract(a));
+        }
+    };
+
     // Type aliases for min-heaps used in sorting logic.
-    using MinHeap = std::priority_queue<std::string, std::vector<std::string>, std::greater<std::string>>;
+    using MinHeap = std::priority_queue<std::string, std::vector<std::string>, LineGreater>;
     using MergeHeapElement = std::pair<std::string, std::size_t>;
     struct MergeHeapComparator {
         bool operator()(const MergeHeapElement& a, const MergeHeapElement& b) const {
-            return a.first > b.first;
+            return LineGreater{}(a.first, b.first);
         }
     };
     using MergeMinHeap = std::priority_queue<MergeHeapElement, std::vector<MergeHeapElement>, MergeHeapComparator>;
@@ -60,3 +75,5 @@ private:
     std::size_t current_memory_usage_;
 };
 
+using AiSolution = BasicAiSolution<>;
+
@@ -0,0 +1,29 @@
+//
+// Fast path for input that fits the memory budget: no temp files at all.
+//
+
+#ifndef EXTERNALSORTINGLAB1_IN_MEMORY_H
+#define EXTERNALSORTINGLAB1_IN_MEMORY_H
+
+#include <cstdint>
+
+#include "io/manager.h"
+#include "key.h"
+
+// Sorts source into output without temp files if it fits memory_budget bytes:
+// the file is read once into one buffer, an index of its lines is built and
+// sorted on `threads` threads (0: one per core), and the lines are written out
+// in one sequential pass. Equal keys keep their input order. Lines are
+// normalised like on the run path (no empty lines, CRLF endings stripped, every
+// line terminated by '\n').
+//
+// Returns false, with output untouched, if source is not a regular file, if the
+// buffer and index would exceed memory_budget (estimated from the start of the
+// file before the rest is read, then checked against the actual line count) or
+// if they cannot be allocated. Throws std::runtime_error on a line that
+// KeyPolicy cannot key.
+template <class KeyPolicy = IntPrefixKey>
+bool sort_in_memory(FileManager& source, FileManager& output, std::uint64_t memory_budget,
+                    unsigned threads = 0, const KeyPolicy& policy = KeyPolicy{});
+
+#endif //EXTERNALSORTINGLAB1_IN_MEMORY_H
@@ -0,0 +1,185 @@
+//
+// Sort-key policies shared by run formation, merging and the presorted scan.
+//
+
+#ifndef EXTERNALSORTINGLAB1_KEY_H
+#define EXTERNALSORTINGLAB1_KEY_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// ---------- fast key parser ----------
+// Parses an optional '-' and the digits that follow. Returns false if there are none.
+template <class Int>
+inline bool try_parse_leading_int(std::string_view s, Int &key) noexcept {
+    const char *p = s.data();
+    const char *end = p + s.size();
+    bool neg = false;
+    if (p < end && *p == '-') { neg = true; ++p; }
+    Int val = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        any = true;
+        val = val * 10 + (*p - '0');
+        ++p;
+    }
+    key = neg ? -val : val;
+    return any;
+}
+
+inline bool try_get_key_sv(std::string_view s, int &key) noexcept {
+    return try_parse_leading_int(s, key);
+}
+
+inline int fast_get_key_sv(std::string_view s) {
+    if (s.empty()) throw std::runtime_error("Cannot extract key from empty line.");
+    int key = 0;
+    if (!try_get_key_sv(s, key)) throw std::runtime_error("Could not extract key from line: " + std::string(s));
+    return key;
+}
+
+// ---------- line endings ----------
+// Drops the '\r' of a CRLF ending. Run formation and the in-memory sort apply it
+// to every line, so also to a last line that has no '\n'; both paths must agree.
+inline std::string_view strip_carriage_return(std::string_view line) noexcept {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    return line;
+}
+
+// ---------- Key policies ----------
+// A key policy is a stateless struct resolved at compile time; the solutions are
+// templated on it, so every comparison below is inlined into the sort kernels.
+//
+//   key_type                 the key of one line (may view into the line)
+//   try_extract(line, key)   parses the key, false if the line has none
+//   extract(line)            same, throws std::runtime_error instead
+//   less(a, b)               strict weak order on keys
+//
+// ModifiedSolution additionally caches an integer per record in its run files:
+//
+//   run_key_type             int32_t or int64_t (see run_format.h)
+//   run_key(key)             order-preserving: less(a, b) implies run_key(a) <= run_key(b)
+//   run_key_exact            true if run_key(a) < run_key(b) is exactly less(a, b),
+//                            otherwise equal run keys are resolved with less()
+//
+// and turns every input line into the record payload that the keys are read from:
+//
+//   ingest(line, scratch, record)   record built at run formation, false if the line
+//                                   cannot be keyed (may use scratch as storage)
+//   record_text(record)             the original line of a record
+//
+// The policies below key the line itself (PlainRecords). A policy may carry state
+// for ingest(); the solutions hold one instance of it.
+
+// Records are the unchanged input lines.
+struct PlainRecords {
+    bool ingest(std::string_view line, std::string &, std::string_view &record) const noexcept {
+        record = line;
+        return true;
+    }
+    static std::string_view record_text(std::string_view record) noexcept { return record; }
+};
+
+template <class Policy>
+inline typename Policy::key_type extract_or_throw(std::string_view line) {
+    if (line.empty()) throw std::runtime_error("Cannot extract key from empty line.");
+    typename Policy::key_type key{};
+    if (!Policy::try_extract(line, key)) {
+        throw std::runtime_error("Could not extract key from line: " + std::string(line));
+    }
+    return key;
+}
+
+// Leading signed integer of the line, e.g. "-42" in "-42-abc-2020/01/01".
+struct IntPrefixKey : PlainRecords {
+    using key_type = std::int32_t;
+    using run_key_type = std::int32_t;
+    static constexpr bool run_key_exact = true;
+
+    static bool try_extract(std::string_view line, key_type &key) noexcept { return try_parse_leading_int(line, key); }
+    static key_type extract(std::string_view line) { return extract_or_throw<IntPrefixKey>(line); }
+    static bool less(key_type a, key_type b) noexcept { return a < b; }
+    static run_key_type run_key(key_type key) noexcept { return key; }
+};
+
+// Leading signed integer that may exceed 32 bits.
+struct Int64PrefixKey : PlainRecords {
+    using key_type = std::int64_t;
+    using run_key_type = std::int64_t;
+    static constexpr bool run_key_exact = true;
+
+    static bool try_extract(std::string_view line, key_type &key) noexcept { return try_parse_leading_int(line, key); }
+    static key_type extract(std::string_view line) { return extract_or_throw<Int64PrefixKey>(line); }
+    static bool less(key_type a, key_type b) noexcept { return a < b; }
+    static run_key_type run_key(key_type key) noexcept { return key; }
+};
+
+// Trailing YYYY/MM/DD field written by the generator, packed as YYYYMMDD.
+struct DateFieldKey : PlainRecords {
+    using key_type = std::int32_t;
+    using run_key_type = std::int32_t;
+    static constexpr bool run_key_exact = true;
+
+    static bool try_extract(std::string_view line, key_type &key) noexcept {
+        constexpr std::size_t DATE_LEN = 10; // YYYY/MM/DD
+        if (line.size() < DATE_LEN) return false;
+        const char *d = line.data() + line.size() - DATE_LEN;
+        if (d[4] != '/' || d[7] != '/') return false;
+        if (line.size() > DATE_LEN && d[-1] != '-') return false;
+        key_type v = 0;
+        for (std::size_t i = 0; i < DATE_LEN; ++i) {
+            if (i == 4 || i == 7) continue;
+            if (d[i] < '0' || d[i] > '9') return false;
+            v = v * 10 + (d[i] - '0');
+        }
+        key = v;
+        return true;
+    }
+    static key_type extract(std::string_view line) { return extract_or_throw<DateFieldKey>(line); }
+    static bool less(key_type a, key_type b) noexcept { return a < b; }
+    static run_key_type run_key(key_type key) noexcept { return key; }
+};
+
+// The whole line, compared bytewise. Run files cache its first four bytes, so
+// most merge comparisons never reach the text.
+struct WholeLineKey : PlainRecords {
+    using key_type = std::string_view;
+    using run_key_type = std::int32_t;
+    static constexpr bool run_key_exact = false;
+
+    static bool try_extract(std::string_view line, key_type &key) noexcept {
+        key = line;
+        return true;
+    }
+    static key_type extract(std::string_view line) noexcept { return line; }
+    static bool less(key_type a, key_type b) noexcept { return a < b; }
+    static run_key_type run_key(key_type key) noexcept {
+        unsigned char prefix[4] = {0, 0, 0, 0};
+        std::memcpy(prefix, key.data(), key.size() < 4 ? key.size() : 4);
+        const std::uint32_t be = (std::uint32_t(prefix[0]) << 24) | (std::uint32_t(prefix[1]) << 16)
+                                 | (std::uint32_t(prefix[2]) << 8) | std::uint32_t(prefix[3]);
+        // Flip the sign bit so that signed order matches unsigned byte order.
+        return static_cast<run_key_type>(be ^ 0x80000000u);
+    }
+};
+
+// Keeps a copy of a key after the line it was taken from has been overwritten;
+// only keys that view into the line need to own their bytes.
+template <class Key>
+struct KeyHolder {
+    Key value{};
+    void assign(Key key) { value = key; }
+    Key get() const { return value; }
+};
+
+template <>
+struct KeyHolder<std::string_view> {
+    std::string value;
+    void assign(std::string_view key) { value.assign(key.data(), key.size()); }
+    std::string_view get() const { return value; }
+};
+
+#endif //EXTERNALSORTINGLAB1_KEY_H
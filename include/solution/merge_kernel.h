@@ -0,0 +1,33 @@
+//
+// Two-way merge of cached run keys, for merge passes that are down to two inputs.
+//
+
+#ifndef EXTERNALSORTINGLAB1_MERGE_KERNEL_H
+#define EXTERNALSORTINGLAB1_MERGE_KERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Only the keys are merged. The result is the order in which to take the
+// records: entry i names the i-th record, as an index into the first input, or
+// into the second with FROM_SECOND set. Payloads then move once, straight to the
+// output, instead of through a heap.
+constexpr std::uint32_t FROM_SECOND = 1u << 31;
+// Longest input merge_two_runs() takes.
+constexpr std::size_t MERGE_KERNEL_MAX_INPUT = FROM_SECOND - 1;
+
+// Merges sorted a[0..na) and b[0..nb), equal keys going to a, until either is
+// used up, and replaces `order` with the merge order. int32 keys are widened to
+// 64-bit lanes together with their index and merged by an AVX2 bitonic network,
+// eight records per step, where the CPU supports it; int64 keys, and CPUs without
+// AVX2, take a branchless scalar loop.
+void merge_two_runs(const std::int32_t* a, std::size_t na, const std::int32_t* b, std::size_t nb,
+                    std::vector<std::uint32_t>& order);
+void merge_two_runs(const std::int64_t* a, std::size_t na, const std::int64_t* b, std::size_t nb,
+                    std::vector<std::uint32_t>& order);
+
+// True if int32 keys take the AVX2 kernel on this machine.
+bool merge_kernel_vectorized();
+
+#endif //EXTERNALSORTINGLAB1_MERGE_KERNEL_H
@@ -9,15 +9,26 @@
 #include <vector>
 #include <string>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
 
 #include "io/reader.h"
+#include "io/run_reader.h"
+#include "io/run_writer.h"
 #include "io/fast_writer.h"
+#include "key.h"
 
-// ---------- In-memory chunk per input file ----------
 // ---------- In-memory segment ----------
+// Holds decoded records of one run file; keys were parsed once during run formation.
+template <class Key>
 struct InMemSegment {
-    std::string buffer; // contiguous storage containing lines (each terminated by '\n')
-    std::vector<std::string_view> lines; // views into buffer
+    std::string buffer; // raw record bytes of one or more blocks
+    std::vector<std::string_view> lines; // payload views into buffer
+    std::vector<Key> keys; // cached run key per line
+    std::vector<std::uint8_t> run_starts; // 1 if the line opens a new sorted run
+    std::vector<std::uint64_t> counts; // collapsed lines per record; empty while all are 1
     std::size_t next_index = 0;
 
     bool has_next() const { return next_index < lines.size(); }
@@ -25,45 +36,210 @@ struct InMemSegment {
         assert(has_next());
         return lines[next_index];
     }
+    Key peek_key() const {
+        assert(has_next());
+        return keys[next_index];
+    }
+    bool peek_starts_run() const {
+        assert(has_next());
+        return run_starts[next_index] != 0;
+    }
+    std::uint64_t peek_count() const {
+        assert(has_next());
+        return counts.empty() ? 1 : counts[next_index];
+    }
     std::string_view pop() {
         assert(has_next());
         return lines[next_index++];
     }
+    // Index of the first record after the next one that opens a run, lines.size()
+    // if none does. Found with memchr and kept until next_index passes it.
+    std::size_t run_end() {
+        assert(has_next());
+        if (run_end_ <= next_index) {
+            const std::size_t from = next_index + 1;
+            const void *p = std::memchr(run_starts.data() + from, 1, run_starts.size() - from);
+            run_end_ = p ? static_cast<std::size_t>(static_cast<const std::uint8_t *>(p) - run_starts.data())
+                         : lines.size();
+        }
+        return run_end_;
+    }
+    // The encoded records [from, to) as they lie in buffer (run_format record
+    // layout): the segment decodes in place, so they are contiguous.
+    std::string_view encoded(std::size_t from, std::size_t to) const {
+        assert(from < to && to <= lines.size());
+        const char *begin = from == 0 ? buffer.data() : lines[from - 1].data() + lines[from - 1].size();
+        const char *end = lines[to - 1].data() + lines[to - 1].size();
+        return std::string_view(begin, static_cast<std::size_t>(end - begin));
+    }
     void clear() {
         // keep capacity to avoid frequent reallocations; clear contents
+        run_end_ = 0;
         buffer.clear();
         lines.clear();
+        keys.clear();
+        run_starts.clear();
+        counts.clear();
         next_index = 0;
     }
+    void release() {
+        // clear() and return the memory, e.g. after the budget shrank
+        *this = InMemSegment{};
+    }
     std::size_t memory_usage() const {
-        return buffer.capacity() + lines.capacity() * sizeof(std::string_view);
+        return buffer.capacity() + lines.capacity() * sizeof(std::string_view)
+               + keys.capacity() * sizeof(Key) + run_starts.capacity()
+               + counts.capacity() * sizeof(std::uint64_t);
     }
+
+private:
+    std::size_t run_end_ = 0;
+};
+
+// Duplicate handling of ModifiedSolution::sort(). Equal records are collapsed
+// while runs are formed and again in every merge, so duplicates stop costing I/O
+// after the first pass.
+enum class DedupMode {
+    None,        // keep every line
+    Unique,      // keep one copy of identical lines; lines of equal key come out in byte order
+    UniqueByKey, // keep the first line seen of each key
+    Count        // like UniqueByKey, and append "\t<number of lines>" to each line
+};
+
+// Tuning switches for ModifiedSolution.
+struct SortOptions {
+    bool compress_runs = false; // block-compress temporary runs (see io/block_codec.h)
+    DedupMode dedup = DedupMode::None;
+    unsigned threads = 0; // parsing and sorting threads; 0: one per core
+};
+
+template <class KeyPolicy>
+class BasicModifiedSolution;
+
+// Lazy view of a sort result: every next() advances the last k-way merge by one
+// line, so a consumer can work on the sorted lines as they are produced and no
+// output file is written or read back. Obtained from
+// BasicModifiedSolution::sorted_stream(); it reads the solution's bucket files,
+// so the solution must outlive it and sort nothing else meanwhile.
+template <class KeyPolicy>
+class BasicSortedStream {
+public:
+    BasicSortedStream(BasicSortedStream&&) noexcept;
+    BasicSortedStream& operator=(BasicSortedStream&&) noexcept;
+    ~BasicSortedStream();
+
+    // Sets line to the next line of the result (valid until the following call)
+    // and returns false once the result is exhausted.
+    bool next(std::string_view& line);
+
+    // Input lines the last line stands for under DedupMode::Count, 1 otherwise.
+    std::uint64_t count() const;
+
+private:
+    friend class BasicModifiedSolution<KeyPolicy>;
+    struct State;
+    explicit BasicSortedStream(std::unique_ptr<State> state);
+
+    std::unique_ptr<State> state_;
 };
 
-class ModifiedSolution {
+// KeyPolicy (see key.h) fixes the sort key at compile time; each policy gets its
+// own instantiation of run formation and the merge kernels.
+template <class KeyPolicy>
+class BasicModifiedSolution {
 public:
-    explicit ModifiedSolution(std::vector<FileManager>& first_bucket,
-                         std::vector<FileManager>& second_bucket);
+    using key_type = typename KeyPolicy::key_type;
+    using run_key_type = typename KeyPolicy::run_key_type;
+    using Segment = InMemSegment<run_key_type>;
+    using RunReader = BasicRunReader<run_key_type>;
+    using RunWriter = BasicRunWriter<run_key_type>;
+    using SortedStream = BasicSortedStream<KeyPolicy>;
+
+    explicit BasicModifiedSolution(std::vector<FileManager>& first_bucket,
+                                   std::vector<FileManager>& second_bucket,
+                                   SortOptions options = {},
+                                   KeyPolicy policy = KeyPolicy{});
 
     void load_initial_series(FileManager& source);
 
+    // Complete sort of source into output. Input that is already in key order, or
+    // in reverse key order, is detected up front and written without temp files,
+    // and so is input that fits the memory budget (see in_memory.h).
+    // Either end may be a pipe (FileManager::standard_input/standard_output): the
+    // input is then read once and the final merge pass streams into the output.
+    void sort(FileManager& source, FileManager& output);
+
+    // Writes the k smallest lines of source, in key order, to output (truncated
+    // first). The input is read once: lines that can no longer be among the k
+    // smallest are dropped on sight, and only when the candidates outgrow memory
+    // are they spilled as sorted runs and merged. Duplicates are kept: throws
+    // std::invalid_argument if SortOptions::dedup is set.
+    void top_k(FileManager& source, FileManager& output, std::uint64_t k);
+
+    // Forms the runs of source and merges until one pass is left, which the
+    // returned stream performs as it is read. Honours SortOptions::dedup.
+    SortedStream sorted_stream(FileManager& source);
+
+    // Sorts into one of the bucket files and returns it.
     const FileManager& external_sort();
 
+    // Sorts with the final pass writing straight into `output` (truncated first),
+    // which saves copying the result out of the bucket files afterwards.
+    void external_sort(FileManager& output);
+    void external_sort(const std::string& output_path);
+
 protected:
-    // Helper methods are virtual to allow overriding by derived classes.
-    void merge_many_into_many(std::vector<FileManager>* cur_fileset,
-                                     std::vector<FileManager>* opposite_fileset);
+    // Cuts source into chunks of the memory budget, sorts each, and writes them
+    // round-robin over the sinks; a chunk that starts at or above the end of the
+    // previous one continues its run. Writing overlaps with parsing the next
+    // chunk. A regular file is parsed in parallel byte ranges with positional
+    // reads (SortOptions::threads), a stream by one thread behind a reader thread.
+    template <class Sink>
+    void form_initial_runs(FileManager& source, std::vector<Sink*>& sinks);
 
+    // Runs merge passes until the text result has been written to final_output,
+    // or to a free bucket file if it is null. Returns the file holding the result.
+    const FileManager& sort_into(FileManager* final_output);
+
+    // Runs the merge passes before the last one and returns the bucket whose
+    // files now hold at most one run each.
+    std::vector<FileManager>* merge_until_last_pass();
+
+    // Merges every run group of cur_fileset into opposite_fileset and returns the
+    // number of runs written to each output file. If final_output is set, this is
+    // the last pass and it writes the text result there instead.
+    std::vector<std::size_t> merge_many_into_many(std::vector<FileManager>* cur_fileset,
+                                                  std::vector<FileManager>* opposite_fileset,
+                                                  FileManager* final_output);
+
+    // Merges the current run of every input into one output run. Sink is either
+    // a BasicRunWriter (intermediate passes) or a text sink (final pass), one of
+    // sink_count outputs sharing the writer budget. Segments and the sink's buffer
+    // are sized to the current memory budget at every refill. Once only two inputs
+    // are left and the run key orders alone, merge_two_runs() replaces the heap;
+    // in DedupMode::Unique equal keys are ordered by record, so it never does.
+    template <class Sink>
     void merge_many_into_one(
-    std::vector<std::unique_ptr<Reader>>& readers,
-    std::vector<InMemSegment>& segments,
-    FastWriterWrapper& out_writer,
-    std::size_t per_file_budget);
+    std::vector<std::unique_ptr<RunReader>>& readers,
+    std::vector<Segment>& segments,
+    Sink& out_writer,
+    std::size_t sink_count);
 
 private:
     // Member variables are non-const references to the file buckets.
     std::vector<FileManager>& first_bucket_;
     std::vector<FileManager>& second_bucket_;
+    SortOptions options_;
+    KeyPolicy policy_;
+    // Runs per file of first_bucket_ after load_initial_series.
+    std::vector<std::size_t> initial_runs_;
+    // Size of the text result, used to preallocate the output file.
+    std::uint64_t total_text_bytes_ = 0;
+    // Lines the final pass may write; only top_k() lowers it.
+    std::uint64_t output_limit_ = std::numeric_limits<std::uint64_t>::max();
 };
 
+using ModifiedSolution = BasicModifiedSolution<IntPrefixKey>;
+using SortedStream = BasicSortedStream<IntPrefixKey>;
+
 #endif //EXTERNALSORTINGLAB1_MODIFIED_H
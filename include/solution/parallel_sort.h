@@ -0,0 +1,46 @@
+//
+// Multi-core sort of an index vector on the shared thread pool.
+//
+
+#ifndef EXTERNALSORTINGLAB1_PARALLEL_SORT_H
+#define EXTERNALSORTINGLAB1_PARALLEL_SORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "io/thread_pool.h"
+
+// Slices smaller than this are not worth a task of their own.
+constexpr std::size_t PARALLEL_SORT_MIN_ENTRIES = 1 << 16;
+
+// Sorts up to `threads` slices in parallel, then merges neighbouring slices
+// pairwise, each round in parallel, until one is left. Needs a second vector of
+// entries.size() while merging. Not stable.
+template <class Entry, class Less>
+void parallel_sort(std::vector<Entry> &entries, unsigned threads, Less less) {
+    const std::size_t n = entries.size();
+    const std::size_t chunks = std::max<std::size_t>(1, std::min<std::size_t>(threads, n / PARALLEL_SORT_MIN_ENTRIES));
+    std::vector<std::size_t> bounds(chunks + 1);
+    for (std::size_t i = 0; i <= chunks; ++i) bounds[i] = n * i / chunks;
+
+    parallel_for(chunks, [&](std::size_t i) {
+        std::sort(entries.begin() + bounds[i], entries.begin() + bounds[i + 1], less);
+    });
+    if (chunks == 1) return;
+
+    std::vector<Entry> merged(n);
+    for (std::size_t width = 1; width < chunks; width *= 2) {
+        const std::size_t pairs = (chunks + 2 * width - 1) / (2 * width);
+        parallel_for(pairs, [&](std::size_t pair) {
+            const std::size_t lo = bounds[pair * 2 * width];
+            const std::size_t mid = bounds[std::min(chunks, pair * 2 * width + width)];
+            const std::size_t hi = bounds[std::min(chunks, pair * 2 * width + 2 * width)];
+            std::merge(entries.begin() + lo, entries.begin() + mid, entries.begin() + mid, entries.begin() + hi,
+                       merged.begin() + lo, less);
+        });
+        entries.swap(merged);
+    }
+}
+
+#endif //EXTERNALSORTINGLAB1_PARALLEL_SORT_H
@@ -0,0 +1,31 @@
+//
+// Fast path for input that is already in key order, or in reverse key order.
+//
+
+#ifndef EXTERNALSORTINGLAB1_PRESORTED_H
+#define EXTERNALSORTINGLAB1_PRESORTED_H
+
+#include "io/manager.h"
+#include "key.h"
+
+enum class InputOrder { Unsorted, Ascending, Descending };
+
+// Scans source in parallel byte ranges (threads == 0: one per core) and reports
+// whether its keys, under KeyPolicy (see key.h), are non-decreasing or strictly
+// decreasing: reversed, equal keys would lose their input order. Lines that the
+// regular path would normalise (empty lines, CRLF endings, lines without a key)
+// make the input count as Unsorted.
+template <class KeyPolicy = IntPrefixKey>
+InputOrder detect_input_order(FileManager& source, unsigned threads = 0, const KeyPolicy& policy = KeyPolicy{});
+
+// Writes the lines of source to the cursor of output in reverse order, reading
+// the source backwards in large blocks. Every line is terminated by '\n'.
+void write_reversed_lines(FileManager& source, FileManager& output);
+
+// If source needs no sorting, replaces output with the sorted result and returns
+// true: a reflink or kernel copy for ascending input, a block-wise reversal for
+// descending input. Returns false (output untouched) otherwise.
+template <class KeyPolicy = IntPrefixKey>
+bool write_if_presorted(FileManager& source, FileManager& output, const KeyPolicy& policy = KeyPolicy{});
+
+#endif //EXTERNALSORTINGLAB1_PRESORTED_H
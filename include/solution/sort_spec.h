@@ -0,0 +1,136 @@
+//
+// Multi-field sort order with memcmp-comparable normalized keys.
+//
+
+#ifndef EXTERNALSORTINGLAB1_SORT_SPEC_H
+#define EXTERNALSORTINGLAB1_SORT_SPEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "key.h"
+
+/**
+ * @class SortSpec
+ * @brief Ordered list of fields of a generator line (NUM-alpha-YYYY/MM/DD) to sort by.
+ *
+ * encode() turns the selected fields into one normalized byte string whose
+ * memcmp order is the requested order:
+ *  - num:   leading signed int32, 4 bytes big-endian with the sign bit flipped
+ *  - date:  YYYYMMDD, 4 bytes big-endian
+ *  - alpha: the letters, 0x00 escaped as 0x00 0x01, terminated by 0x00 0x00
+ * Descending fields have all of their bytes inverted.
+ */
+class SortSpec {
+public:
+    enum class Field { Number, Alpha, Date };
+
+    struct Column {
+        Field field;
+        bool descending;
+    };
+
+    SortSpec() = default;
+
+    // Parses a comma-separated list such as "date,num" or "alpha:desc,num".
+    // Field names: num, alpha, date; suffix ":asc" (default) or ":desc".
+    // Throws std::invalid_argument on an unknown field or an empty spec.
+    static SortSpec parse(std::string_view text);
+
+    // Appends the normalized key of line to out. Returns false (out unspecified)
+    // if the line does not have the shape NUM-alpha-YYYY/MM/DD.
+    bool encode(std::string_view line, std::string& out) const;
+
+    const std::vector<Column>& columns() const { return columns_; }
+
+private:
+    std::vector<Column> columns_;
+};
+
+/**
+ * @brief Key policy (see key.h) that sorts by a SortSpec.
+ *
+ * ingest() builds each record once, at run formation, as
+ *
+ *   [varint key_len][normalized key][original line]
+ *
+ * so merges compare the cached 64-bit key prefix and, only when that ties, one
+ * memcmp of the normalized keys. No field is parsed again after ingest.
+ */
+class NormalizedKey {
+public:
+    using key_type = std::string_view;
+    using run_key_type = std::int64_t;
+    static constexpr bool run_key_exact = false;
+
+    NormalizedKey() = default;
+    explicit NormalizedKey(SortSpec spec) : spec_(std::move(spec)) {}
+
+    bool ingest(std::string_view line, std::string& scratch, std::string_view& record) const {
+        constexpr std::size_t HEAD = 10; // room for the key length varint
+        scratch.assign(HEAD, '\0');
+        if (!spec_.encode(line, scratch)) return false;
+        std::uint64_t key_len = scratch.size() - HEAD;
+        char len_bytes[HEAD];
+        std::size_t n = 0;
+        do {
+            len_bytes[n++] = static_cast<char>((key_len & 0x7F) | (key_len >= 0x80 ? 0x80 : 0));
+            key_len >>= 7;
+        } while (key_len != 0);
+        std::memcpy(&scratch[HEAD - n], len_bytes, n);
+        scratch.append(line.data(), line.size());
+        record = std::string_view(scratch).substr(HEAD - n);
+        return true;
+    }
+
+    static std::string_view record_text(std::string_view record) noexcept {
+        std::string_view key;
+        std::size_t header = 0;
+        if (!split(record, key, header)) return record;
+        return record.substr(header + key.size());
+    }
+
+    static bool try_extract(std::string_view record, key_type& key) noexcept {
+        std::size_t header = 0;
+        return split(record, key, header);
+    }
+    static key_type extract(std::string_view record) { return extract_or_throw<NormalizedKey>(record); }
+
+    // std::string_view compares bytes as unsigned char, exactly like memcmp.
+    static bool less(key_type a, key_type b) noexcept { return a < b; }
+
+    // First eight key bytes, big-endian, with the sign bit flipped for signed order.
+    static run_key_type run_key(key_type key) noexcept {
+        unsigned char prefix[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        std::memcpy(prefix, key.data(), key.size() < 8 ? key.size() : 8);
+        std::uint64_t be = 0;
+        for (unsigned char b : prefix) be = (be << 8) | b;
+        return static_cast<run_key_type>(be ^ 0x8000000000000000ull);
+    }
+
+    const SortSpec& spec() const { return spec_; }
+
+private:
+    static bool split(std::string_view record, std::string_view& key, std::size_t& header) noexcept {
+        std::uint64_t len = 0;
+        unsigned shift = 0;
+        for (std::size_t i = 0; i < record.size() && shift < 64; shift += 7) {
+            const auto byte = static_cast<unsigned char>(record[i++]);
+            len |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                if (len > record.size() - i) return false;
+                header = i;
+                key = record.substr(i, static_cast<std::size_t>(len));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    SortSpec spec_;
+};
+
+#endif //EXTERNALSORTINGLAB1_SORT_SPEC_H
@@ -10,21 +10,28 @@
 #include <string>
 
 #include "io/reader.h"
+#include "key.h"
 
 
 // Forward-declare the classes from your API to reduce header dependencies.
 class FileManager;
 class BufferedWriter;
 
-class StdSolution final : public Solution {
+// KeyPolicy (see key.h) selects the sort key at compile time.
+template <class KeyPolicy>
+class BasicStdSolution final : public Solution {
 public:
+    using key_type = typename KeyPolicy::key_type;
+
     // Constructor now takes non-const references to allow file modification (e.g., clear).
-    explicit StdSolution(std::vector<FileManager>& first_bucket,
-                         std::vector<FileManager>& second_bucket);
+    explicit BasicStdSolution(std::vector<FileManager>& first_bucket,
+                              std::vector<FileManager>& second_bucket);
 
-    void load_initial_series(FileManager& source) override;
+    // Splits the input into ascending runs, dealt round-robin over the first bucket.
+    void load_initial_series(Reader& reader) override;
 
-    const FileManager& external_sort() override;
+    // Merges the runs until one file holds them all and returns that file.
+    FileManager& external_sort() override;
 
 protected:
     // Helper methods are virtual to allow overriding by derived classes.
@@ -35,12 +42,9 @@ protected:
         std::vector<std::unique_ptr<Reader>>& readers,
         std::vector<std::optional<std::string>>& lookahead_lines,
         BufferedWriter& out_file);
-
-private:
-    // Member variables are non-const references to the file buckets.
-    std::vector<FileManager>& first_bucket_;
-    std::vector<FileManager>& second_bucket_;
 };
 
+using StdSolution = BasicStdSolution<IntPrefixKey>;
+
 #endif //EXTERNALSORTINGLAB1_STANDARD_H
 
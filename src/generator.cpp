@@ -151,7 +151,8 @@ void produce_chunks(ChunkQueue &q,
 }
 
 void writer_thread_func(ChunkQueue &q, const char *filename, std::atomic<uint64_t> &written_bytes, uint64_t target_bytes) {
-    FILE *f = std::fopen(filename, "wb");
+    const bool to_stdout = std::strcmp(filename, "-") == 0;
+    FILE *f = to_stdout ? stdout : std::fopen(filename, "wb");
     if (!f) {
         std::perror("fopen");
         q.set_finished();
@@ -177,7 +178,7 @@ void writer_thread_func(ChunkQueue &q, const char *filename, std::atomic<uint64_
     }
 
     std::fflush(f);
-    std::fclose(f);
+    if (!to_stdout) std::fclose(f);
     q.set_finished(); // in case producers or consumers are still waiting
 }
 
@@ -246,6 +247,8 @@ int main(int argc, char** argv) {
 
     if (writer.joinable()) writer.join();
 
-    std::cout << "Requested bytes: " << target_bytes << ", written: " << written_bytes.load() << '\n';
+    // With "-" stdout carries the data, so the summary goes to stderr.
+    std::ostream &log = std::strcmp(filename, "-") == 0 ? std::cerr : std::cout;
+    log << "Requested bytes: " << target_bytes << ", written: " << written_bytes.load() << '\n';
     return 0;
 }
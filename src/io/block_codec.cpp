@@ -0,0 +1,250 @@
+#include "../../include/io/block_codec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace block_codec {
+
+static constexpr unsigned char MODE_STORED = 0;
+static constexpr unsigned char MODE_HUFFMAN = 1;
+static constexpr std::size_t SYMBOLS = 256;
+static constexpr std::size_t LENGTHS_SIZE = SYMBOLS / 2;
+static constexpr std::size_t TABLE_SIZE = std::size_t(1) << MAX_CODE_BITS;
+
+using Lengths = std::array<std::uint8_t, SYMBOLS>;
+using Codes = std::array<std::uint16_t, SYMBOLS>;
+
+static inline std::uint64_t load64(const char* p) {
+    std::uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store64(char* p, std::uint64_t v) {
+    std::memcpy(p, &v, sizeof(v));
+}
+
+// Plain Huffman construction; depths are recomputed from parent links.
+static unsigned build_lengths_once(const std::array<std::uint64_t, SYMBOLS>& freq, Lengths& lengths) {
+    using Node = std::pair<std::uint64_t, int>;
+    std::priority_queue<Node, std::vector<Node>, std::greater<>> pq;
+    std::vector<int> parent(2 * SYMBOLS, -1);
+
+    for (std::size_t s = 0; s < SYMBOLS; ++s) {
+        if (freq[s] > 0) pq.emplace(freq[s], static_cast<int>(s));
+    }
+    lengths.fill(0);
+    if (pq.size() == 1) {
+        lengths[pq.top().second] = 1;
+        return 1;
+    }
+
+    int next = static_cast<int>(SYMBOLS);
+    while (pq.size() > 1) {
+        Node a = pq.top(); pq.pop();
+        Node b = pq.top(); pq.pop();
+        parent[a.second] = next;
+        parent[b.second] = next;
+        pq.emplace(a.first + b.first, next++);
+    }
+
+    unsigned max_len = 0;
+    for (std::size_t s = 0; s < SYMBOLS; ++s) {
+        if (freq[s] == 0) continue;
+        unsigned depth = 0;
+        for (int n = static_cast<int>(s); parent[n] != -1; n = parent[n]) ++depth;
+        lengths[s] = static_cast<std::uint8_t>(depth);
+        max_len = std::max(max_len, depth);
+    }
+    return max_len;
+}
+
+// Flattens the distribution until every code fits in MAX_CODE_BITS.
+static void build_lengths(std::array<std::uint64_t, SYMBOLS> freq, Lengths& lengths) {
+    while (build_lengths_once(freq, lengths) > MAX_CODE_BITS) {
+        for (auto& f : freq) {
+            if (f > 0) f = (f >> 1) | 1;
+        }
+    }
+}
+
+// Canonical codes, bit-reversed for the LSB-first stream.
+static void build_codes(const Lengths& lengths, Codes& codes) {
+    std::array<unsigned, MAX_CODE_BITS + 1> count{};
+    for (auto len : lengths) count[len]++;
+    count[0] = 0;
+
+    std::array<unsigned, MAX_CODE_BITS + 1> next_code{};
+    unsigned code = 0;
+    for (unsigned len = 1; len <= MAX_CODE_BITS; ++len) {
+        code = (code + count[len - 1]) << 1;
+        next_code[len] = code;
+    }
+
+    codes.fill(0);
+    for (std::size_t s = 0; s < SYMBOLS; ++s) {
+        const unsigned len = lengths[s];
+        if (len == 0) continue;
+        unsigned c = next_code[len]++;
+        unsigned reversed = 0;
+        for (unsigned i = 0; i < len; ++i) {
+            reversed = (reversed << 1) | (c & 1u);
+            c >>= 1;
+        }
+        codes[s] = static_cast<std::uint16_t>(reversed);
+    }
+}
+
+static void append_stored(const char* src, std::size_t len, std::string& out, std::size_t out_start) {
+    out.resize(out_start);
+    out.push_back(static_cast<char>(MODE_STORED));
+    out.append(src, len);
+}
+
+void compress(const char* src, std::size_t len, std::string& out) {
+    const std::size_t out_start = out.size();
+    if (len < LENGTHS_SIZE) {
+        append_stored(src, len, out, out_start);
+        return;
+    }
+
+    std::array<std::uint64_t, SYMBOLS> freq{};
+    for (std::size_t i = 0; i < len; ++i) freq[static_cast<unsigned char>(src[i])]++;
+
+    Lengths lengths{};
+    Codes codes{};
+    build_lengths(freq, lengths);
+    build_codes(lengths, codes);
+
+    std::uint64_t total_bits = 0;
+    for (std::size_t s = 0; s < SYMBOLS; ++s) total_bits += freq[s] * lengths[s];
+    const std::size_t encoded_size = 1 + LENGTHS_SIZE + static_cast<std::size_t>((total_bits + 7) / 8);
+    if (encoded_size >= len + 1) {
+        append_stored(src, len, out, out_start);
+        return;
+    }
+
+    // Encode into pre-sized storage; the 8 spare bytes absorb the final word store.
+    out.resize(out_start + encoded_size + 8);
+    char* w = &out[out_start];
+    *w++ = static_cast<char>(MODE_HUFFMAN);
+    for (std::size_t s = 0; s < SYMBOLS; s += 2) {
+        *w++ = static_cast<char>(lengths[s] | (lengths[s + 1] << 4));
+    }
+
+    // Four codes (<= 44 bits) on top of < 8 pending bits always fit the 64-bit
+    // accumulator, so the flush is unconditional and branch-free. Kept free of
+    // lambdas: captured locals would alias the char stores and be reloaded.
+    std::uint64_t acc = 0;
+    unsigned bits = 0;
+    const auto* in = reinterpret_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+    for (; i < len; ) {
+        const std::size_t batch = std::min<std::size_t>(4, len - i);
+        for (std::size_t k = 0; k < batch; ++k, ++i) {
+            acc |= static_cast<std::uint64_t>(codes[in[i]]) << bits;
+            bits += lengths[in[i]];
+        }
+        store64(w, acc);
+        const unsigned bytes = bits >> 3;
+        w += bytes;
+        acc >>= bytes * 8;
+        bits &= 7;
+    }
+    if (bits > 0) *w++ = static_cast<char>(acc & 0xFF);
+    out.resize(static_cast<std::size_t>(w - out.data()));
+}
+
+void decompress(const char* src, std::size_t len, char* dst, std::size_t dst_len) {
+    if (len == 0) {
+        throw std::runtime_error("Corrupted compressed block: empty stream.");
+    }
+    const auto mode = static_cast<unsigned char>(src[0]);
+    const char* p = src + 1;
+    const char* end = src + len;
+
+    if (mode == MODE_STORED) {
+        if (static_cast<std::size_t>(end - p) != dst_len) {
+            throw std::runtime_error("Corrupted compressed block: stored size mismatch.");
+        }
+        std::memcpy(dst, p, dst_len);
+        return;
+    }
+    if (mode != MODE_HUFFMAN || static_cast<std::size_t>(end - p) < LENGTHS_SIZE) {
+        throw std::runtime_error("Corrupted compressed block: bad header.");
+    }
+
+    Lengths lengths{};
+    for (std::size_t i = 0; i < LENGTHS_SIZE; ++i) {
+        const auto b = static_cast<unsigned char>(p[i]);
+        lengths[2 * i] = b & 0x0F;
+        lengths[2 * i + 1] = b >> 4;
+    }
+    p += LENGTHS_SIZE;
+
+    Codes codes{};
+    build_codes(lengths, codes);
+
+    // Each entry: symbol << 4 | code length; length 0 marks an invalid code.
+    std::vector<std::uint16_t> table(TABLE_SIZE, 0);
+    for (std::size_t s = 0; s < SYMBOLS; ++s) {
+        const unsigned l = lengths[s];
+        if (l == 0) continue;
+        if (l > MAX_CODE_BITS) throw std::runtime_error("Corrupted compressed block: bad code length.");
+        for (std::size_t i = codes[s]; i < TABLE_SIZE; i += std::size_t(1) << l) {
+            table[i] = static_cast<std::uint16_t>((s << 4) | l);
+        }
+    }
+
+    // LSB-first bit buffer; a refill leaves at least 56 valid bits, enough for
+    // CODES_PER_REFILL codes. The fast path needs 8 readable input bytes.
+    constexpr std::size_t CODES_PER_REFILL = 56 / MAX_CODE_BITS;
+    std::uint64_t acc = 0;
+    unsigned bits = 0;
+    std::size_t out = 0;
+    bool invalid = false;
+
+    while (dst_len - out >= CODES_PER_REFILL && end - p >= 8) {
+        acc |= load64(p) << bits;
+        p += (63 - bits) >> 3;
+        bits |= 56;
+        for (std::size_t k = 0; k < CODES_PER_REFILL; ++k) {
+            const std::uint16_t entry = table[acc & (TABLE_SIZE - 1)];
+            const unsigned l = entry & 0x0F;
+            invalid |= (l == 0);
+            dst[out++] = static_cast<char>(entry >> 4);
+            acc >>= l;
+            bits -= l;
+        }
+    }
+
+    std::size_t padding = 0;
+    while (out < dst_len && !invalid) {
+        while (bits <= 56) {
+            if (p < end) {
+                acc |= static_cast<std::uint64_t>(static_cast<unsigned char>(*p++)) << bits;
+            } else if (++padding > 16) {
+                throw std::runtime_error("Corrupted compressed block: bit stream overrun.");
+            }
+            bits += 8;
+        }
+        const std::uint16_t entry = table[acc & (TABLE_SIZE - 1)];
+        const unsigned l = entry & 0x0F;
+        invalid |= (l == 0);
+        dst[out++] = static_cast<char>(entry >> 4);
+        acc >>= l;
+        bits -= l;
+    }
+    if (invalid) {
+        throw std::runtime_error("Corrupted compressed block: invalid code.");
+    }
+}
+
+} // namespace block_codec
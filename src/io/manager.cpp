@@ -1,8 +1,13 @@
 #include "../include/io/manager.h"
+#include "../include/io/temp_storage.h"
+#include "../include/io/metrics.h"
 
 #include <system_error>
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
+#include <utility>
+#include <vector>
 
 #ifdef _WIN32
   #include <fileapi.h>
@@ -14,10 +19,24 @@
 #else
   #include <fcntl.h>
   #include <unistd.h>
+  #include <sys/ioctl.h>
   #include <sys/stat.h>
   #include <sys/types.h>
   #include <cstdio>
 #endif
+#if defined(__linux__)
+  #include <linux/fs.h>
+  #include <sys/mman.h>
+#endif
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  #define FILE_MANAGER_HAVE_MEMFD 1
+#endif
+#if defined(__linux__) && defined(O_DIRECT)
+  #define FILE_MANAGER_HAVE_O_DIRECT 1
+#endif
+
+// Bounce buffer of direct_io() files, and the most a direct transfer moves per system call.
+static constexpr std::size_t DIRECT_BOUNCE_SIZE = 1 << 20;
 
 FileManager::FileManager(const std::string& path, bool create_if_missing, unsigned mode)
     : handle_(),
@@ -28,29 +47,340 @@ FileManager::FileManager(const std::string& path, bool create_if_missing, unsign
     open_impl(create_if_missing);
 }
 
+FileManager::FileManager(native_handle_t handle, std::string name)
+    : handle_(handle),
+      path_(std::move(name)),
+      mode_(0),
+      opened_(true)
+{
+}
+
+#ifdef _WIN32
+static HANDLE duplicate_std_handle(DWORD which) {
+    HANDLE dup = INVALID_HANDLE_VALUE;
+    if (!DuplicateHandle(GetCurrentProcess(), GetStdHandle(which), GetCurrentProcess(), &dup,
+                         0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "DuplicateHandle failed");
+    }
+    return dup;
+}
+
+FileManager FileManager::standard_input() { return FileManager(duplicate_std_handle(STD_INPUT_HANDLE), "<stdin>"); }
+FileManager FileManager::standard_output() { return FileManager(duplicate_std_handle(STD_OUTPUT_HANDLE), "<stdout>"); }
+#else
+static int duplicate_std_handle(int fd) {
+    const int dup = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup == -1) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "dup failed");
+    }
+    return dup;
+}
+
+FileManager FileManager::standard_input() { return FileManager(duplicate_std_handle(STDIN_FILENO), "<stdin>"); }
+FileManager FileManager::standard_output() { return FileManager(duplicate_std_handle(STDOUT_FILENO), "<stdout>"); }
+#endif
+
+FileManager FileManager::temporary(const std::string& spill_path, std::shared_ptr<TempQuota> quota) {
+#ifdef FILE_MANAGER_HAVE_MEMFD
+    const int fd = ::memfd_create(spill_path.c_str(), MFD_CLOEXEC);
+    if (fd != -1) {
+        FileManager fm(fd, spill_path);
+        fm.mode_ = 0644;
+        fm.quota_ = std::move(quota);
+        fm.in_memory_ = true;
+        return fm;
+    }
+    // ENOSYS, EMFILE...: start on disk instead.
+#endif
+    FileManager fm(spill_path, true, 0644);
+    fm.quota_ = std::move(quota);
+    return fm;
+}
+
 FileManager::~FileManager() {
-    close_impl();
+    discard();
 }
 
 FileManager::FileManager(FileManager&& other) noexcept
-    : handle_(other.handle_), path_(std::move(other.path_)), mode_(other.mode_), opened_(other.opened_) {
+    : handle_(other.handle_), path_(std::move(other.path_)), mode_(other.mode_), opened_(other.opened_),
+      quota_(std::move(other.quota_)), charged_(other.charged_), in_memory_(other.in_memory_),
+      direct_handle_(other.direct_handle_), direct_(other.direct_), bounce_(std::move(other.bounce_)) {
     other.handle_ = native_handle_t();
     other.opened_ = false;
+    other.charged_ = 0;
+    other.in_memory_ = false;
+    other.direct_ = false;
 }
 
 FileManager& FileManager::operator=(FileManager&& other) noexcept {
     if (this != &other) {
-        close_impl();
+        discard();
         handle_ = other.handle_;
         path_ = std::move(other.path_);
         mode_ = other.mode_;
         opened_ = other.opened_;
+        quota_ = std::move(other.quota_);
+        charged_ = other.charged_;
+        in_memory_ = other.in_memory_;
+        direct_handle_ = other.direct_handle_;
+        direct_ = other.direct_;
+        bounce_ = std::move(other.bounce_);
         other.handle_ = native_handle_t();
         other.opened_ = false;
+        other.charged_ = 0;
+        other.in_memory_ = false;
+        other.direct_ = false;
     }
     return *this;
 }
 
+bool FileManager::in_memory() const noexcept { return in_memory_; }
+
+void FileManager::release_quota() noexcept {
+    if (quota_ && charged_ > 0) quota_->release(charged_);
+    charged_ = 0;
+}
+
+// A spilled temporary() file is scratch data: it goes away with its FileManager.
+void FileManager::discard() noexcept {
+    const bool remove_spill = opened_ && quota_ && !in_memory_;
+    close_impl();
+    if (remove_spill) std::remove(path_.c_str());
+}
+
+void FileManager::will_write(std::uint64_t len) {
+#ifdef FILE_MANAGER_HAVE_MEMFD
+    if (!in_memory_ || len == 0) return;
+    const off_t cursor = ::lseek(handle_, 0, SEEK_CUR);
+    if (cursor == (off_t)-1) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "lseek failed");
+    }
+    const std::uint64_t end = static_cast<std::uint64_t>(cursor) + len;
+    if (end <= charged_) return;
+    if (quota_->try_charge(end - charged_)) {
+        charged_ = end;
+        return;
+    }
+    spill_to_disk();
+#else
+    (void)len;
+#endif
+}
+
+// Copies the memory file to path_ and swaps the disk file in under the same
+// handle number, so code holding native_handle() keeps working.
+void FileManager::spill_to_disk() {
+#ifdef FILE_MANAGER_HAVE_MEMFD
+    const int disk = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, static_cast<mode_t>(mode_));
+    if (disk == -1) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "open failed: " + path_);
+    }
+    try {
+        const off_t cursor = ::lseek(handle_, 0, SEEK_CUR);
+        const std::uint64_t total = size();
+        std::vector<char> buf(1 << 20);
+        for (std::uint64_t done = 0; done < total;) {
+            const std::size_t n = read_at(buf.data(), static_cast<std::size_t>(std::min<std::uint64_t>(buf.size(), total - done)), done);
+            if (n == 0) throw std::system_error(EIO, std::generic_category(), "short read while spilling");
+            for (std::size_t off = 0; off < n;) {
+                const ssize_t put = ::pwrite(disk, buf.data() + off, n - off, static_cast<off_t>(done + off));
+                if (put < 0) {
+                    if (errno == EINTR) continue;
+                    int e = errno;
+                    throw std::system_error(e, std::generic_category(), "write failed while spilling");
+                }
+                off += static_cast<std::size_t>(put);
+            }
+            done += n;
+        }
+        if (cursor == (off_t)-1 || ::dup2(disk, handle_) == -1 || ::lseek(handle_, cursor, SEEK_SET) == (off_t)-1) {
+            int e = errno;
+            throw std::system_error(e, std::generic_category(), "spilling to disk failed");
+        }
+    } catch (...) {
+        ::close(disk);
+        ::unlink(path_.c_str());
+        throw;
+    }
+    ::close(disk);
+    release_quota();
+    in_memory_ = false;
+#endif
+}
+
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+static std::size_t pread_retry(int fd, char* dst, std::size_t len, std::uint64_t offset) {
+    while (true) {
+        ssize_t n = ::pread(fd, dst, len, static_cast<off_t>(offset));
+        if (n >= 0) return static_cast<std::size_t>(n);
+        if (errno == EINTR) continue;
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "pread failed");
+    }
+}
+
+static void pwrite_all(int fd, const char* src, std::size_t len, std::uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, src, len, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int e = errno;
+            throw std::system_error(e, std::generic_category(), "pwrite failed");
+        }
+        src += n;
+        offset += static_cast<std::uint64_t>(n);
+        len -= static_cast<std::size_t>(n);
+    }
+}
+
+// Reads up to len bytes at offset through the O_DIRECT descriptor. Aligned pieces
+// land in dst directly; the rest is read as whole blocks into bounce and copied.
+// Stops short only at end of file.
+static std::size_t direct_pread(int fd, char* dst, std::size_t len, std::uint64_t offset, AlignedBuffer& bounce) {
+    std::size_t done = 0;
+    while (done < len) {
+        const std::uint64_t pos = offset + done;
+        const std::size_t want = len - done;
+        if (is_aligned(dst + done) && pos == align_down(pos) && want >= DIRECT_IO_ALIGNMENT) {
+            const std::size_t chunk = static_cast<std::size_t>(std::min<std::uint64_t>(align_down(want), DIRECT_BOUNCE_SIZE));
+            const std::size_t n = pread_retry(fd, dst + done, chunk, pos);
+            done += n;
+            if (n < chunk) break;
+            continue;
+        }
+        const std::uint64_t start = align_down(pos);
+        const std::size_t skip = static_cast<std::size_t>(pos - start);
+        const std::size_t span = static_cast<std::size_t>(std::min<std::uint64_t>(bounce.size(), align_up(pos + want) - start));
+        const std::size_t n = pread_retry(fd, bounce.data(), span, start);
+        if (n <= skip) break;
+        const std::size_t take = std::min(want, n - skip);
+        std::memcpy(dst + done, bounce.data() + skip, take);
+        done += take;
+        if (n < span) break;
+    }
+    return done;
+}
+#endif
+
+bool FileManager::set_direct_io(bool enable) {
+    if (!enable) {
+        close_direct();
+        return true;
+    }
+    if (direct_) return true;
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+    if (!opened_ || quota_ || !is_seekable()) return false;
+    // A second open file description, so the buffered handle keeps its flags and cursor.
+    // Going through /proc also covers handles without a path, such as a redirected stdin.
+    const int access = ::fcntl(handle_, F_GETFL);
+    if (access == -1) return false;
+    const std::string self = "/proc/self/fd/" + std::to_string(handle_);
+    const int fd = ::open(self.c_str(), (access & O_ACCMODE) | O_DIRECT | O_CLOEXEC);
+    if (fd == -1) return false; // EINVAL: the filesystem has no direct I/O
+    bounce_ = AlignedBuffer(DIRECT_BOUNCE_SIZE);
+    direct_handle_ = fd;
+    direct_ = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FileManager::direct_io() const noexcept { return direct_; }
+
+void FileManager::close_direct() noexcept {
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+    if (direct_) ::close(direct_handle_);
+#endif
+    direct_ = false;
+    bounce_ = AlignedBuffer();
+}
+
+std::size_t FileManager::direct_read(char* dst, std::size_t len) {
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+    if (!direct_) throw std::system_error(EINVAL, std::generic_category(), "direct I/O is off");
+    const std::uint64_t offset = cursor();
+    const std::size_t n = direct_pread(direct_handle_, dst, len, offset, bounce_);
+    set_cursor(offset + n);
+    return n;
+#else
+    (void)dst;
+    (void)len;
+    throw std::system_error(ENOTSUP, std::generic_category(), "direct I/O is unsupported");
+#endif
+}
+
+// Blocks fully inside the range go direct; the partial blocks at either end go
+// through the page cache, which the kernel keeps coherent with the direct writes.
+void FileManager::direct_write(const char* src, std::size_t len) {
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+    if (!direct_) throw std::system_error(EINVAL, std::generic_category(), "direct I/O is off");
+    const std::uint64_t start = cursor();
+    std::uint64_t pos = start;
+    std::size_t left = len;
+    if (pos != align_down(pos)) {
+        const std::size_t head = static_cast<std::size_t>(std::min<std::uint64_t>(left, align_up(pos) - pos));
+        pwrite_all(handle_, src, head, pos);
+        src += head;
+        pos += head;
+        left -= head;
+    }
+    while (left >= DIRECT_IO_ALIGNMENT) {
+        const std::size_t chunk = static_cast<std::size_t>(std::min<std::uint64_t>(align_down(left), DIRECT_BOUNCE_SIZE));
+        if (is_aligned(src)) {
+            pwrite_all(direct_handle_, src, chunk, pos);
+        } else {
+            std::memcpy(bounce_.data(), src, chunk);
+            pwrite_all(direct_handle_, bounce_.data(), chunk, pos);
+        }
+        src += chunk;
+        pos += chunk;
+        left -= chunk;
+    }
+    if (left > 0) pwrite_all(handle_, src, left, pos);
+    set_cursor(start + len);
+#else
+    (void)src;
+    (void)len;
+    throw std::system_error(ENOTSUP, std::generic_category(), "direct I/O is unsupported");
+#endif
+}
+
+std::uint64_t FileManager::cursor() const {
+#ifdef _WIN32
+    LARGE_INTEGER zero{}, pos{};
+    if (!SetFilePointerEx(handle_, zero, &pos, FILE_CURRENT)) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "SetFilePointerEx failed");
+    }
+    return static_cast<std::uint64_t>(pos.QuadPart);
+#else
+    const off_t pos = ::lseek(handle_, 0, SEEK_CUR);
+    if (pos == (off_t)-1) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "lseek failed");
+    }
+    return static_cast<std::uint64_t>(pos);
+#endif
+}
+
+void FileManager::set_cursor(std::uint64_t offset) {
+#ifdef _WIN32
+    LARGE_INTEGER pos{};
+    pos.QuadPart = static_cast<LONGLONG>(offset);
+    if (!SetFilePointerEx(handle_, pos, nullptr, FILE_BEGIN)) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "SetFilePointerEx failed");
+    }
+#else
+    if (::lseek(handle_, static_cast<off_t>(offset), SEEK_SET) == (off_t)-1) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "lseek failed");
+    }
+#endif
+}
+
 bool FileManager::is_open() const noexcept { return opened_; }
 native_handle_t FileManager::native_handle() const noexcept { return handle_; }
 const std::string& FileManager::path() const noexcept { return path_; }
@@ -80,6 +410,8 @@ void FileManager::open_impl(bool create_if_missing) {
 }
 
 void FileManager::close_impl() noexcept {
+    release_quota();
+    close_direct();
     if (!opened_) return;
 #ifdef _WIN32
     if (handle_ && handle_ != INVALID_HANDLE_VALUE) {
@@ -117,6 +449,19 @@ void FileManager::remove_file() {
 
 void FileManager::clear() {
     if (!opened_) open_impl(true);
+#ifdef FILE_MANAGER_HAVE_MEMFD
+    // An empty temporary() file starts over in memory.
+    if (quota_ && !in_memory_) {
+        const int fd = ::memfd_create(path_.c_str(), MFD_CLOEXEC);
+        if (fd != -1) {
+            if (::dup2(fd, handle_) != -1) {
+                ::unlink(path_.c_str());
+                in_memory_ = true;
+            }
+            ::close(fd);
+        }
+    }
+#endif
 #ifdef _WIN32
     // set pointer to 0 and SetEndOfFile
     LARGE_INTEGER zero{};
@@ -138,6 +483,7 @@ void FileManager::clear() {
         throw std::system_error(e, std::generic_category(), "lseek failed");
     }
 #endif
+    release_quota();
 }
 
 void FileManager::reset_cursor() {
@@ -155,6 +501,21 @@ void FileManager::reset_cursor() {
 #endif
 }
 
+void FileManager::seek_to_end() {
+    if (!opened_) open_impl(true);
+#ifdef _WIN32
+    LARGE_INTEGER zero{}; zero.QuadPart = 0;
+    if (!SetFilePointerEx(handle_, zero, nullptr, FILE_END)) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "SetFilePointerEx failed");
+    }
+#else
+    if (lseek(handle_, 0, SEEK_END) == (off_t)-1) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "lseek failed");
+    }
+#endif
+}
+
 std::uint64_t FileManager::size() const {
     if (!opened_) {
         // try to open readonly just to query size
@@ -180,3 +541,161 @@ std::uint64_t FileManager::size() const {
 bool FileManager::is_empty() const {
     return size() == 0;
 }
+
+bool FileManager::is_seekable() const {
+    if (!opened_) return false;
+#ifdef _WIN32
+    return GetFileType(handle_) == FILE_TYPE_DISK;
+#else
+    return ::lseek(handle_, 0, SEEK_CUR) != (off_t)-1;
+#endif
+}
+
+void FileManager::preallocate(std::uint64_t len) {
+    // Memory files would take the quota up front; they grow as they are written.
+    if (!opened_ || len == 0 || in_memory_) return;
+#if defined(__linux__)
+    if (::fallocate(handle_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(len)) != 0) {
+        int e = errno;
+        if (e == ENOSPC) {
+            throw std::system_error(e, std::generic_category(), "fallocate failed");
+        }
+        // EOPNOTSUPP and friends: the filesystem will allocate on write instead.
+    }
+#endif
+}
+
+std::size_t FileManager::read_at(char* dst, std::size_t len, std::uint64_t offset) const {
+#ifdef _WIN32
+    OVERLAPPED ov{};
+    ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFu);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD got = 0;
+    if (!ReadFile(handle_, dst, static_cast<DWORD>(len), &got, &ov)) {
+        DWORD err = GetLastError();
+        if (err == ERROR_HANDLE_EOF) return 0;
+        throw std::system_error(static_cast<int>(err), std::system_category(), "ReadFile failed");
+    }
+    return got;
+#else
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+    if (direct_) {
+        // Own bounce buffer: read_at may run on several threads at once.
+        AlignedBuffer bounce(static_cast<std::size_t>(std::min<std::uint64_t>(align_up(len) + DIRECT_IO_ALIGNMENT, DIRECT_BOUNCE_SIZE)));
+        return direct_pread(direct_handle_, dst, len, offset, bounce);
+    }
+#endif
+    while (true) {
+        ssize_t n = ::pread(handle_, dst, len, static_cast<off_t>(offset));
+        if (n >= 0) return static_cast<std::size_t>(n);
+        if (errno == EINTR) continue;
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "pread failed");
+    }
+#endif
+}
+
+std::uint64_t FileManager::copy_to(FileManager& dst, std::uint64_t len) {
+    if (!opened_ || !dst.opened_) {
+        throw std::system_error(EINVAL, std::generic_category(), "file not open");
+    }
+    metrics::ScopedOp op(metrics::Op::FileCopy);
+    op.add_bytes(len);
+    dst.will_write(len);
+    std::uint64_t copied = 0;
+#ifdef FILE_MANAGER_HAVE_O_DIRECT
+    // copy_file_range would pull the data through the page cache.
+    if (direct_ || dst.direct_) {
+        AlignedBuffer buf(DIRECT_BOUNCE_SIZE);
+        while (copied < len) {
+            const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(buf.size(), len - copied));
+            std::size_t got;
+            if (direct_) {
+                got = direct_read(buf.data(), want);
+            } else {
+                const std::uint64_t offset = cursor();
+                got = pread_retry(handle_, buf.data(), want, offset);
+                set_cursor(offset + got);
+            }
+            if (got == 0) break;
+            if (dst.direct_) {
+                dst.direct_write(buf.data(), got);
+            } else {
+                const std::uint64_t offset = dst.cursor();
+                pwrite_all(dst.handle_, buf.data(), got, offset);
+                dst.set_cursor(offset + got);
+            }
+            copied += got;
+        }
+        return copied;
+    }
+#endif
+#if defined(__linux__)
+    while (copied < len) {
+        ssize_t n = ::copy_file_range(handle_, nullptr, dst.handle_, nullptr,
+                                      static_cast<size_t>(len - copied), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            // Not supported for this pair of files: finish in user space.
+            if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) break;
+            int e = errno;
+            throw std::system_error(e, std::generic_category(), "copy_file_range failed");
+        }
+        if (n == 0) return copied;
+        copied += static_cast<std::uint64_t>(n);
+    }
+#endif
+    char buf[64 * 1024];
+    while (copied < len) {
+        const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(sizeof(buf), len - copied));
+#ifdef _WIN32
+        DWORD got = 0;
+        if (!ReadFile(handle_, buf, static_cast<DWORD>(want), &got, nullptr)) {
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "ReadFile failed");
+        }
+        if (got == 0) break;
+        DWORD put = 0;
+        if (!WriteFile(dst.handle_, buf, got, &put, nullptr) || put != got) {
+            throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "WriteFile failed");
+        }
+        copied += got;
+#else
+        ssize_t got = ::read(handle_, buf, want);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            int e = errno;
+            throw std::system_error(e, std::generic_category(), "read failed");
+        }
+        if (got == 0) break;
+        for (ssize_t off = 0; off < got; ) {
+            ssize_t put = ::write(dst.handle_, buf + off, static_cast<size_t>(got - off));
+            if (put < 0) {
+                if (errno == EINTR) continue;
+                int e = errno;
+                throw std::system_error(e, std::generic_category(), "write failed");
+            }
+            off += put;
+        }
+        copied += static_cast<std::uint64_t>(got);
+#endif
+    }
+    return copied;
+}
+
+void FileManager::clone_to(FileManager& dst) {
+    dst.clear();
+    reset_cursor();
+#if defined(__linux__) && defined(FICLONE)
+    if (::ioctl(dst.handle_, FICLONE, handle_) == 0) {
+        dst.reset_cursor();
+        return;
+    }
+    // EXDEV, EOPNOTSUPP, EINVAL...: no shared extents here, copy instead.
+#endif
+    const std::uint64_t len = size();
+    if (copy_to(dst, len) != len) {
+        throw std::system_error(EIO, std::generic_category(), "short copy");
+    }
+    reset_cursor();
+    dst.reset_cursor();
+}
@@ -0,0 +1,265 @@
+#include "../../include/io/memory_budget.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A cgroup limit this large means "no limit" (cgroup v1 reports unlimited as ~2^63).
+constexpr std::uint64_t NO_LIMIT = 1ull << 60;
+// Share of the free cgroup memory handed out; the rest covers stacks, allocator
+// slack and the kernel memory charged to the group.
+constexpr double FREE_SHARE = 0.9;
+// Share of the free address space handed out. Lower: the stacks of threads not
+// started yet and reservations made since the last poll land there at once, and
+// going over RLIMIT_AS is std::bad_alloc, not reclaim.
+constexpr double ADDRESS_SPACE_SHARE = 0.8;
+// PSI "some avg10" at which shrinking starts, and where it reaches MIN_SCALE.
+constexpr double PRESSURE_LOW = 10.0;
+constexpr double PRESSURE_HIGH = 60.0;
+constexpr double MIN_SCALE = 0.25;
+
+bool file_exists(const std::string& path) {
+    return std::ifstream(path).good();
+}
+
+// First number of a file; false for "max", missing or unreadable files.
+bool read_number(const std::string& path, std::uint64_t& value) {
+    std::ifstream in(path);
+    return static_cast<bool>(in >> value);
+}
+
+// Value of a "key value" line of memory.stat or "Key: value kB" of /proc/self/status.
+std::uint64_t read_field(const std::string& path, const std::string& key) {
+    std::ifstream in(path);
+    std::string name;
+    std::uint64_t value = 0;
+    while (in >> name) {
+        if (name == key && in >> value) return value;
+        in.ignore(1 << 20, '\n');
+    }
+    return 0;
+}
+
+// "some avg10=1.23 ..." of a PSI file, in percent.
+double read_pressure(const std::string& path) {
+    if (path.empty()) return 0;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.rfind("some ", 0) != 0) continue;
+        const std::size_t pos = line.find("avg10=");
+        if (pos == std::string::npos) return 0;
+        try {
+            return std::stod(line.substr(pos + 6));
+        } catch (const std::exception&) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+struct Mounts {
+    std::string v2;        // cgroup2 mount point
+    std::string v1_memory; // cgroup v1 memory controller mount point
+};
+
+Mounts find_mounts() {
+    Mounts m;
+    std::ifstream in("/proc/self/mounts");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string device, dir, type, options;
+        if (!(fields >> device >> dir >> type >> options)) continue;
+        if (type == "cgroup2" && m.v2.empty()) {
+            m.v2 = dir;
+        } else if (type == "cgroup" && m.v1_memory.empty()) {
+            std::istringstream opts(options);
+            std::string opt;
+            while (std::getline(opts, opt, ',')) {
+                if (opt == "memory") m.v1_memory = dir;
+            }
+        }
+    }
+    return m;
+}
+
+// Path of the process's cgroup in the v2 hierarchy ("0::/path") or, for v1, in the
+// hierarchy that has the memory controller ("4:memory:/path").
+std::string cgroup_path(bool v2) {
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(in, line)) {
+        const std::size_t first = line.find(':');
+        const std::size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) continue;
+        const std::string controllers = line.substr(first + 1, second - first - 1);
+        const std::string path = line.substr(second + 1);
+        if (v2 && line.compare(0, first, "0") == 0 && controllers.empty()) return path;
+        if (!v2) {
+            std::istringstream list(controllers);
+            std::string c;
+            while (std::getline(list, c, ',')) {
+                if (c == "memory") return path;
+            }
+        }
+    }
+    return {};
+}
+
+// The cgroup directory under `root`; the root itself if the path is not visible,
+// as in containers that mount only their own cgroup.
+std::string cgroup_dir(const std::string& root, const std::string& path) {
+    if (path.empty() || path == "/") return root;
+    const std::string dir = root + path;
+    return file_exists(dir + "/cgroup.procs") ? dir : root;
+}
+
+} // namespace
+
+MemoryBudget::MemoryBudget(std::uint64_t ceiling) : ceiling_(ceiling), budget_(ceiling) {
+    const Mounts mounts = find_mounts();
+    // cgroup v2 counts only if it has the memory controller; in hybrid setups
+    // it may still carry the PSI files.
+    std::string v2_dir;
+    if (!mounts.v2.empty()) {
+        v2_dir = cgroup_dir(mounts.v2, cgroup_path(true));
+        std::ifstream controllers(mounts.v2 + "/cgroup.controllers");
+        std::string c;
+        while (controllers >> c) {
+            if (c == "memory") cgroup_v2_ = true;
+        }
+    }
+    if (cgroup_v2_) {
+        cgroup_root_ = mounts.v2;
+        cgroup_dir_ = v2_dir;
+    } else if (!mounts.v1_memory.empty()) {
+        cgroup_root_ = mounts.v1_memory;
+        cgroup_dir_ = cgroup_dir(mounts.v1_memory, cgroup_path(false));
+    }
+
+    if (!v2_dir.empty() && file_exists(v2_dir + "/memory.pressure")) {
+        pressure_path_ = v2_dir + "/memory.pressure";
+    } else if (file_exists("/proc/pressure/memory")) {
+        pressure_path_ = "/proc/pressure/memory";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    poll(false);
+}
+
+void MemoryBudget::set_ceiling(std::uint64_t ceiling) {
+    ceiling_.store(ceiling, std::memory_order_relaxed);
+    refresh();
+}
+
+std::uint64_t MemoryBudget::current() {
+    const std::int64_t now = Clock::now().time_since_epoch().count();
+    if (now >= next_poll_.load(std::memory_order_relaxed)) {
+        // One thread polls; the others go on with the previous value.
+        std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+        if (lock.owns_lock() && now >= next_poll_.load(std::memory_order_relaxed)) poll(true);
+    }
+    return budget_.load(std::memory_order_relaxed);
+}
+
+void MemoryBudget::refresh() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    poll(false);
+}
+
+MemoryBudget::Reading MemoryBudget::last_reading() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reading_;
+}
+
+std::uint64_t MemoryBudget::target(const Reading& reading, std::uint64_t ceiling) {
+    double budget = static_cast<double>(ceiling);
+    if (reading.limit > 0) {
+        const std::uint64_t free = reading.limit > reading.others ? reading.limit - reading.others : 0;
+        budget = std::min(budget, static_cast<double>(free) * FREE_SHARE);
+    }
+    if (reading.address_space > 0) {
+        const std::uint64_t free =
+            reading.address_space > reading.unbacked ? reading.address_space - reading.unbacked : 0;
+        budget = std::min(budget, static_cast<double>(free) * ADDRESS_SPACE_SHARE);
+    }
+    if (reading.pressure > PRESSURE_LOW) {
+        const double over = (reading.pressure - PRESSURE_LOW) / (PRESSURE_HIGH - PRESSURE_LOW);
+        budget *= std::max(MIN_SCALE, 1.0 - (1.0 - MIN_SCALE) * over);
+    }
+    const std::uint64_t floor = std::min(MIN_BUDGET, ceiling);
+    return std::clamp(static_cast<std::uint64_t>(budget), floor, ceiling);
+}
+
+// Called with mutex_ held.
+void MemoryBudget::poll(bool smooth) {
+    reading_ = read();
+    std::uint64_t next = target(reading_, ceiling_.load(std::memory_order_relaxed));
+    const std::uint64_t prev = budget_.load(std::memory_order_relaxed);
+    if (smooth && next > prev) next = std::min(next, prev + prev / 4);
+    budget_.store(next, std::memory_order_relaxed);
+    const auto interval = std::chrono::duration_cast<Clock::duration>(POLL_INTERVAL);
+    next_poll_.store((Clock::now() + interval).time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+MemoryBudget::Reading MemoryBudget::read() const {
+    Reading r;
+    r.pressure = read_pressure(pressure_path_);
+#ifndef _WIN32
+    // Every mapping counts against RLIMIT_AS, resident or not; what is resident
+    // and anonymous is mostly the buffers the budget hands out.
+    rlimit as{};
+    if (getrlimit(RLIMIT_AS, &as) == 0 && as.rlim_cur != RLIM_INFINITY) {
+        r.address_space = static_cast<std::uint64_t>(as.rlim_cur);
+        const std::uint64_t mapped = read_field("/proc/self/status", "VmSize:") * 1024;
+        const std::uint64_t anon = read_field("/proc/self/status", "RssAnon:") * 1024;
+        r.unbacked = mapped > anon ? mapped - anon : 0;
+    }
+#endif
+    if (cgroup_dir_.empty()) return r;
+
+    // The tightest limit of the cgroup and its ancestors, and the group it belongs to.
+    std::string limiting;
+    std::string dir = cgroup_dir_;
+    while (true) {
+        for (const char* name : cgroup_v2_ ? std::vector<const char*>{"/memory.max", "/memory.high"}
+                                          : std::vector<const char*>{"/memory.limit_in_bytes"}) {
+            std::uint64_t value = 0;
+            if (read_number(dir + name, value) && value < NO_LIMIT && (r.limit == 0 || value < r.limit)) {
+                r.limit = value;
+                limiting = dir;
+            }
+        }
+        if (dir.size() <= cgroup_root_.size()) break;
+        dir.erase(dir.rfind('/'));
+    }
+    if (r.limit == 0) return r;
+
+    // Page cache is reclaimed before anyone is OOM-killed, and this process's
+    // own memory is what the budget hands out, so neither counts as taken. The
+    // cache figure includes shmem (tmpfs, memfd temp runs), which only swap can
+    // take back: it stays counted.
+    std::uint64_t usage = 0;
+    read_number(limiting + (cgroup_v2_ ? "/memory.current" : "/memory.usage_in_bytes"), usage);
+    const std::string stat = limiting + "/memory.stat";
+    const std::uint64_t file = read_field(stat, cgroup_v2_ ? "file" : "total_cache");
+    const std::uint64_t shmem = read_field(stat, cgroup_v2_ ? "shmem" : "total_shmem");
+    const std::uint64_t cache = file > shmem ? file - shmem : 0;
+    const std::uint64_t own = read_field("/proc/self/status", "RssAnon:") * 1024;
+    r.others = usage > cache + own ? usage - cache - own : 0;
+    return r;
+}
+
+MemoryBudget& memory_budget() {
+    static MemoryBudget budget;
+    return budget;
+}
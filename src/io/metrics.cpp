@@ -0,0 +1,455 @@
+#include "../../include/io/metrics.h"
+
+#include <fstream>
+#include <algorithm>
+#include <condition_variable>
+#include <iomanip>
+#include <limits>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+  #include <sys/resource.h>
+#endif
+#if defined(__linux__)
+  #include <linux/perf_event.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+  #include <cstring>
+  #define METRICS_HAVE_PERF_EVENTS 1
+#endif
+
+namespace metrics {
+
+std::atomic<unsigned> g_mode{0};
+
+namespace {
+
+struct OpTotals {
+    std::atomic<std::uint64_t> calls{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<std::uint64_t> nanos{0};
+};
+
+struct Phase {
+    std::string name;
+    std::uint64_t nanos;
+    bool has_runs;
+    std::uint64_t runs;
+    std::uint64_t peak_rss; // bytes, 0 if unknown
+    Snapshot delta;
+};
+
+struct Span {
+    const char* name;
+    const char* category;
+    std::uint64_t start_ns; // since g_start
+    std::uint64_t dur_ns;
+    std::uint64_t bytes;
+};
+
+// Spans of one thread. Owned by the registry so they outlive the thread.
+struct ThreadTrace {
+    std::size_t tid;
+    std::vector<Span> spans;
+};
+
+OpTotals g_ops[OP_COUNT];
+std::atomic<std::uint64_t> g_counters[COUNTER_COUNT];
+Clock::time_point g_start;
+std::mutex g_phases_mutex;
+std::vector<Phase> g_phases;
+std::once_flag g_start_once;
+std::mutex g_trace_mutex;
+std::vector<std::unique_ptr<ThreadTrace>> g_traces;
+thread_local ThreadTrace* t_trace = nullptr;
+
+const char* const OP_NAMES[OP_COUNT] = {
+    "reader_fill", "run_read", "writer_write", "writer_flush", "file_copy", "segment_refill", "prefetch_wait",
+};
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "heap_operations", "comparisons", "gallop_records", "two_way_records",
+};
+const char* const HW_NAMES[HW_COUNT] = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "task_clock_ns",
+};
+
+// VmHWM of this process in bytes, 0 where /proc is unavailable.
+std::uint64_t read_peak_rss() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string key;
+    while (status >> key) {
+        if (key == "VmHWM:") {
+            std::uint64_t kb = 0;
+            status >> kb;
+            return kb * 1024;
+        }
+        status.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+#endif
+    return 0;
+}
+
+// Resident set size of this process in bytes, 0 where /proc is unavailable.
+std::uint64_t read_rss() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t size = 0, resident = 0;
+    if (statm >> size >> resident) return resident * static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
+// Which Hw counters could be opened; the others are reported as null.
+bool g_hw_open[HW_COUNT] = {};
+bool g_hw_enabled = false;
+
+#ifdef METRICS_HAVE_PERF_EVENTS
+const std::pair<std::uint32_t, std::uint64_t> HW_EVENTS[HW_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+};
+
+// Counts the calling thread only: inherited counters would fold in other threads
+// just as they exit, and the pool workers never do before the report.
+int open_counter(std::uint32_t type, std::uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+#endif
+
+// Current value of a counter, scaled up if the kernel multiplexed it.
+std::uint64_t read_counter(int fd) {
+#ifdef METRICS_HAVE_PERF_EVENTS
+    std::uint64_t v[3] = {0, 0, 0}; // value, time enabled, time running
+    if (::read(fd, v, sizeof(v)) != static_cast<ssize_t>(sizeof(v)) || v[2] == 0) return 0;
+    if (v[2] >= v[1]) return v[0];
+    return static_cast<std::uint64_t>(static_cast<double>(v[0]) * static_cast<double>(v[1]) / static_cast<double>(v[2]));
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+// Hw counters of one thread, -1 where unavailable. Registered while the thread
+// runs; on exit its final counts move to g_hw_retired and the descriptors close.
+struct ThreadCounters {
+    int fds[HW_COUNT] = {-1, -1, -1, -1, -1};
+
+    ~ThreadCounters();
+};
+
+std::mutex g_hw_mutex;
+std::vector<ThreadCounters*> g_hw_threads;
+std::uint64_t g_hw_retired[HW_COUNT] = {};
+thread_local std::unique_ptr<ThreadCounters> t_counters;
+
+ThreadCounters::~ThreadCounters() {
+    std::lock_guard<std::mutex> lock(g_hw_mutex);
+    for (std::size_t i = 0; i < HW_COUNT; ++i) {
+        if (fds[i] < 0) continue;
+        g_hw_retired[i] += read_counter(fds[i]);
+#ifdef METRICS_HAVE_PERF_EVENTS
+        ::close(fds[i]);
+#endif
+    }
+    g_hw_threads.erase(std::find(g_hw_threads.begin(), g_hw_threads.end(), this));
+}
+
+// Opens the calling thread's counters once; returns how many opened.
+std::size_t open_thread_counters() {
+    std::size_t opened = 0;
+#ifdef METRICS_HAVE_PERF_EVENTS
+    if (!t_counters) {
+        auto counters = std::make_unique<ThreadCounters>();
+        for (std::size_t i = 0; i < HW_COUNT; ++i) {
+            counters->fds[i] = open_counter(HW_EVENTS[i].first, HW_EVENTS[i].second);
+        }
+        std::lock_guard<std::mutex> lock(g_hw_mutex);
+        g_hw_threads.push_back(counters.get());
+        t_counters = std::move(counters);
+    }
+    for (int fd : t_counters->fds) opened += fd >= 0 ? 1 : 0;
+#endif
+    return opened;
+}
+
+} // namespace
+
+// Samples the RSS for one phase, for when the phase stays below an earlier peak and
+// the kernel's high-water mark says nothing about it. Resetting that mark instead
+// would hide the process peak from getrusage() and from whoever waits for us.
+class ScopedPhase::RssSampler {
+public:
+    RssSampler() : peak_(read_rss()), hwm_(read_peak_rss()), thread_([this] { run(); }) {}
+    ~RssSampler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+    RssSampler(const RssSampler&) = delete;
+    RssSampler& operator=(const RssSampler&) = delete;
+
+    // Peak RSS since construction: exact if the phase raised the high-water mark.
+    std::uint64_t peak() {
+        const std::uint64_t hwm = read_peak_rss();
+        if (hwm > hwm_) return hwm;
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::max(peak_, read_rss());
+    }
+
+private:
+    static constexpr std::chrono::milliseconds INTERVAL{5};
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!wake_.wait_for(lock, INTERVAL, [this] { return stop_; })) {
+            lock.unlock();
+            const std::uint64_t rss = read_rss();
+            lock.lock();
+            peak_ = std::max(peak_, rss);
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::uint64_t peak_;
+    const std::uint64_t hwm_;
+    std::thread thread_;
+};
+
+namespace {
+
+double seconds(std::uint64_t nanos) { return static_cast<double>(nanos) / 1e9; }
+
+void start_clock() {
+    std::call_once(g_start_once, [] { g_start = Clock::now(); });
+}
+
+std::uint64_t nanos_between(Clock::time_point a, Clock::time_point b) {
+    return b > a ? static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count()) : 0;
+}
+
+ThreadTrace& thread_trace() {
+    if (!t_trace) {
+        std::lock_guard<std::mutex> lock(g_trace_mutex);
+        g_traces.push_back(std::make_unique<ThreadTrace>(ThreadTrace{g_traces.size(), {}}));
+        t_trace = g_traces.back().get();
+    }
+    return *t_trace;
+}
+
+void write_stats(std::ostream& out, const Snapshot& s, const char* indent) {
+    out << indent << "\"operations\": {";
+    for (std::size_t i = 0; i < OP_COUNT; ++i) {
+        out << (i ? ",\n" : "\n") << indent << "  \"" << OP_NAMES[i] << "\": {\"calls\": " << s.calls[i]
+            << ", \"bytes\": " << s.bytes[i] << ", \"seconds\": " << seconds(s.nanos[i]) << "}";
+    }
+    out << "\n" << indent << "},\n" << indent << "\"counters\": {";
+    for (std::size_t i = 0; i < COUNTER_COUNT; ++i) {
+        out << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << s.counters[i];
+    }
+    out << "},\n" << indent << "\"page_faults\": {\"minor\": " << s.minor_faults << ", \"major\": " << s.major_faults << "}";
+    if (!g_hw_enabled) return;
+    out << ",\n" << indent << "\"hardware\": {";
+    for (std::size_t i = 0; i < HW_COUNT; ++i) {
+        out << (i ? ", " : "") << "\"" << HW_NAMES[i] << "\": ";
+        if (g_hw_open[i]) out << s.hardware[i];
+        else out << "null";
+    }
+    const std::size_t cycles = static_cast<std::size_t>(Hw::Cycles);
+    const std::size_t instructions = static_cast<std::size_t>(Hw::Instructions);
+    if (g_hw_open[cycles] && g_hw_open[instructions] && s.hardware[cycles] > 0) {
+        out << ", \"ipc\": " << static_cast<double>(s.hardware[instructions]) / static_cast<double>(s.hardware[cycles]);
+    }
+    out << "}";
+}
+
+} // namespace
+
+void enable() {
+    start_clock();
+    g_mode.fetch_or(COLLECT, std::memory_order_relaxed);
+}
+
+void enable_trace() {
+    start_clock();
+    thread_trace(); // the calling (main) thread becomes tid 0
+    g_mode.fetch_or(TRACE, std::memory_order_relaxed);
+}
+
+std::size_t enable_hardware_counters() {
+    std::size_t opened = 0;
+#ifdef METRICS_HAVE_PERF_EVENTS
+    opened = open_thread_counters();
+    if (!g_hw_enabled) {
+        for (std::size_t i = 0; i < HW_COUNT; ++i) g_hw_open[i] = t_counters->fds[i] >= 0;
+        g_hw_enabled = true;
+    }
+#endif
+    enable();
+    return opened;
+}
+
+void count_thread() {
+    if (g_hw_enabled) open_thread_counters();
+}
+
+const char* op_name(Op op) noexcept { return OP_NAMES[static_cast<std::size_t>(op)]; }
+
+void record(Op op, std::uint64_t bytes, std::uint64_t nanos) noexcept {
+    OpTotals& t = g_ops[static_cast<std::size_t>(op)];
+    t.calls.fetch_add(1, std::memory_order_relaxed);
+    t.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    t.nanos.fetch_add(nanos, std::memory_order_relaxed);
+}
+
+void add(Counter counter, std::uint64_t n) noexcept {
+    g_counters[static_cast<std::size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+}
+
+void trace_span(const char* name, const char* category, Clock::time_point start, Clock::time_point end,
+                std::uint64_t bytes) noexcept {
+    try {
+        thread_trace().spans.push_back(Span{name, category, nanos_between(g_start, start), nanos_between(start, end), bytes});
+    } catch (...) {
+        // Tracing must not fail the sort.
+    }
+}
+
+Snapshot snapshot() noexcept {
+    Snapshot s;
+    for (std::size_t i = 0; i < OP_COUNT; ++i) {
+        s.calls[i] = g_ops[i].calls.load(std::memory_order_relaxed);
+        s.bytes[i] = g_ops[i].bytes.load(std::memory_order_relaxed);
+        s.nanos[i] = g_ops[i].nanos.load(std::memory_order_relaxed);
+    }
+    for (std::size_t i = 0; i < COUNTER_COUNT; ++i) {
+        s.counters[i] = g_counters[i].load(std::memory_order_relaxed);
+    }
+    if (g_hw_enabled) {
+        std::lock_guard<std::mutex> lock(g_hw_mutex);
+        for (std::size_t i = 0; i < HW_COUNT; ++i) {
+            s.hardware[i] = g_hw_retired[i];
+            for (const ThreadCounters* t : g_hw_threads) {
+                if (t->fds[i] >= 0) s.hardware[i] += read_counter(t->fds[i]);
+            }
+        }
+    }
+#ifndef _WIN32
+    rusage usage{};
+    if (::getrusage(RUSAGE_SELF, &usage) == 0) {
+        s.minor_faults = static_cast<std::uint64_t>(usage.ru_minflt);
+        s.major_faults = static_cast<std::uint64_t>(usage.ru_majflt);
+    }
+#endif
+    return s;
+}
+
+ScopedPhase::ScopedPhase(const char* name) : name_(name), mode_(mode()) {
+    if (!mode_) return;
+    if (mode_ & COLLECT) {
+        sampler_ = std::make_unique<RssSampler>();
+        before_ = snapshot();
+    }
+    start_ = Clock::now();
+}
+
+ScopedPhase::~ScopedPhase() {
+    if (!mode_) return;
+    const Clock::time_point end = Clock::now();
+    if (mode_ & TRACE) trace_span(name_, "phase", start_, end, 0);
+    if (!(mode_ & COLLECT)) return;
+    Phase phase{name_, nanos_between(start_, end), has_runs_, runs_, sampler_->peak(), snapshot()};
+    sampler_.reset();
+    for (std::size_t i = 0; i < OP_COUNT; ++i) {
+        phase.delta.calls[i] -= before_.calls[i];
+        phase.delta.bytes[i] -= before_.bytes[i];
+        phase.delta.nanos[i] -= before_.nanos[i];
+    }
+    for (std::size_t i = 0; i < COUNTER_COUNT; ++i) phase.delta.counters[i] -= before_.counters[i];
+    phase.delta.minor_faults -= before_.minor_faults;
+    phase.delta.major_faults -= before_.major_faults;
+    // Multiplexed counters are estimates and need not grow monotonically.
+    for (std::size_t i = 0; i < HW_COUNT; ++i) {
+        phase.delta.hardware[i] = phase.delta.hardware[i] > before_.hardware[i] ? phase.delta.hardware[i] - before_.hardware[i] : 0;
+    }
+    std::lock_guard<std::mutex> lock(g_phases_mutex);
+    g_phases.push_back(std::move(phase));
+}
+
+void write_report(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(g_phases_mutex);
+    out << "{\n  \"enabled\": " << (enabled() ? "true" : "false") << ",\n";
+    out << "  \"total_seconds\": " << (enabled() ? seconds(nanos_since(g_start)) : 0.0) << ",\n";
+    out << "  \"peak_rss_bytes\": " << read_peak_rss() << ",\n";
+    write_stats(out, snapshot(), "  ");
+    out << ",\n  \"phases\": [";
+    for (std::size_t i = 0; i < g_phases.size(); ++i) {
+        const Phase& p = g_phases[i];
+        out << (i ? ",\n" : "\n") << "    {\n      \"name\": \"" << p.name << "\",\n      \"seconds\": " << seconds(p.nanos)
+            << ",\n";
+        if (p.has_runs) out << "      \"runs\": " << p.runs << ",\n";
+        out << "      \"peak_rss_bytes\": " << p.peak_rss << ",\n";
+        write_stats(out, p.delta, "      ");
+        out << "\n    }";
+    }
+    out << (g_phases.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+void write_report(const std::string& path) {
+    if (path == "-") {
+        write_report(std::cerr);
+        return;
+    }
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Cannot open metrics report: " + path);
+    write_report(out);
+}
+
+void write_trace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Cannot open trace file: " + path);
+    std::lock_guard<std::mutex> lock(g_trace_mutex);
+    out << std::fixed << std::setprecision(3);
+    // Complete ("X") events in microseconds, plus one thread-name record per timeline.
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    const char* sep = "\n";
+    for (const auto& t : g_traces) {
+        out << sep << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << t->tid
+            << ", \"args\": {\"name\": \"" << (t->tid == 0 ? "main" : "worker ");
+        if (t->tid != 0) out << t->tid;
+        out << "\"}}";
+        sep = ",\n";
+        for (const Span& s : t->spans) {
+            out << sep << "{\"name\": \"" << s.name << "\", \"cat\": \"" << s.category
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << t->tid << ", \"ts\": " << s.start_ns / 1000.0
+                << ", \"dur\": " << s.dur_ns / 1000.0;
+            if (s.bytes) out << ", \"args\": {\"bytes\": " << s.bytes << "}";
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+}
+
+} // namespace metrics
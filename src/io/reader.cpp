@@ -1,4 +1,6 @@
 #include "../../include/io/reader.h"
+#include "../../include/io/metrics.h"
+#include <algorithm>
 #include <stdexcept>
 #include <cstring>
 #include <cctype>
@@ -26,10 +28,14 @@ Reader::Reader(const std::string& filepath)
 }
 
 Reader::Reader(FileManager& manager)
-    : buffer_(DEFAULT_BUFFER_SIZE) { // Ensure member is initialized
+    : buffer_(manager.direct_io() ? DIRECT_BUFFER_SIZE : DEFAULT_BUFFER_SIZE) { // Ensure member is initialized
     if (!manager.is_open()) {
         throw std::runtime_error("FileManager is not open.");
     }
+    if (manager.direct_io()) {
+        direct_source_ = &manager;
+        return;
+    }
 
 #ifdef _WIN32
     int fd = _open_osfhandle(reinterpret_cast<intptr_t>(manager.native_handle()), 0);
@@ -62,8 +68,24 @@ void Reader::fill_buffer() {
         return;
     }
 
+    metrics::ScopedOp op(metrics::Op::ReaderFill);
     buffer_pos_ = 0;
+    if (direct_source_) {
+        // direct_read() may return less than asked before the end of the file.
+        buffer_end_ = 0;
+        while (buffer_end_ < buffer_.size()) {
+            const size_t n = direct_source_->direct_read(buffer_.data() + buffer_end_, buffer_.size() - buffer_end_);
+            if (n == 0) {
+                eof_reached_ = true;
+                break;
+            }
+            buffer_end_ += n;
+        }
+        op.add_bytes(buffer_end_);
+        return;
+    }
     buffer_end_ = fread(buffer_.data(), 1, buffer_.size(), file_handle_);
+    op.add_bytes(buffer_end_);
 
     if (buffer_end_ < buffer_.size()) {
         // If we read less than a full buffer, we've either hit the end of the file or an error occurred.
@@ -75,6 +97,33 @@ void Reader::fill_buffer() {
     }
 }
 
+size_t Reader::read_raw(char* dst, size_t len) {
+    metrics::ScopedOp op(metrics::Op::ReaderFill);
+    // Bytes get_line() has already buffered come first.
+    size_t done = std::min(len, buffer_end_ - buffer_pos_);
+    memcpy(dst, buffer_.data() + buffer_pos_, done);
+    buffer_pos_ += done;
+
+    while (done < len && !eof_reached_) {
+        size_t n = 0;
+        if (direct_source_) {
+            n = direct_source_->direct_read(dst + done, len - done);
+            if (n == 0) eof_reached_ = true;
+        } else {
+            n = fread(dst + done, 1, len - done, file_handle_);
+            if (n < len - done) {
+                if (ferror(file_handle_)) {
+                    throw std::runtime_error("Error reading from file.");
+                }
+                eof_reached_ = true;
+            }
+        }
+        done += n;
+    }
+    op.add_bytes(done);
+    return done;
+}
+
 bool Reader::get_line(std::string_view& view) {
     line_buffer_.clear();
 
@@ -126,3 +175,18 @@ bool Reader::get_line(std::string_view& view) {
         fill_buffer();
     }
 }
+
+std::uint64_t next_line_start(const FileManager& source, std::uint64_t offset, std::uint64_t file_size) {
+    if (offset == 0) return 0;
+    char buf[4096];
+    std::uint64_t pos = offset - 1; // the byte before offset may already be '\n'
+    while (pos < file_size) {
+        const size_t n = source.read_at(buf, sizeof(buf), pos);
+        if (n == 0) break;
+        if (const void* nl = memchr(buf, '\n', n)) {
+            return pos + static_cast<std::uint64_t>(static_cast<const char*>(nl) - buf) + 1;
+        }
+        pos += n;
+    }
+    return file_size;
+}
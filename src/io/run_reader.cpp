@@ -0,0 +1,324 @@
+#include "../../include/io/run_reader.h"
+#include "../../include/io/run_format.h"
+#include "../../include/io/block_codec.h"
+#include "../../include/io/writer.h"
+#include "../../include/io/metrics.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <unistd.h>
+#endif
+
+template <class Key>
+BasicRunReader<Key>::BasicRunReader(FileManager& fm, std::size_t buffer_size, std::size_t prefetch_bytes)
+    : fm_(fm), handle_(fm.native_handle()), buffer_(buffer_size), prefetch_bytes_(prefetch_bytes) {
+    if (!fm.is_open()) {
+        throw std::runtime_error("FileManager is not open.");
+    }
+    if (prefetch_bytes_ > 0) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        schedule_prefetch();
+    }
+}
+
+template <class Key>
+BasicRunReader<Key>::~BasicRunReader() {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+    }
+    // Queued tasks see stop_ and return at once; a running one stops after its block.
+    try { prefetch_tasks_.wait(); }
+    catch (...) { /* destructor-safe */ }
+}
+
+template <class Key>
+void BasicRunReader<Key>::fill_buffer() {
+    buffer_pos_ = 0;
+    buffer_end_ = 0;
+    if (eof_reached_) return;
+    read_more();
+}
+
+// Appends whatever the next read returns after buffer_end_.
+template <class Key>
+void BasicRunReader<Key>::read_more() {
+    metrics::ScopedOp op(metrics::Op::RunRead);
+    if (fm_.direct_io()) {
+        const std::size_t n = fm_.direct_read(buffer_.data() + buffer_end_, buffer_.size() - buffer_end_);
+        if (n == 0) eof_reached_ = true;
+        buffer_end_ += n;
+        op.add_bytes(n);
+        return;
+    }
+
+#ifdef _WIN32
+    DWORD got = 0;
+    if (!ReadFile(handle_, buffer_.data() + buffer_end_, static_cast<DWORD>(buffer_.size() - buffer_end_), &got, nullptr)) {
+        throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "ReadFile failed");
+    }
+    const std::size_t n = got;
+#else
+    ssize_t n;
+    do {
+        n = ::read(handle_, buffer_.data() + buffer_end_, buffer_.size() - buffer_end_);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "read failed");
+    }
+#endif
+    if (n == 0) eof_reached_ = true;
+    buffer_end_ += static_cast<std::size_t>(n);
+    op.add_bytes(static_cast<std::uint64_t>(n));
+}
+
+template <class Key>
+bool BasicRunReader<Key>::ensure_buffered(std::size_t len) {
+    if (buffer_end_ - buffer_pos_ >= len) return true;
+    std::memmove(buffer_.data(), buffer_.data() + buffer_pos_, buffer_end_ - buffer_pos_);
+    buffer_end_ -= buffer_pos_;
+    buffer_pos_ = 0;
+    while (buffer_end_ < len && !eof_reached_) read_more();
+    return buffer_end_ >= len;
+}
+
+template <class Key>
+bool BasicRunReader<Key>::file_is_end() {
+    if (buffer_pos_ < buffer_end_) return false;
+    fill_buffer();
+    return buffer_pos_ >= buffer_end_;
+}
+
+template <class Key>
+void BasicRunReader<Key>::read_exact(char* dst, std::size_t len) {
+    while (len > 0) {
+        if (buffer_pos_ >= buffer_end_) {
+            fill_buffer();
+            if (buffer_end_ == 0) {
+                throw std::runtime_error("Corrupted run file: unexpected end of file.");
+            }
+        }
+        const std::size_t n = std::min(len, buffer_end_ - buffer_pos_);
+        std::memcpy(dst, buffer_.data() + buffer_pos_, n);
+        buffer_pos_ += n;
+        dst += n;
+        len -= n;
+    }
+}
+
+template <class Key>
+void BasicRunReader<Key>::expand_compressed(const char* data, std::size_t len, std::uint32_t record_count, std::string& out) {
+    const char* p = data;
+    const char* end = data + len;
+
+    keys_.resize(record_count);
+    tags_.resize(record_count);
+    std::uint64_t prev = 0;
+    std::uint64_t v = 0;
+    for (std::uint32_t i = 0; i < record_count; ++i) {
+        p = run_format::read_varint(p, end, v);
+        prev += static_cast<std::uint64_t>(run_format::unzigzag(v));
+        keys_[i] = static_cast<Key>(static_cast<std::int64_t>(prev));
+    }
+    std::size_t payload_total = 0;
+    std::size_t counted = 0;
+    for (std::uint32_t i = 0; i < record_count; ++i) {
+        p = run_format::read_varint(p, end, tags_[i]);
+        payload_total += static_cast<std::size_t>(tags_[i] >> 3);
+        counted += (tags_[i] >> 2) & 1u;
+    }
+    counts_.resize(counted);
+    for (std::size_t i = 0; i < counted; ++i) {
+        p = run_format::read_varint(p, end, counts_[i]);
+    }
+
+    payloads_.resize(payload_total);
+    block_codec::decompress(p, static_cast<std::size_t>(end - p), &payloads_[0], payload_total);
+
+    // Worst case per record: key, two full varints and the restored key digits.
+    // Expanded in scratch space and then appended, so `out` only grows by what the
+    // block really takes: sizing it for the worst case would make a segment or a
+    // prefetched block hold (and touch) about twice its bytes.
+    expanded_.resize(payload_total
+                     + record_count * (sizeof(Key) + 2 * run_format::MAX_VARINT_SIZE + run_format::MAX_KEY_DIGITS));
+    char* w = &expanded_[0];
+    const char* stored = payloads_.data();
+    const std::uint64_t* count = counts_.data();
+    for (std::uint32_t i = 0; i < record_count; ++i) {
+        const std::size_t n = static_cast<std::size_t>(tags_[i] >> 3);
+        const bool has_count = (tags_[i] & 4u) != 0;
+        char digits[run_format::MAX_KEY_DIGITS];
+        const std::size_t digits_len = (tags_[i] & 2u) ? run_format::format_key(keys_[i], digits) : 0;
+
+        std::memcpy(w, &keys_[i], sizeof(Key));
+        w += sizeof(Key);
+        w = run_format::write_varint(w, (static_cast<std::uint64_t>(digits_len + n) << 2)
+                                            | (has_count ? 2u : 0u) | (tags_[i] & 1u));
+        if (has_count) w = run_format::write_varint(w, *count++);
+        std::memcpy(w, digits, digits_len);
+        w += digits_len;
+        std::memcpy(w, stored, n);
+        w += n;
+        stored += n;
+    }
+    out.append(expanded_.data(), static_cast<std::size_t>(w - expanded_.data()));
+}
+
+template <class Key>
+bool BasicRunReader<Key>::load_block(std::string& out, std::uint32_t& record_count) {
+    if (file_is_end()) return false;
+
+    run_format::BlockHeader header{};
+    read_exact(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (header.flags & run_format::BLOCK_COMPRESSED) {
+        compressed_.resize(header.payload_size);
+        read_exact(&compressed_[0], header.payload_size);
+        expand_compressed(compressed_.data(), compressed_.size(), header.record_count, out);
+    } else {
+        const std::size_t old_size = out.size();
+        out.resize(old_size + header.payload_size);
+        read_exact(&out[old_size], header.payload_size);
+    }
+    record_count = header.record_count;
+    return true;
+}
+
+// Queues a prefetch task unless one is queued or running or the read-ahead is
+// full. Called with mutex_ held.
+template <class Key>
+void BasicRunReader<Key>::schedule_prefetch() {
+    if (loader_ != Loader::Idle || exhausted_ || stop_ || ready_bytes_ >= prefetch_bytes_) return;
+    loader_ = Loader::Queued;
+    prefetch_tasks_.run([this] { prefetch_task(); });
+}
+
+// Loads blocks until the read-ahead is full, then ends; read_block() queues the next.
+template <class Key>
+void BasicRunReader<Key>::prefetch_task() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    // The caller may have taken over while this task was queued.
+    if (loader_ != Loader::Queued) return;
+    loader_ = Loader::Running;
+    while (!stop_ && ready_bytes_ < prefetch_bytes_ && load_next(lk)) {}
+    loader_ = Loader::Idle;
+    cv_.notify_all();
+}
+
+// Loads one block with mutex_ released; the caller has set loader_ to Running.
+// Returns false once the file is exhausted or a read failed.
+template <class Key>
+bool BasicRunReader<Key>::load_next(std::unique_lock<std::mutex>& lk) {
+    lk.unlock();
+    DecodedBlock block;
+    bool loaded = false;
+    std::exception_ptr error;
+    try {
+        loaded = load_block(block.data, block.record_count);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    lk.lock();
+    if (loaded) {
+        ready_bytes_ += block.data.size();
+        ready_.push_back(std::move(block));
+    } else {
+        exhausted_ = true;
+        error_ = error;
+    }
+    cv_.notify_all();
+    return loaded;
+}
+
+// Blocks until a block is ready or the file is done. Only real waits are timed,
+// so the metrics show how long merging starved on reads.
+template <class Key>
+void BasicRunReader<Key>::wait_for_block(std::unique_lock<std::mutex>& lk) {
+    auto ready = [&] { return !ready_.empty() || exhausted_; };
+    if (ready()) return;
+    metrics::ScopedOp op(metrics::Op::PrefetchWait);
+    while (!ready()) {
+        if (loader_ == Loader::Running) {
+            cv_.wait(lk);
+            continue;
+        }
+        // The task is still queued behind other work: load the block here.
+        loader_ = Loader::Running;
+        load_next(lk);
+        loader_ = Loader::Idle;
+    }
+}
+
+template <class Key>
+bool BasicRunReader<Key>::is_end() {
+    if (prefetch_bytes_ == 0) return file_is_end();
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    wait_for_block(lk);
+    if (ready_.empty() && error_) std::rethrow_exception(error_);
+    return ready_.empty();
+}
+
+template <class Key>
+bool BasicRunReader<Key>::read_block(std::string& out, std::uint32_t& record_count) {
+    if (prefetch_bytes_ == 0) return load_block(out, record_count);
+
+    DecodedBlock block;
+    {
+        std::unique_lock<std::mutex> lk(mutex_);
+        wait_for_block(lk);
+        if (ready_.empty()) {
+            if (error_) std::rethrow_exception(error_);
+            return false;
+        }
+        block = std::move(ready_.front());
+        ready_.pop_front();
+        ready_bytes_ -= block.data.size();
+        schedule_prefetch();
+    }
+
+    out.append(block.data);
+    record_count = block.record_count;
+    return true;
+}
+
+template <class Key>
+bool BasicRunReader<Key>::next_block_continues_run() {
+    if (prefetch_bytes_ > 0) return false;
+    if (!ensure_buffered(sizeof(run_format::BlockHeader))) return false;
+    run_format::BlockHeader header{};
+    std::memcpy(&header, buffer_.data() + buffer_pos_, sizeof(header));
+    return run_format::continues_run(header.flags);
+}
+
+template <class Key>
+bool BasicRunReader<Key>::copy_block_to(FileManager& out) {
+    if (prefetch_bytes_ > 0) return false;
+    if (!ensure_buffered(sizeof(run_format::BlockHeader))) return false;
+    run_format::BlockHeader header{};
+    std::memcpy(&header, buffer_.data() + buffer_pos_, sizeof(header));
+
+    const std::uint64_t block_size = sizeof(header) + header.payload_size;
+    const std::size_t buffered = static_cast<std::size_t>(
+        std::min<std::uint64_t>(block_size, buffer_end_ - buffer_pos_));
+    Writer writer(out);
+    writer.write_all(buffer_.data() + buffer_pos_, buffered);
+    buffer_pos_ += buffered;
+
+    const std::uint64_t rest = block_size - buffered;
+    if (rest > 0 && fm_.copy_to(out, rest) != rest) {
+        throw std::runtime_error("Corrupted run file: unexpected end of file.");
+    }
+    return true;
+}
+
+template class BasicRunReader<std::int32_t>;
+template class BasicRunReader<std::int64_t>;
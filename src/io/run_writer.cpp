@@ -0,0 +1,216 @@
+#include "../../include/io/run_writer.h"
+#include "../../include/io/run_format.h"
+#include "../../include/io/block_codec.h"
+#include "../../include/io/run_reader.h"
+#include "../../include/io/metrics.h"
+
+#include <algorithm>
+
+template <class Key>
+BasicRunWriter<Key>::BasicRunWriter(FileManager& fm, bool compress, std::size_t flush_size, std::size_t block_size)
+    : fm_(fm),
+      writer_(fm),
+      compress_(compress),
+      flush_size_(std::max<std::size_t>(flush_size, block_size)),
+      block_size_(block_size) {
+    out_.reserve(flush_size_ / 2 + block_size_);
+    if (compress_) col_payload_.reserve(block_size_);
+}
+
+template <class Key>
+BasicRunWriter<Key>::~BasicRunWriter() {
+    try { flush(); }
+    catch (...) { /* destructor-safe */ }
+}
+
+template <class Key>
+void BasicRunWriter<Key>::open_block() {
+    block_start_ = out_.size();
+    out_.resize(out_.size() + sizeof(run_format::BlockHeader));
+    block_records_ = 0;
+    block_flags_ = 0;
+    block_open_ = true;
+}
+
+template <class Key>
+void BasicRunWriter<Key>::seal_block() {
+    if (compress_) {
+        seal_compressed_block();
+        return;
+    }
+    if (!block_open_) return;
+    run_format::BlockHeader header{};
+    header.payload_size = static_cast<std::uint32_t>(out_.size() - block_start_ - sizeof(header));
+    header.record_count = block_records_;
+    header.flags = block_flags_;
+    std::memcpy(&out_[block_start_], &header, sizeof(header));
+    block_open_ = false;
+}
+
+template <class Key>
+void BasicRunWriter<Key>::seal_compressed_block() {
+    if (col_keys_.empty()) return;
+    open_block();
+
+    if (col_tags_.front() & 1u) block_flags_ |= run_format::BLOCK_OPENS_RUN;
+    for (std::size_t i = 1; i < col_tags_.size(); ++i) {
+        if (col_tags_[i] & 1u) {
+            block_flags_ |= run_format::BLOCK_MIXED_RUNS;
+            break;
+        }
+    }
+
+    // Deltas wrap modulo 2^64, so extreme int64 keys round-trip as well.
+    std::uint64_t prev = 0;
+    for (Key key : col_keys_) {
+        const auto cur = static_cast<std::uint64_t>(static_cast<std::int64_t>(key));
+        run_format::append_varint(out_, run_format::zigzag(static_cast<std::int64_t>(cur - prev)));
+        prev = cur;
+    }
+    for (std::uint64_t tag : col_tags_) {
+        run_format::append_varint(out_, tag);
+    }
+    for (std::uint64_t count : col_counts_) {
+        run_format::append_varint(out_, count);
+    }
+    block_codec::compress(col_payload_.data(), col_payload_.size(), out_);
+
+    run_format::BlockHeader header{};
+    header.payload_size = static_cast<std::uint32_t>(out_.size() - block_start_ - sizeof(header));
+    header.record_count = static_cast<std::uint32_t>(col_keys_.size());
+    header.flags = block_flags_ | run_format::BLOCK_COMPRESSED;
+    std::memcpy(&out_[block_start_], &header, sizeof(header));
+    block_open_ = false;
+
+    col_keys_.clear();
+    col_tags_.clear();
+    col_counts_.clear();
+    col_payload_.clear();
+}
+
+// Hands the pending bytes to the write-behind task once the previous write is
+// done. The flush is timed from the caller's side: the wait is what a merge loses.
+template <class Key>
+void BasicRunWriter<Key>::write_pending() {
+    if (out_.empty()) return;
+    metrics::ScopedOp op(metrics::Op::WriterFlush);
+    op.add_bytes(out_.size());
+    writes_.wait();
+    in_flight_.swap(out_);
+    out_.clear();
+    out_.reserve(flush_size_ / 2 + block_size_);
+    writes_.run([this] { writer_.write_all(in_flight_.data(), in_flight_.size()); });
+}
+
+template <class Key>
+void BasicRunWriter<Key>::push(Key key, std::string_view payload, std::uint64_t count) {
+    const bool run_start = run_pending_;
+    if (run_pending_) {
+        ++runs_;
+        run_pending_ = false;
+    }
+
+    if (compress_) {
+        // The key digits are incompressible noise; drop them if the key restores them exactly.
+        char digits[run_format::MAX_KEY_DIGITS];
+        const std::size_t n = run_format::format_key(key, digits);
+        const bool elided = payload.size() >= n && std::memcmp(payload.data(), digits, n) == 0;
+        if (elided) payload.remove_prefix(n);
+        col_keys_.push_back(key);
+        col_tags_.push_back((static_cast<std::uint64_t>(payload.size()) << 3) | (count != 1 ? 4u : 0u)
+                            | (elided ? 2u : 0u) | (run_start ? 1u : 0u));
+        if (count != 1) col_counts_.push_back(count);
+        col_payload_.append(payload.data(), payload.size());
+        if (col_payload_.size() < block_size_) return;
+    } else {
+        if (!block_open_) open_block();
+        if (run_start) {
+            block_flags_ |= block_records_ == 0 ? run_format::BLOCK_OPENS_RUN : run_format::BLOCK_MIXED_RUNS;
+        }
+        run_format::append_record(out_, key, run_start, payload, count);
+        ++block_records_;
+        if (out_.size() - block_start_ < block_size_) return;
+    }
+
+    seal_block();
+    if (out_.size() >= flush_size_ / 2) write_pending();
+}
+
+template <class Key>
+bool BasicRunWriter<Key>::append_records(std::string_view records, std::uint32_t count) {
+    if (compress_ || run_pending_) return false;
+    const char* p = records.data();
+    const char* const end = p + records.size();
+    while (p < end) {
+        if (!block_open_) open_block();
+        const std::size_t used = out_.size() - block_start_;
+        const std::size_t room = block_size_ > used ? block_size_ - used : 0;
+        // Whole records up to the block size; record headers are only decoded
+        // where a block boundary falls.
+        const char* cut = end;
+        std::uint32_t n = count;
+        if (static_cast<std::size_t>(end - p) > room) {
+            cut = p;
+            n = 0;
+            run_format::Record<Key> rec{};
+            while (cut < end) {
+                const char* next = run_format::decode_record(cut, end, rec);
+                if (static_cast<std::size_t>(next - p) > room && (n > 0 || block_records_ > 0)) break;
+                cut = next;
+                ++n;
+            }
+        }
+        out_.append(p, static_cast<std::size_t>(cut - p));
+        block_records_ += n;
+        count -= n;
+        p = cut;
+        if (p == end && out_.size() - block_start_ < block_size_) break;
+        seal_block();
+        if (out_.size() >= flush_size_ / 2) write_pending();
+    }
+    return true;
+}
+
+template <class Key>
+void BasicRunWriter<Key>::flush() {
+    seal_block();
+    if (out_.empty()) {
+        writes_.wait();
+        return;
+    }
+    // The caller waits for the bytes anyway, so they are written here.
+    metrics::ScopedOp op(metrics::Op::WriterFlush);
+    op.add_bytes(out_.size());
+    writes_.wait();
+    writer_.write_all(out_.data(), out_.size());
+    out_.clear();
+}
+
+template <class Key>
+void BasicRunWriter<Key>::set_flush_size(std::size_t flush_size) {
+    flush_size_ = std::max(flush_size, block_size_);
+    const std::size_t wanted = flush_size_ / 2 + block_size_;
+    if (out_.capacity() <= 2 * wanted) return;
+    // Only the open block, at most one block_size, moves into the smaller buffer.
+    writes_.wait();
+    std::string().swap(in_flight_);
+    const std::size_t sealed = block_open_ ? block_start_ : out_.size();
+    if (sealed > 0) writer_.write_all(out_.data(), sealed);
+    std::string smaller;
+    smaller.reserve(wanted);
+    smaller.append(out_, sealed, std::string::npos);
+    out_.swap(smaller);
+    block_start_ = 0;
+}
+
+template <class Key>
+bool BasicRunWriter<Key>::copy_block_from(BasicRunReader<Key>& reader) {
+    if (run_pending_ || runs_ == 0) return false;
+    if (!reader.next_block_continues_run()) return false;
+    // The copied block must land on a block boundary, after everything already pushed.
+    flush();
+    return reader.copy_block_to(fm_);
+}
+
+template class BasicRunWriter<std::int32_t>;
+template class BasicRunWriter<std::int64_t>;
@@ -0,0 +1,67 @@
+#include "../../include/io/temp_storage.h"
+
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#ifndef _WIN32
+  #include <cerrno>
+  #include <sys/stat.h>
+#endif
+
+// Identifies the device a directory lives on; on Windows every directory counts as its own.
+static std::uint64_t device_of(const std::string& dir, std::size_t index) {
+#ifdef _WIN32
+    (void)dir;
+    return index;
+#else
+    (void)index;
+    struct stat st;
+    if (::stat(dir.c_str(), &st) != 0) {
+        int e = errno;
+        throw std::system_error(e, std::generic_category(), "stat failed: " + dir);
+    }
+    return static_cast<std::uint64_t>(st.st_dev);
+#endif
+}
+
+TempStorage::TempStorage(std::vector<std::string> dirs, std::uint64_t memory_quota, bool direct_io)
+    : quota_(memory_quota > 0 ? std::make_shared<TempQuota>(memory_quota) : nullptr), direct_io_(direct_io) {
+    if (dirs.empty()) throw std::invalid_argument("TempStorage needs at least one directory.");
+
+    // Devices in order of first appearance; even ones form side 0, odd ones side 1.
+    std::vector<std::uint64_t> devices;
+    for (std::size_t i = 0; i < dirs.size(); ++i) {
+        const std::uint64_t dev = device_of(dirs[i], i);
+        std::size_t d = 0;
+        while (d < devices.size() && devices[d] != dev) ++d;
+        if (d == devices.size()) devices.push_back(dev);
+        sides_[d % 2].push_back(std::move(dirs[i]));
+    }
+    if (sides_[1].empty()) sides_[1] = sides_[0];
+}
+
+std::vector<FileManager> TempStorage::make_bucket(const std::string& prefix, std::size_t count) {
+    const std::vector<std::string>& dirs = sides_[buckets_made_++ % 2];
+    std::vector<FileManager> files;
+    files.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        const std::filesystem::path dir(dirs[i % dirs.size()]);
+        const std::string path = (dir / (prefix + std::to_string(i) + ".txt")).string();
+        if (std::filesystem::exists(path)) {
+            std::filesystem::remove(path);
+        }
+        if (quota_) {
+            files.push_back(FileManager::temporary(path, quota_));
+        } else {
+            files.emplace_back(path, true, 0644);
+            if (direct_io_) files.back().set_direct_io(true);
+        }
+    }
+    return files;
+}
+
+std::uint64_t TempStorage::memory_used() const {
+    return quota_ ? quota_->used() : 0;
+}
@@ -0,0 +1,158 @@
+#include "../../include/io/thread_pool.h"
+#include "../../include/io/metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace {
+
+// The pool a worker thread belongs to, and its index there.
+thread_local const ThreadPool* t_pool = nullptr;
+thread_local std::size_t t_index = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i <= threads; ++i) queues_.push_back(std::make_unique<Queue>());
+    workers_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) workers_.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& w : workers_) w.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::submit(Task task, TaskPriority priority) {
+    const std::size_t q = t_pool == this ? t_index : queues_.size() - 1;
+    {
+        std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+        // Counted before it is visible, so queued_ never falls below the real number.
+        queued_.fetch_add(1, std::memory_order_relaxed);
+        queues_[q]->tasks[static_cast<std::size_t>(priority)].push_back(std::move(task));
+    }
+    // A worker checks queued_ under sleep_mutex_ before it sleeps; taking the
+    // mutex here means it either saw the task or is already waiting for this notify.
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    wake_.notify_one();
+}
+
+bool ThreadPool::run_one() {
+    Task task;
+    if (!take(t_pool == this ? t_index : queues_.size() - 1, task)) return false;
+    task();
+    return true;
+}
+
+// Highest priority first; within one: own deque (newest end), injection queue,
+// then the other workers' deques from their oldest end. `self` is the injection
+// queue for threads outside the pool.
+bool ThreadPool::take(std::size_t self, Task& task) {
+    if (queued_.load(std::memory_order_relaxed) == 0) return false;
+    const std::size_t inject = queues_.size() - 1;
+    for (std::size_t p = 0; p < TASK_PRIORITY_COUNT; ++p) {
+        for (std::size_t k = 0; k < queues_.size(); ++k) {
+            std::size_t q;
+            if (self == inject) q = k == 0 ? inject : k - 1;
+            else q = k == 0 ? self : k == 1 ? inject : (self + k - 1) % inject;
+
+            Queue& queue = *queues_[q];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            auto& tasks = queue.tasks[p];
+            if (tasks.empty()) continue;
+            if (q == self && self != inject) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            } else {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(std::size_t index) {
+    t_pool = this;
+    t_index = index;
+    metrics::count_thread();
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return stop_ || queued_.load(std::memory_order_relaxed) > 0; });
+        if (stop_ && queued_.load(std::memory_order_relaxed) == 0) return;
+    }
+}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {
+        // wait() is the place to see task errors; a destructor must not throw.
+    }
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    run(std::move(task), priority_);
+}
+
+void TaskGroup::run(std::function<void()> task, TaskPriority priority) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++pending_;
+    }
+    pool_.submit([this, task = std::move(task)] {
+        std::exception_ptr error;
+        try {
+            task();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // Notified under the lock: once wait() sees zero, this task no longer touches the group.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error && !error_) error_ = error;
+        if (--pending_ == 0) done_.notify_all();
+    }, priority);
+}
+
+void TaskGroup::wait() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pending_ == 0) break;
+        }
+        if (pool_.run_one()) continue;
+        // Nothing to help with: the group's tasks are running elsewhere. The timeout
+        // picks up tasks they submit in the meantime.
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait_for(lock, std::chrono::milliseconds(1), [this] { return pending_ == 0; });
+    }
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error = std::exchange(error_, nullptr);
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+bool TaskGroup::idle() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_ == 0;
+}
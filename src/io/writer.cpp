@@ -1,4 +1,5 @@
 #include "../include/io/writer.h"
+#include "../include/io/metrics.h"
 #include <system_error>
 #include <cerrno>
 #include <cstring>
@@ -17,6 +18,13 @@ std::size_t Writer::write_all(const char* data, std::size_t len) {
     if (!fm_.is_open()) {
         throw std::system_error(EINVAL, std::generic_category(), "file not open");
     }
+    metrics::ScopedOp op(metrics::Op::WriterWrite);
+    op.add_bytes(len);
+    fm_.will_write(len);
+    if (fm_.direct_io()) {
+        fm_.direct_write(data, len);
+        return len;
+    }
     std::size_t written = 0;
 #ifdef _WIN32
     HANDLE h = fm_.native_handle();
@@ -61,6 +69,7 @@ void Writer::reset_cursor() {
 }
 
 void Writer::flush() {
+    metrics::ScopedOp op(metrics::Op::WriterFlush);
 #ifdef _WIN32
     HANDLE h = fm_.native_handle();
     if (!FlushFileBuffers(h)) {
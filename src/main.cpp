@@ -1,50 +1,231 @@
 #include <array>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <vector>
 #include <fstream>
 #include <memory>
 #include <filesystem>
 #include <fcntl.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #include "../include/io/manager.h"
+#include "../include/io/memory_budget.h"
+#include "../include/io/metrics.h"
+#include "../include/io/temp_storage.h"
+#include "../include/solution/in_memory.h"
 
 #if SOLUTION_TYPE == 1
 #include "../include/solution/standard.h"
 using ActiveSolution = StdSolution;
+using ActivePolicy = IntPrefixKey;
 #elif SOLUTION_TYPE == 2
 #include "../include/solution/modified.h"
+#include "../include/solution/sort_spec.h"
 using ActiveSolution = ModifiedSolution;
 #elif SOLUTION_TYPE == 3
 #include "../include/solution/ai.h"
 using ActiveSolution = AiSolution;
+using ActivePolicy = WholeLineKey;
 #else
 #error "Unknown solution type"
 #endif
 
-std::vector<FileManager> initialize_merge_files(const std::string &prefix, std::size_t count) {
-    std::vector<FileManager> files;
-    files.reserve(count);
-    for (std::size_t i = 0; i < count; i++) {
-        const std::string path = prefix + std::to_string(i) + ".txt";
-        if (std::filesystem::exists(path)) {
-            std::filesystem::remove(path);
+#if SOLUTION_TYPE == 2
+// Command line of modified_main:
+//   --key=SPEC   sort by a field spec such as "date,num" or "alpha:desc" (see sort_spec.h)
+//   --top=N      write only the N smallest lines; not with the duplicate flags below
+//   --unique, --unique-by-key, --count   collapse duplicates (see DedupMode)
+//   --input=PATH, --output=PATH          default input.txt and output.txt; "-" means
+//                                        stdin/stdout: generator - 1g | modified_main --input=- --output=-
+//   --temp-dir=DIR[,DIR...]   where the b/c run files go (default: current directory);
+//                        several directories are striped, reads and writes on different devices
+//   --temp-memory=SIZE   keep run files in memory up to SIZE bytes (suffix k, m or g)
+//                        and spill the rest to --temp-dir; 0 (default) keeps them on disk
+//   --memory=SIZE        most memory the buffers may take (default 500m); less while the
+//                        cgroup limit or memory pressure requires it (see memory_budget.h)
+//   --metrics=PATH       write phase timings, I/O and merge counters as JSON to PATH ("-": stderr)
+//   --hw-counters        add CPU cycles, instructions, LLC and branch misses per phase to the
+//                        --metrics report (default PATH "-"); Linux perf_event_open
+//   --trace=PATH         write a Chrome trace-event timeline of passes, refills, writes and
+//                        read waits per thread to PATH (load in chrome://tracing or Perfetto)
+//   --direct-io          bypass the page cache (O_DIRECT) for input, output and on-disk run
+//                        files where the filesystem allows it
+//   --compress-runs      block-compress the temporary runs (see io/block_codec.h): less
+//                        temp I/O and memory tier space for some CPU time
+//   --threads=N          threads that parse and sort the input (default: one per core)
+struct CommandLine {
+    std::string input_path = "input.txt";
+    std::string output_path = "output.txt";
+    std::string key_spec;
+    std::vector<std::string> temp_dirs;
+    std::uint64_t temp_memory = 0;
+    std::uint64_t memory = MemoryBudget::DEFAULT_CEILING;
+    bool direct_io = false;
+    std::string metrics_path;
+    std::string trace_path;
+    bool hw_counters = false;
+    bool has_top = false;
+    std::uint64_t top = 0;
+    SortOptions options;
+};
+
+static std::uint64_t parse_bytes(const std::string &text) {
+    std::size_t used = 0;
+    std::uint64_t value = std::stoull(text, &used);
+    const std::string suffix = text.substr(used);
+    if (suffix == "k" || suffix == "K") value <<= 10;
+    else if (suffix == "m" || suffix == "M") value <<= 20;
+    else if (suffix == "g" || suffix == "G") value <<= 30;
+    else if (!suffix.empty()) throw std::invalid_argument("Unknown size suffix: " + suffix);
+    return value;
+}
+
+static CommandLine parse_command_line(int argc, char const *argv[]) {
+    CommandLine cl;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind("--input=", 0) == 0) {
+            cl.input_path = arg.substr(8);
+        } else if (arg.rfind("--output=", 0) == 0) {
+            cl.output_path = arg.substr(9);
+        } else if (arg.rfind("--temp-dir=", 0) == 0) {
+            std::string::size_type start = 11;
+            while (true) {
+                const std::string::size_type comma = arg.find(',', start);
+                const std::string dir = arg.substr(start, comma - start);
+                if (dir.empty()) throw std::invalid_argument("Empty directory in " + arg);
+                cl.temp_dirs.push_back(dir);
+                if (comma == std::string::npos) break;
+                start = comma + 1;
+            }
+        } else if (arg.rfind("--temp-memory=", 0) == 0) {
+            cl.temp_memory = parse_bytes(arg.substr(14));
+        } else if (arg.rfind("--memory=", 0) == 0) {
+            cl.memory = parse_bytes(arg.substr(9));
+            if (cl.memory == 0) throw std::invalid_argument("--memory must be positive");
+        } else if (arg.rfind("--metrics=", 0) == 0) {
+            cl.metrics_path = arg.substr(10);
+        } else if (arg == "--hw-counters") {
+            cl.hw_counters = true;
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            cl.trace_path = arg.substr(8);
+        } else if (arg == "--direct-io") {
+            cl.direct_io = true;
+        } else if (arg == "--compress-runs") {
+            cl.options.compress_runs = true;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            cl.options.threads = static_cast<unsigned>(std::stoul(arg.substr(10)));
+        } else if (arg.rfind("--key=", 0) == 0) {
+            cl.key_spec = arg.substr(6);
+        } else if (arg.rfind("--top=", 0) == 0) {
+            cl.has_top = true;
+            cl.top = std::stoull(arg.substr(6));
+        } else if (arg == "--unique") {
+            cl.options.dedup = DedupMode::Unique;
+        } else if (arg == "--unique-by-key") {
+            cl.options.dedup = DedupMode::UniqueByKey;
+        } else if (arg == "--count") {
+            cl.options.dedup = DedupMode::Count;
+        } else {
+            throw std::invalid_argument("Unknown argument: " + arg);
         }
-        files.emplace_back(path, true, 0644);
     }
-    return files;
+    if (cl.has_top && cl.options.dedup != DedupMode::None) {
+        throw std::invalid_argument("--top cannot be combined with --unique, --unique-by-key or --count");
+    }
+    if (cl.hw_counters && cl.metrics_path.empty()) cl.metrics_path = "-";
+    return cl;
+}
+
+static FileManager open_input(const std::string &path) {
+    return path == "-" ? FileManager::standard_input() : FileManager(path, false);
+}
+
+static FileManager open_output(const std::string &path) {
+    return path == "-" ? FileManager::standard_output() : FileManager(path, true, 0644);
 }
 
-int main(int argc, char const *argv[]) {
+template <class Solution>
+static void run_solution(Solution &solution, const CommandLine &cl, FileManager &in, FileManager &out) {
+    if (cl.has_top) {
+        solution.top_k(in, out, cl.top);
+    } else {
+        solution.sort(in, out);
+    }
+}
+#endif
+
+// Only modified_main takes arguments; std_main and ai_main sort input.txt into output.txt.
+int main([[maybe_unused]] int argc, [[maybe_unused]] char const *argv[]) {
     constexpr int FILE_COUNT = 3;
+
+#if SOLUTION_TYPE == 2
+    // The last merge pass writes the output directly, no copy out of the b/c files;
+    // presorted input and input that fits in memory skip the temp files altogether.
+    const CommandLine cl = parse_command_line(argc, argv);
+    memory_budget().set_ceiling(cl.memory);
+#if defined(__GLIBC__)
+    // glibc raises its mmap threshold to the largest block freed so far (up to 32 MiB),
+    // so segments, run blocks and writer buffers would come from the heap, where
+    // freed pages stay resident beside the next pass's buffers. A fixed, low
+    // threshold keeps them in mappings that go back to the kernel when freed.
+    mallopt(M_MMAP_THRESHOLD, 64 << 10);
+    // Each thread would otherwise get an arena of its own, reserving 64 MiB of
+    // address space apiece: beyond a `ulimit -v` with the reader, writer, prefetch
+    // and pool threads. Large buffers bypass the arenas anyway (see above).
+    mallopt(M_ARENA_MAX, 1);
+#endif
+    if (!cl.metrics_path.empty()) metrics::enable();
+    if (cl.hw_counters) metrics::enable_hardware_counters();
+    if (!cl.trace_path.empty()) metrics::enable_trace();
+    FileManager in_manager = open_input(cl.input_path);
+    FileManager out_manager = open_output(cl.output_path);
+    if (cl.direct_io) {
+        in_manager.set_direct_io(true);
+        out_manager.set_direct_io(true);
+    }
+    TempStorage temp(cl.temp_dirs.empty() ? std::vector<std::string>{"."} : cl.temp_dirs, cl.temp_memory,
+                     cl.direct_io);
+    std::vector<FileManager> b_files = temp.make_bucket("b", FILE_COUNT);
+    std::vector<FileManager> c_files = temp.make_bucket("c", FILE_COUNT);
+    if (!cl.key_spec.empty()) {
+        BasicModifiedSolution<NormalizedKey> solution(b_files, c_files, cl.options,
+                                                      NormalizedKey(SortSpec::parse(cl.key_spec)));
+        run_solution(solution, cl, in_manager, out_manager);
+    } else {
+        ActiveSolution solution(b_files, c_files, cl.options);
+        run_solution(solution, cl, in_manager, out_manager);
+    }
+    if (!cl.metrics_path.empty()) metrics::write_report(cl.metrics_path);
+    if (!cl.trace_path.empty()) metrics::write_trace(cl.trace_path);
+#else
     const std::string SOURCE_PATH = "input.txt";
     auto in_manager = FileManager(SOURCE_PATH, O_RDWR, 0644);
-    std::vector<FileManager> b_files = initialize_merge_files( "b", FILE_COUNT);
-    std::vector<FileManager> c_files = initialize_merge_files( "c", FILE_COUNT);
+    // These solutions fix their limit up front: the budget the cgroup allows at startup.
+    const std::uint64_t MEMORY_LIMIT = memory_budget().current();
+    // Input that fits the limit is sorted in one buffer straight into output.txt;
+    // larger input goes through the temp files and the result is cloned there.
+    FileManager out_manager("output.txt", true, 0644);
+    if (sort_in_memory<ActivePolicy>(in_manager, out_manager, MEMORY_LIMIT)) return 0;
 
-    ActiveSolution solution(b_files, c_files, 500 * 1024 * 1024); // 500 MB limit for AI solution
+    TempStorage temp;
+    std::vector<FileManager> b_files = temp.make_bucket("b", FILE_COUNT);
+    std::vector<FileManager> c_files = temp.make_bucket("c", FILE_COUNT);
+
+#if SOLUTION_TYPE == 1
+    ActiveSolution solution(b_files, c_files); // streams line by line, nothing to bound
+#else
+    ActiveSolution solution(b_files, c_files, MEMORY_LIMIT); // at most 500 MB for AI solution
+#endif
 
     Reader in(in_manager);
     solution.load_initial_series(in);
 
-    const FileManager &result = solution.external_sort();
+    FileManager &result = solution.external_sort();
+    result.clone_to(out_manager);
+#endif
     return 0;
 }
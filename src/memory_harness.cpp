@@ -0,0 +1,266 @@
+// memory_harness.cpp
+// Runs a solution binary under a memory cap and reports how close it gets to the
+// memory budget: peak RSS and page faults for the whole run, and per phase for
+// binaries that write a --metrics report (modified_main).
+//
+// Example: ./memory_harness --as-limit=512000k --budget=500m --phases -- ./modified_main
+//
+//   --as-limit=SIZE     RLIMIT_AS for the child, like `ulimit -v` (suffix k, m or g)
+//   --rss-limit=SIZE    kill the child once its RSS exceeds SIZE
+//   --budget=SIZE       budget the percentages refer to (default 500m)
+//   --interval-ms=N     /proc sampling period (default 10)
+//   --phases            pass --metrics=<temp file> to the child and report its phases
+//   --fail-above-budget exit 1 if the peak RSS exceeds --budget
+//
+// Linux only: samples /proc/<pid>/status and /proc/<pid>/stat while the child runs
+// and takes the final peak and fault counts from wait4().
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct Options {
+    std::uint64_t as_limit = 0;
+    std::uint64_t rss_limit = 0;
+    std::uint64_t budget = 500ull << 20;
+    unsigned interval_ms = 10;
+    bool phases = false;
+    bool fail_above_budget = false;
+    std::vector<std::string> command;
+};
+
+struct Sample {
+    std::uint64_t rss = 0;      // bytes
+    std::uint64_t peak_rss = 0; // bytes, VmHWM
+    std::uint64_t minor_faults = 0;
+    std::uint64_t major_faults = 0;
+};
+
+static std::uint64_t parse_bytes(const std::string &text) {
+    std::size_t used = 0;
+    std::uint64_t value = std::stoull(text, &used);
+    const std::string suffix = text.substr(used);
+    if (suffix == "k" || suffix == "K") value <<= 10;
+    else if (suffix == "m" || suffix == "M") value <<= 20;
+    else if (suffix == "g" || suffix == "G") value <<= 30;
+    else if (!suffix.empty()) throw std::invalid_argument("Unknown size suffix: " + suffix);
+    return value;
+}
+
+static Options parse_options(int argc, char const *argv[]) {
+    Options o;
+    int i = 1;
+    for (; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--") {
+            ++i;
+            break;
+        } else if (arg.rfind("--as-limit=", 0) == 0) {
+            o.as_limit = parse_bytes(arg.substr(11));
+        } else if (arg.rfind("--rss-limit=", 0) == 0) {
+            o.rss_limit = parse_bytes(arg.substr(12));
+        } else if (arg.rfind("--budget=", 0) == 0) {
+            o.budget = parse_bytes(arg.substr(9));
+        } else if (arg.rfind("--interval-ms=", 0) == 0) {
+            o.interval_ms = static_cast<unsigned>(std::stoul(arg.substr(14)));
+        } else if (arg == "--phases") {
+            o.phases = true;
+        } else if (arg == "--fail-above-budget") {
+            o.fail_above_budget = true;
+        } else {
+            throw std::invalid_argument("Unknown argument: " + arg);
+        }
+    }
+    for (; i < argc; ++i) o.command.emplace_back(argv[i]);
+    if (o.command.empty()) throw std::invalid_argument("No command given after --");
+    if (o.budget == 0) throw std::invalid_argument("--budget must be positive");
+    return o;
+}
+
+// False once the process is gone.
+static bool sample_process(pid_t pid, Sample &s) {
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    if (!status) return false;
+    std::string key;
+    while (status >> key) {
+        std::uint64_t kb = 0;
+        if (key == "VmRSS:") {
+            status >> kb;
+            s.rss = kb * 1024;
+        } else if (key == "VmHWM:") {
+            status >> kb;
+            s.peak_rss = std::max(s.peak_rss, kb * 1024);
+        }
+        status.ignore(1 << 20, '\n');
+    }
+    // Fields 10 and 12 of /proc/<pid>/stat, counted after the parenthesised name.
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) return false;
+    const std::size_t close = line.rfind(')');
+    if (close == std::string::npos) return false;
+    std::istringstream rest(line.substr(close + 2));
+    std::string field;
+    std::vector<std::string> fields;
+    while (fields.size() < 10 && rest >> field) fields.push_back(field);
+    if (fields.size() == 10) {
+        s.minor_faults = std::stoull(fields[7]);
+        s.major_faults = std::stoull(fields[9]);
+    }
+    return true;
+}
+
+static std::string mib(std::uint64_t bytes) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.1f MiB", static_cast<double>(bytes) / (1 << 20));
+    return buf;
+}
+
+static std::string percent(std::uint64_t bytes, std::uint64_t budget) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.1f%%", 100.0 * static_cast<double>(bytes) / static_cast<double>(budget));
+    return buf;
+}
+
+// The phases of a metrics report: name and peak_rss_bytes in the order written.
+static void print_phases(const std::string &path, std::uint64_t budget) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string report = ss.str();
+    std::size_t pos = report.find("\"phases\"");
+    if (pos == std::string::npos) {
+        std::cerr << "phases: none reported\n";
+        return;
+    }
+    std::cerr << "phases:\n";
+    const std::string name_key = "\"name\": \"";
+    const std::string peak_key = "\"peak_rss_bytes\": ";
+    while ((pos = report.find(name_key, pos)) != std::string::npos) {
+        pos += name_key.size();
+        const std::string name = report.substr(pos, report.find('"', pos) - pos);
+        const std::size_t peak = report.find(peak_key, pos);
+        if (peak == std::string::npos) break;
+        const std::uint64_t bytes = std::stoull(report.substr(peak + peak_key.size()));
+        char line[128];
+        std::snprintf(line, sizeof(line), "  %-18s peak_rss %12s  %7s of budget\n", name.c_str(), mib(bytes).c_str(),
+                      percent(bytes, budget).c_str());
+        std::cerr << line;
+        pos = peak;
+    }
+}
+
+int main(int argc, char const *argv[]) {
+    Options o;
+    try {
+        o = parse_options(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n"
+                  << "usage: memory_harness [--as-limit=SIZE] [--rss-limit=SIZE] [--budget=SIZE]"
+                     " [--interval-ms=N] [--phases] [--fail-above-budget] -- command [args...]\n";
+        return 2;
+    }
+
+    std::string metrics_path;
+    if (o.phases) {
+        metrics_path = "/tmp/memory_harness." + std::to_string(getpid()) + ".json";
+        o.command.push_back("--metrics=" + metrics_path);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        std::perror("fork");
+        return 2;
+    }
+    if (pid == 0) {
+        if (o.as_limit > 0) {
+            rlimit lim{static_cast<rlim_t>(o.as_limit), static_cast<rlim_t>(o.as_limit)};
+            if (setrlimit(RLIMIT_AS, &lim) != 0) {
+                std::perror("setrlimit");
+                _exit(127);
+            }
+        }
+        std::vector<char *> args;
+        for (auto &a : o.command) args.push_back(&a[0]);
+        args.push_back(nullptr);
+        execvp(args[0], args.data());
+        std::perror("execvp");
+        _exit(127);
+    }
+
+    Sample peak;
+    bool killed_for_rss = false;
+    int status = 0;
+    rusage usage{};
+    while (true) {
+        const pid_t done = wait4(pid, &status, WNOHANG, &usage);
+        if (done == pid) break;
+        if (done < 0 && errno != EINTR) {
+            std::perror("wait4");
+            return 2;
+        }
+        Sample now;
+        if (sample_process(pid, now)) {
+            peak.peak_rss = std::max({peak.peak_rss, now.peak_rss, now.rss});
+            peak.minor_faults = now.minor_faults;
+            peak.major_faults = now.major_faults;
+            if (o.rss_limit > 0 && now.rss > o.rss_limit && !killed_for_rss) {
+                killed_for_rss = true;
+                kill(pid, SIGKILL);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(o.interval_ms));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // wait4 has the exact figures; the samples only matter for the RSS cap.
+    peak.peak_rss = std::max(peak.peak_rss, static_cast<std::uint64_t>(usage.ru_maxrss) * 1024);
+    peak.minor_faults = static_cast<std::uint64_t>(usage.ru_minflt);
+    peak.major_faults = static_cast<std::uint64_t>(usage.ru_majflt);
+
+    std::cerr << "command:      ";
+    for (std::size_t i = 0; i < o.command.size(); ++i) std::cerr << (i ? " " : "") << o.command[i];
+    std::cerr << "\n";
+    if (killed_for_rss) {
+        std::cerr << "result:       killed, RSS above " << mib(o.rss_limit) << "\n";
+    } else if (WIFSIGNALED(status)) {
+        std::cerr << "result:       signal " << WTERMSIG(status) << "\n";
+    } else {
+        std::cerr << "result:       exit " << WEXITSTATUS(status) << "\n";
+    }
+    char line[160];
+    std::snprintf(line, sizeof(line), "wall:         %.2f s\n", seconds);
+    std::cerr << line;
+    std::cerr << "peak_rss:     " << mib(peak.peak_rss) << " (" << percent(peak.peak_rss, o.budget) << " of "
+              << mib(o.budget) << " budget)\n";
+    std::cerr << "page_faults:  " << peak.minor_faults << " minor, " << peak.major_faults << " major\n";
+    if (o.phases) {
+        print_phases(metrics_path, o.budget);
+        std::remove(metrics_path.c_str());
+    }
+
+    if (killed_for_rss) return 1;
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WEXITSTATUS(status) == 0 && o.fail_above_budget && peak.peak_rss > o.budget) {
+        std::cerr << "result:       peak RSS above the budget\n";
+        return 1;
+    }
+    return WEXITSTATUS(status);
+}
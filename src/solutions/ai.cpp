@@ -1,16 +1,20 @@
 #include "../../include/solution/ai.h"
 #include "../../include/io/buffered_writer.h"
 #include "../../include/io/reader.h"
+#include "../../include/io/metrics.h"
 #include <utility>
 
-AiSolution::AiSolution(std::vector<FileManager>& first_bucket,
-                       std::vector<FileManager>& second_bucket,
-                       std::size_t memory_limit_bytes)
+template <class KeyPolicy>
+BasicAiSolution<KeyPolicy>::BasicAiSolution(std::vector<FileManager>& first_bucket,
+                                            std::vector<FileManager>& second_bucket,
+                                            std::size_t memory_limit_bytes)
     : Solution(first_bucket, second_bucket),
       memory_limit_bytes_(memory_limit_bytes),
       current_memory_usage_(0) {}
 
-void AiSolution::load_initial_series(Reader& in) {
+template <class KeyPolicy>
+void BasicAiSolution<KeyPolicy>::load_initial_series(Reader& in) {
+    metrics::ScopedPhase phase("run_formation");
     if (in.is_end()) {
         return;
     }
@@ -47,7 +51,7 @@ void AiSolution::load_initial_series(Reader& in) {
 
         if (in.get_line(line_view)) {
             std::string new_line(line_view);
-            if (new_line >= smallest) {
+            if (!KeyPolicy::less(KeyPolicy::extract(new_line), KeyPolicy::extract(smallest))) {
                 current_memory_usage_ += new_line.capacity() + sizeof(std::string);
                 min_heap.push(std::move(new_line));
             } else {
@@ -75,7 +79,8 @@ void AiSolution::load_initial_series(Reader& in) {
     }
 }
 
-FileManager& AiSolution::external_sort() {
+template <class KeyPolicy>
+FileManager& BasicAiSolution<KeyPolicy>::external_sort() {
     auto* source_bucket_ref = &first_;
     auto* dest_bucket_ref = &second_;
 
@@ -107,9 +112,11 @@ FileManager& AiSolution::external_sort() {
     return *final_bucket[0];
 }
 
-void AiSolution::merge_pass(
+template <class KeyPolicy>
+void BasicAiSolution<KeyPolicy>::merge_pass(
     std::vector<FileManager>& source_bucket,
     std::vector<FileManager>& dest_bucket) {
+    metrics::ScopedPhase phase("merge_pass");
 
     // Cast to the pointer-based vector type that the logic can work with.
     auto& source_files = reinterpret_cast<std::vector<std::unique_ptr<FileManager>>&>(source_bucket);
@@ -153,7 +160,8 @@ void AiSolution::merge_pass(
     writer.flush();
 }
 
-bool AiSolution::is_sorted() const {
+template <class KeyPolicy>
+bool BasicAiSolution<KeyPolicy>::is_sorted() const {
     int non_empty_files = 0;
     // Here, we can iterate directly. We must use the dot operator `.` because
     // `file` is a reference to a FileManager object, not a pointer.
@@ -170,3 +178,7 @@ bool AiSolution::is_sorted() const {
     return non_empty_files <= 1;
 }
 
+template class BasicAiSolution<IntPrefixKey>;
+template class BasicAiSolution<Int64PrefixKey>;
+template class BasicAiSolution<DateFieldKey>;
+template class BasicAiSolution<WholeLineKey>;
@@ -0,0 +1,265 @@
+#include "../../include/solution/in_memory.h"
+#include "../../include/solution/key.h"
+#include "../../include/solution/sort_spec.h"
+#include "../../include/solution/parallel_sort.h"
+#include "../../include/io/buffered_writer.h"
+#include "../../include/io/fast_writer.h"
+#include "../../include/io/thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+static constexpr std::size_t READ_CHUNK_SIZE = 8 << 20;
+// Ranges smaller than this are not worth a thread of their own.
+static constexpr std::uint64_t MIN_RANGE_BYTES = 4ull << 20;
+static constexpr std::size_t OUTPUT_BUFFER_SIZE = 8 << 20;
+// Start of the file parsed to estimate the index before the whole file is read.
+static constexpr std::size_t SAMPLE_BYTES = 1 << 20;
+
+namespace {
+
+// One line of the input: its run key and where its record lives, in the input
+// buffer for PlainRecords policies and in the record arena otherwise.
+template <class KeyPolicy>
+struct IndexEntry {
+    typename KeyPolicy::run_key_type key;
+    std::uint32_t size;
+    std::uint64_t offset;
+};
+
+template <class KeyPolicy>
+struct ParsedRange {
+    std::vector<IndexEntry<KeyPolicy>> entries;
+    std::string arena;
+    bool fits = true; // false once a record is too long for the index
+};
+
+} // namespace
+
+template <class KeyPolicy>
+static void parse_range(const KeyPolicy &policy, const char *data, std::size_t begin, std::size_t end,
+                        ParsedRange<KeyPolicy> &out) {
+    constexpr bool plain = std::is_base_of_v<PlainRecords, KeyPolicy>;
+    std::string scratch;
+    std::string_view record;
+    const char *p = data + begin;
+    const char *stop = data + end;
+    while (p < stop) {
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<std::size_t>(stop - p)));
+        std::string_view line(p, static_cast<std::size_t>((nl ? nl : stop) - p));
+        p = nl ? nl + 1 : stop;
+        // Same normalisation as run formation.
+        line = strip_carriage_return(line);
+        if (line.empty()) continue;
+
+        if (!policy.ingest(line, scratch, record)) {
+            throw std::runtime_error("Line does not match the sort spec: " + std::string(line));
+        }
+        if (record.size() > std::numeric_limits<std::uint32_t>::max()) {
+            out.fits = false;
+            return;
+        }
+        IndexEntry<KeyPolicy> entry{KeyPolicy::run_key(KeyPolicy::extract(record)),
+                                    static_cast<std::uint32_t>(record.size()), 0};
+        if constexpr (plain) {
+            entry.offset = static_cast<std::uint64_t>(record.data() - data);
+        } else {
+            entry.offset = out.arena.size();
+            out.arena.append(record.data(), record.size());
+        }
+        out.entries.push_back(entry);
+    }
+}
+
+// Bytes the sort would take at its peak, estimated from the whole lines in the
+// first SAMPLE_BYTES of the file: the input buffer, the record arena and the
+// index twice (merge target). Scanning the sample costs one small read, where
+// finding out after loading would cost the whole file and could overshoot.
+template <class KeyPolicy>
+static std::uint64_t estimated_footprint(const FileManager &source, std::uint64_t file_size,
+                                         const KeyPolicy &policy) {
+    constexpr bool plain = std::is_base_of_v<PlainRecords, KeyPolicy>;
+    std::string sample(static_cast<std::size_t>(std::min<std::uint64_t>(SAMPLE_BYTES, file_size)), '\0');
+    for (std::size_t done = 0; done < sample.size();) {
+        const std::size_t n = source.read_at(&sample[done], sample.size() - done, done);
+        if (n == 0) throw std::runtime_error("Short read while sampling input.");
+        done += n;
+    }
+    if (sample.size() < file_size) {
+        const std::size_t nl = sample.rfind('\n');
+        // A line longer than the sample: the index is negligible next to the records.
+        if (nl == std::string::npos) return plain ? file_size : 2 * file_size;
+        sample.resize(nl + 1);
+    }
+    if (sample.empty()) return 0;
+
+    ParsedRange<KeyPolicy> parsed;
+    parse_range(policy, sample.data(), 0, sample.size(), parsed);
+    if (!parsed.fits) return std::numeric_limits<std::uint64_t>::max();
+    const double scale = static_cast<double>(file_size) / static_cast<double>(sample.size());
+    const auto entries = static_cast<std::uint64_t>(static_cast<double>(parsed.entries.size()) * scale) + 1;
+    const auto arena = static_cast<std::uint64_t>(static_cast<double>(parsed.arena.size()) * scale);
+    return file_size + arena + 2 * entries * sizeof(IndexEntry<KeyPolicy>);
+}
+
+template <class KeyPolicy>
+struct SortedIndex {
+    std::unique_ptr<char[]> buffer; // the input; released once PlainRecords are not needed
+    std::vector<IndexEntry<KeyPolicy>> entries;
+    std::string arena;
+};
+
+// Loads source into one buffer and sorts an index of its lines. Returns false if
+// that would exceed memory_budget; may throw std::bad_alloc on the way.
+template <class KeyPolicy>
+static bool load_sorted(FileManager &source, std::uint64_t memory_budget, unsigned threads,
+                        const KeyPolicy &policy, SortedIndex<KeyPolicy> &out) {
+    using Entry = IndexEntry<KeyPolicy>;
+    constexpr bool plain = std::is_base_of_v<PlainRecords, KeyPolicy>;
+
+    const std::uint64_t file_size = source.size();
+    if (file_size > memory_budget || file_size > std::numeric_limits<std::size_t>::max()) return false;
+    if (estimated_footprint(source, file_size, policy) > memory_budget) return false;
+    const std::size_t size = static_cast<std::size_t>(file_size);
+
+    // One buffer for the whole input, filled by parallel positional reads.
+    std::unique_ptr<char[]> buffer(new char[size > 0 ? size : 1]);
+    const std::size_t read_chunks = (size + READ_CHUNK_SIZE - 1) / READ_CHUNK_SIZE;
+    const std::size_t readers = std::min<std::size_t>(threads, read_chunks);
+    parallel_for(readers, [&](std::size_t r) {
+        for (std::size_t c = r; c < read_chunks; c += readers) {
+            const std::size_t begin = c * READ_CHUNK_SIZE;
+            const std::size_t len = std::min(READ_CHUNK_SIZE, size - begin);
+            for (std::size_t done = 0; done < len;) {
+                const std::size_t n = source.read_at(buffer.get() + begin + done, len - done, begin + done);
+                if (n == 0) throw std::runtime_error("Short read while loading input.");
+                done += n;
+            }
+        }
+    });
+
+    // Line-aligned ranges, parsed in parallel.
+    const std::size_t range_count = static_cast<std::size_t>(
+        std::max<std::uint64_t>(1, std::min<std::uint64_t>(threads, file_size / MIN_RANGE_BYTES)));
+    std::vector<std::size_t> bounds;
+    for (std::size_t i = 0; i < range_count; ++i) {
+        std::size_t b = size * i / range_count;
+        if (b > 0) {
+            const void *nl = std::memchr(buffer.get() + b - 1, '\n', size - (b - 1));
+            b = nl ? static_cast<std::size_t>(static_cast<const char *>(nl) - buffer.get()) + 1 : size;
+        }
+        if (bounds.empty() || b > bounds.back()) bounds.push_back(b);
+    }
+    bounds.push_back(size);
+    std::vector<ParsedRange<KeyPolicy>> ranges(bounds.size() - 1);
+
+    // Every line has at most one entry: count them, check the index against the
+    // budget with that bound and reserve it, so no vector grows by doubling.
+    std::vector<std::uint64_t> lines(ranges.size());
+    parallel_for(ranges.size(), [&](std::size_t i) {
+        const char *begin = buffer.get() + bounds[i];
+        const char *end = buffer.get() + bounds[i + 1];
+        lines[i] = static_cast<std::uint64_t>(std::count(begin, end, '\n')) + (end > begin && end[-1] != '\n');
+    });
+    std::uint64_t line_count = 0;
+    for (const std::uint64_t n : lines) line_count += n;
+    if (file_size + 2 * line_count * sizeof(Entry) > memory_budget) return false;
+    parallel_for(ranges.size(), [&](std::size_t i) {
+        ranges[i].entries.reserve(static_cast<std::size_t>(lines[i]));
+        parse_range(policy, buffer.get(), bounds[i], bounds[i + 1], ranges[i]);
+    });
+
+    // The sort needs the index twice (merge target) next to the records.
+    std::uint64_t entry_count = 0;
+    std::uint64_t arena_bytes = 0;
+    for (const auto &r : ranges) {
+        if (!r.fits) return false;
+        entry_count += r.entries.size();
+        arena_bytes += r.arena.size();
+    }
+    if (file_size + arena_bytes + 2 * entry_count * sizeof(Entry) > memory_budget) return false;
+
+    std::vector<Entry> &entries = out.entries;
+    entries.reserve(static_cast<std::size_t>(entry_count));
+    std::string &arena = out.arena;
+    arena.reserve(static_cast<std::size_t>(arena_bytes));
+    for (auto &r : ranges) {
+        const std::uint64_t base = arena.size();
+        for (Entry e : r.entries) {
+            e.offset += base;
+            entries.push_back(e);
+        }
+        arena.append(r.arena);
+        r = ParsedRange<KeyPolicy>();
+    }
+    // Ingested records carry the line; the raw input is no longer needed.
+    if constexpr (!plain) buffer.reset();
+    const char *records = plain ? buffer.get() : arena.data();
+
+    auto record = [records](const Entry &e) { return std::string_view(records + e.offset, e.size); };
+    // The offset tie-break keeps equal keys in input order.
+    parallel_sort(entries, threads, [&record](const Entry &a, const Entry &b) {
+        if (a.key != b.key) return a.key < b.key;
+        if constexpr (!KeyPolicy::run_key_exact) {
+            const auto ka = KeyPolicy::extract(record(a));
+            const auto kb = KeyPolicy::extract(record(b));
+            if (KeyPolicy::less(ka, kb)) return true;
+            if (KeyPolicy::less(kb, ka)) return false;
+        }
+        return a.offset < b.offset;
+    });
+    out.buffer = std::move(buffer);
+    return true;
+}
+
+template <class KeyPolicy>
+bool sort_in_memory(FileManager &source, FileManager &output, std::uint64_t memory_budget,
+                    unsigned threads, const KeyPolicy &policy) {
+    using Entry = IndexEntry<KeyPolicy>;
+    constexpr bool plain = std::is_base_of_v<PlainRecords, KeyPolicy>;
+
+    if (!source.is_seekable()) return false;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    SortedIndex<KeyPolicy> sorted;
+    try {
+        if (!load_sorted(source, memory_budget, threads, policy, sorted)) return false;
+    } catch (const std::bad_alloc &) {
+        // The budget is an estimate: an address-space limit may still refuse the
+        // buffers. The external path needs far less at once.
+        return false;
+    }
+    const char *records = plain ? sorted.buffer.get() : sorted.arena.data();
+
+    if (output.is_seekable()) output.clear();
+    output.preallocate(source.size() + 1);
+    {
+        BufferedWriter bw(output);
+        FastWriterWrapper writer(bw, OUTPUT_BUFFER_SIZE);
+        for (const Entry &e : sorted.entries) {
+            writer.push_line(KeyPolicy::record_text(std::string_view(records + e.offset, e.size)));
+        }
+    }
+    if (output.is_seekable()) output.reset_cursor();
+    return true;
+}
+
+#define INSTANTIATE_IN_MEMORY(Policy) \
+    template bool sort_in_memory<Policy>(FileManager &, FileManager &, std::uint64_t, unsigned, const Policy &);
+
+INSTANTIATE_IN_MEMORY(IntPrefixKey)
+INSTANTIATE_IN_MEMORY(Int64PrefixKey)
+INSTANTIATE_IN_MEMORY(DateFieldKey)
+INSTANTIATE_IN_MEMORY(WholeLineKey)
+INSTANTIATE_IN_MEMORY(NormalizedKey)
+
+#undef INSTANTIATE_IN_MEMORY
@@ -0,0 +1,160 @@
+#include "../../include/solution/merge_kernel.h"
+
+#include <cassert>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #define MERGE_KERNEL_HAVE_AVX2 1
+  #include <immintrin.h>
+#endif
+
+namespace {
+
+// Merges from a[ia], b[ib] until either input is used up. The comparison picks
+// the index, not a branch, so unpredictable inputs cost no mispredictions.
+template <class T>
+std::size_t merge_scalar(const T* a, std::size_t na, const T* b, std::size_t nb, std::size_t ia, std::size_t ib,
+                         std::uint32_t* out) {
+    std::uint32_t* o = out;
+    while (ia < na && ib < nb) {
+        const bool take_b = b[ib] < a[ia];
+        *o++ = take_b ? static_cast<std::uint32_t>(ib) | FROM_SECOND : static_cast<std::uint32_t>(ia);
+        ib += take_b;
+        ia += !take_b;
+    }
+    return static_cast<std::size_t>(o - out);
+}
+
+#ifdef MERGE_KERNEL_HAVE_AVX2
+
+// Registers of one step: eight records as two sorted halves of four.
+struct Block8 {
+    __m256i lo;
+    __m256i hi;
+};
+
+// Eight keys starting at keys[i], widened to 64-bit lanes with the key in the
+// high half and `tag` | index in the low half. The lanes are distinct and order
+// like (key, input, index), so ties go to the first input as in the scalar loop.
+__attribute__((target("avx2"))) inline Block8 load8(const std::int32_t* keys, std::size_t i, __m256i tag) {
+    const __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+    const __m256i base = _mm256_or_si256(_mm256_set1_epi64x(static_cast<long long>(i)), tag);
+    const __m256i index_lo = _mm256_add_epi64(base, _mm256_setr_epi64x(0, 1, 2, 3));
+    const __m256i index_hi = _mm256_add_epi64(base, _mm256_setr_epi64x(4, 5, 6, 7));
+    return Block8{
+        _mm256_or_si256(_mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(k)), 32), index_lo),
+        _mm256_or_si256(_mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(k, 1)), 32), index_hi),
+    };
+}
+
+__attribute__((target("avx2"))) inline void min_max(__m256i a, __m256i b, __m256i& lo, __m256i& hi) {
+    const __m256i gt = _mm256_cmpgt_epi64(a, b);
+    lo = _mm256_blendv_epi8(a, b, gt);
+    hi = _mm256_blendv_epi8(b, a, gt);
+}
+
+// Sorts a bitonic sequence of four: compare-exchange at distance 2, then 1.
+__attribute__((target("avx2"))) inline __m256i sort_bitonic4(__m256i v) {
+    __m256i lo, hi;
+    min_max(v, _mm256_permute4x64_epi64(v, 0x4E), lo, hi);
+    v = _mm256_blend_epi32(lo, hi, 0xF0);
+    min_max(v, _mm256_permute4x64_epi64(v, 0xB1), lo, hi);
+    return _mm256_blend_epi32(lo, hi, 0xCC);
+}
+
+// Sorts a bitonic sequence of eight: distance 4 across the registers, then each.
+__attribute__((target("avx2"))) inline Block8 sort_bitonic8(__m256i lo, __m256i hi) {
+    min_max(lo, hi, lo, hi);
+    return Block8{sort_bitonic4(lo), sort_bitonic4(hi)};
+}
+
+// Merges two sorted blocks: a against reversed b is bitonic, so one
+// compare-exchange splits it into the eight smallest and the eight largest.
+__attribute__((target("avx2"))) inline void merge8x8(const Block8& a, const Block8& b, Block8& low, Block8& high) {
+    __m256i l0, h0, l1, h1;
+    min_max(a.lo, _mm256_permute4x64_epi64(b.hi, 0x1B), l0, h0);
+    min_max(a.hi, _mm256_permute4x64_epi64(b.lo, 0x1B), l1, h1);
+    low = sort_bitonic8(l0, l1);
+    high = sort_bitonic8(h0, h1);
+}
+
+// Writes the low halves (the tags) of four lanes and returns how many are
+// from the second input: FROM_SECOND moved up to the sign bit of each lane.
+__attribute__((target("avx2"))) inline std::size_t store_tags(__m256i v, std::uint32_t* out) {
+    const __m256i tags = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(tags));
+    return static_cast<std::size_t>(
+        __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(v, 32)))));
+}
+
+// Each step merges the eight values held back from the previous step with the
+// next eight of the input whose head is smaller, and writes the lower eight out.
+// Once an input cannot supply eight more, the scalar loop takes over from the
+// last position written; the values held back are read again from the inputs.
+__attribute__((target("avx2"))) std::size_t merge_avx2(const std::int32_t* a, std::size_t na, const std::int32_t* b,
+                                                       std::size_t nb, std::uint32_t* out) {
+    if (na < 8 || nb < 8) return merge_scalar(a, na, b, nb, 0, 0, out);
+
+    const __m256i tag_a = _mm256_setzero_si256();
+    const __m256i tag_b = _mm256_set1_epi64x(FROM_SECOND);
+    Block8 next = load8(a, 0, tag_a);
+    Block8 held = load8(b, 0, tag_b);
+    std::size_t ia = 8;
+    std::size_t ib = 8;
+    std::size_t done_b = 0;
+    std::uint32_t* o = out;
+    while (true) {
+        Block8 low;
+        merge8x8(next, held, low, held);
+        done_b += store_tags(low.lo, o);
+        done_b += store_tags(low.hi, o + 4);
+        o += 8;
+
+        if (ia >= na || ib >= nb) break;
+        // Chosen without a branch: on interleaved inputs it would be a coin flip.
+        const bool from_a = !(b[ib] < a[ia]);
+        const std::size_t i = from_a ? ia : ib;
+        if ((from_a ? na : nb) - i < 8) break;
+        next = load8(from_a ? a : b, i, from_a ? tag_a : tag_b);
+        ia += from_a ? 8 : 0;
+        ib += from_a ? 0 : 8;
+    }
+    const std::size_t written = static_cast<std::size_t>(o - out);
+    return written + merge_scalar(a, na, b, nb, written - done_b, done_b, o);
+}
+
+bool cpu_has_avx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+#endif // MERGE_KERNEL_HAVE_AVX2
+
+} // namespace
+
+void merge_two_runs(const std::int32_t* a, std::size_t na, const std::int32_t* b, std::size_t nb,
+                    std::vector<std::uint32_t>& order) {
+    assert(na <= MERGE_KERNEL_MAX_INPUT && nb <= MERGE_KERNEL_MAX_INPUT);
+    order.resize(na + nb);
+#ifdef MERGE_KERNEL_HAVE_AVX2
+    if (cpu_has_avx2()) {
+        order.resize(merge_avx2(a, na, b, nb, order.data()));
+        return;
+    }
+#endif
+    order.resize(merge_scalar(a, na, b, nb, 0, 0, order.data()));
+}
+
+void merge_two_runs(const std::int64_t* a, std::size_t na, const std::int64_t* b, std::size_t nb,
+                    std::vector<std::uint32_t>& order) {
+    assert(na <= MERGE_KERNEL_MAX_INPUT && nb <= MERGE_KERNEL_MAX_INPUT);
+    order.resize(na + nb);
+    order.resize(merge_scalar(a, na, b, nb, 0, 0, order.data()));
+}
+
+bool merge_kernel_vectorized() {
+#ifdef MERGE_KERNEL_HAVE_AVX2
+    return cpu_has_avx2();
+#else
+    return false;
+#endif
+}
@@ -9,257 +9,1531 @@
 #include <cstdint>
 #include <cassert>
 #include <algorithm>
+#include <cstring>
+#include <exception>
+#include <numeric>
+#include <thread>
 
 #include "io/reader.h"
+#include "io/run_format.h"
+#include "io/run_writer.h"
+#include "io/metrics.h"
+#include "io/memory_budget.h"
+#include "io/spsc_ring.h"
 #include "../../include/io/buffered_writer.h"
 #include "../../include/io/fast_writer.h"
 #include "../../include/solution/modified.h"
+#include "../../include/solution/key.h"
+#include "../../include/solution/presorted.h"
+#include "../../include/solution/in_memory.h"
+#include "../../include/solution/parallel_sort.h"
+#include "../../include/solution/merge_kernel.h"
+#include "../../include/solution/sort_spec.h"
 
-// ---------- Configurable memory budget ----------
-static constexpr std::size_t TOTAL_MEMORY_BUDGET_BYTES = 500ull * 1024 * 1024; // 500 MB
-// Split budget: 84% readers, 12% writer, rest for overhead
-static constexpr std::size_t READER_BUDGET = (TOTAL_MEMORY_BUDGET_BYTES * 84) / 100;
-static constexpr std::size_t WRITER_BUFFER_BUDGET = (TOTAL_MEMORY_BUDGET_BYTES * 12) / 100;
-
-// ---------- fast key parser ----------
-inline int fast_get_key_sv(std::string_view s) {
-    if (s.empty()) throw std::runtime_error("Cannot extract key from empty line.");
-    const char *p = s.data();
-    const char *end = p + s.size();
-    bool neg = false;
-    if (*p == '-') { neg = true; ++p; }
-    int val = 0;
-    bool any = false;
-    while (p < end && *p >= '0' && *p <= '9') {
-        any = true;
-        val = val * 10 + (*p - '0');
-        ++p;
-    }
-    if (!any) throw std::runtime_error("Could not extract key from line: " + std::string(s));
-    return neg ? -val : val;
+// ---------- Memory budget ----------
+// The total follows the cgroup limit and memory pressure (see io/memory_budget.h),
+// so the shares below are recomputed at every refill rather than fixed per pass.
+// The process itself (code, libraries, thread stacks, allocator slack) comes off
+// the top; the rest is split 84% readers, 12% writer, the remainder for overhead.
+static constexpr std::uint64_t PROCESS_BASELINE_BYTES = 8ull << 20;
+static std::uint64_t buffer_budget() {
+    const std::uint64_t total = memory_budget().current();
+    return total - std::min(total / 4, PROCESS_BASELINE_BYTES);
 }
+static std::size_t reader_budget() {
+    return static_cast<std::size_t>(buffer_budget() * 84 / 100);
+}
+static std::size_t writer_budget() {
+    return static_cast<std::size_t>(buffer_budget() * 12 / 100);
+}
+// Share of one segment when `files` are merged, or of one of `writers` outputs.
+static std::size_t segment_budget(std::size_t files) {
+    return std::max<std::size_t>(1 << 20, reader_budget() / std::max<std::size_t>(1, files));
+}
+static std::size_t writer_share(std::size_t writers) {
+    return std::max<std::size_t>(1 << 20, writer_budget() / std::max<std::size_t>(1, writers));
+}
+// Decoded look-ahead kept per reader when runs are compressed; charged to the
+// reader's segment share, of which it takes at most a quarter.
+static constexpr std::size_t PREFETCH_BYTES_PER_READER = 4ull * 1024 * 1024;
+// Encoded record size assumed for a segment's first fill, before it has seen any.
+// Kept low: a guess too small only makes that fill end early, one too large
+// reserves address space that is never touched.
+static constexpr std::size_t DEFAULT_RECORD_BYTES = 16;
+// Run formation: raw input blocks between the reader and parser stages (from the
+// overhead share), and sorted chunk sets between the parser and writer stages.
+static constexpr std::size_t INPUT_BLOCK_SIZE = 1 << 20;
+static constexpr std::size_t INPUT_BLOCKS = 4;
+static constexpr std::size_t RUN_CHUNKS = 2;
+// Byte ranges smaller than this are not worth a parsing thread of their own.
+static constexpr std::uint64_t RUN_RANGE_MIN_BYTES = 4ull << 20;
 
-// ---------- Safe refill: build buffer first, then create string_views ----------
-// This version is robust against reallocations.
-static bool refill_segment_from_reader(InMemSegment &seg, Reader &reader, std::size_t max_bytes) {
+// ---------- Segment refill: load whole blocks, then decode in one sweep ----------
+// Views are created only after all blocks are appended, so buffer reallocations are harmless.
+//
+// max_bytes covers the record bytes, the index built over them (lines, keys,
+// run_starts and, once a previous fill needed them, counts) and the reader's
+// read-ahead. The buffer reserves only the record bytes' part of it, split by
+// the record size of the previous fill: untouched reservation is not resident,
+// but it takes address space. A block is only loaded while one as large as the
+// largest so far still fits both max_bytes and that reservation, so the buffer
+// never reallocates, which would briefly double it.
+template <class Key>
+static bool refill_segment_from_reader(InMemSegment<Key> &seg, BasicRunReader<Key> &reader, std::size_t max_bytes) {
+    metrics::ScopedOp op(metrics::Op::SegmentRefill);
+    max_bytes -= std::min(max_bytes / 2, reader.prefetch_bytes());
+    const std::size_t index_bytes = sizeof(std::string_view) + sizeof(Key) + sizeof(std::uint8_t)
+                                    + (seg.counts.empty() ? 0 : sizeof(std::uint64_t));
+    const std::size_t record_bytes =
+        seg.lines.empty() ? DEFAULT_RECORD_BYTES : std::max<std::size_t>(1, seg.buffer.size() / seg.lines.size());
     seg.clear();
 
-    std::size_t reserve_size = std::max<std::size_t>(max_bytes, 1 << 20);
-    seg.buffer.reserve(reserve_size);
-
-    std::string_view line_view;
-    std::size_t accumulated = 0;
-    std::vector<std::size_t> offsets;
-    offsets.reserve(256);
-
-    // Read lines and append to seg.buffer. Save start offsets; do NOT create string_views yet.
-    while (!reader.is_end() && reader.get_line(line_view)) {
-        std::size_t before = seg.buffer.size();
-        seg.buffer.append(line_view.data(), line_view.size());
-        seg.buffer.push_back('\n');
-        offsets.push_back(before);
+    const std::size_t reserve_size =
+        std::max<std::size_t>(max_bytes / (record_bytes + index_bytes) * record_bytes, 1 << 20);
+    // After a budget cut, give back what a larger earlier refill reserved.
+    if (seg.buffer.capacity() > 2 * reserve_size) seg.release();
+    if (seg.buffer.capacity() < reserve_size) {
+        // reserve() on the old string would grow it to at least twice its capacity.
+        std::string().swap(seg.buffer);
+        seg.buffer.reserve(reserve_size);
+    }
 
-        accumulated += line_view.size() + 1;
-        if (accumulated >= max_bytes) break;
+    std::size_t record_count = 0;
+    std::size_t largest_block = 0;
+    std::size_t largest_raw = 0;
+    std::uint32_t block_records = 0;
+    while (true) {
+        const std::size_t before = seg.buffer.size();
+        if (!reader.read_block(seg.buffer, block_records)) break;
+        record_count += block_records;
+        largest_raw = std::max(largest_raw, seg.buffer.size() - before);
+        largest_block = std::max(largest_block, seg.buffer.size() - before + block_records * index_bytes);
+        if (seg.buffer.size() + record_count * index_bytes + largest_block > max_bytes) break;
+        if (seg.buffer.size() + largest_raw > seg.buffer.capacity()) break;
     }
+    op.add_bytes(seg.buffer.size());
 
-    if (offsets.empty()) {
+    if (record_count == 0) {
         return false;
     }
 
-    // Create stable string_views into seg.buffer AFTER all appends are finished.
-    seg.lines.reserve(offsets.size());
-    const char* buf_data = seg.buffer.data();
-    const char* buf_end = buf_data + seg.buffer.size();
-    for (std::size_t off : offsets) {
-        const char* start_ptr = buf_data + off;
-        const char* cur = start_ptr;
-        while (cur < buf_end && *cur != '\n') ++cur;
-        std::size_t len = static_cast<std::size_t>(cur - start_ptr);
-        seg.lines.emplace_back(start_ptr, len);
+    seg.lines.reserve(record_count);
+    seg.keys.reserve(record_count);
+    seg.run_starts.reserve(record_count);
+    const char *p = seg.buffer.data();
+    const char *end = p + seg.buffer.size();
+    run_format::Record<Key> rec{};
+    for (std::size_t i = 0; i < record_count; ++i) {
+        p = run_format::decode_record(p, end, rec);
+        seg.keys.push_back(rec.key);
+        seg.lines.push_back(rec.payload);
+        seg.run_starts.push_back(rec.run_start ? 1 : 0);
+        // Counts are only materialised once a collapsed record shows up.
+        if (rec.count != 1 || !seg.counts.empty()) {
+            seg.counts.resize(i, 1);
+            seg.counts.push_back(rec.count);
+        }
     }
 
     seg.next_index = 0;
     return true;
 }
 
+// ---------- Output sinks for merge_many_into_one ----------
+// The final pass drops the keys and produces the text lines of the result.
+template <class KeyPolicy>
+struct TextSink {
+    using run_key_type = typename KeyPolicy::run_key_type;
+
+    FastWriterWrapper &writer;
+    std::uint64_t remaining; // lines still to be written
+    bool with_counts = false; // DedupMode::Count: append "\t<count>"
+    std::string line;
+
+    void begin_run() {}
+    void push(run_key_type, std::string_view record, std::uint64_t count = 1) {
+        if (remaining == 0) return;
+        --remaining;
+        if (!with_counts) {
+            writer.push_line(KeyPolicy::record_text(record));
+            return;
+        }
+        line.assign(KeyPolicy::record_text(record));
+        line.push_back('\t');
+        line.append(std::to_string(count));
+        writer.push_line(line);
+    }
+    bool copy_block_from(BasicRunReader<run_key_type> &) { return false; }
+    bool append_records(std::string_view, std::uint32_t) { return false; }
+    void set_flush_size(std::size_t bytes) { writer.set_buffer_limit(bytes); }
+};
+
+// Collapses equal records of one run before they reach Sink (a RunWriter or
+// TextSink). Records of one key are neighbours, so the latest record is held back
+// until another key arrives and its count is complete by the time it is written.
+// In Unique mode equal keys are also ordered by record (RecordChunk::by_record,
+// PQEntry's ByRecord), so a record is dropped if it repeats the one before.
+template <class KeyPolicy, class Sink>
+class DedupSink {
+public:
+    using run_key_type = typename KeyPolicy::run_key_type;
+
+    DedupSink(Sink &inner, DedupMode mode) : inner_(&inner), mode_(mode) {}
+
+    void begin_run() {
+        flush();
+        inner_->begin_run();
+    }
+
+    void push(run_key_type key, std::string_view record, std::uint64_t count = 1) {
+        const bool same = held_ && same_key(key, record);
+        if (mode_ == DedupMode::Unique) {
+            if (same && record == held_record_) return;
+            inner_->push(key, record);
+            hold(key, record, count);
+            return;
+        }
+        if (same) {
+            held_count_ += count;
+            return;
+        }
+        flush();
+        hold(key, record, count);
+    }
+
+    // Records are compared one by one, so blocks and spans are never passed through.
+    bool copy_block_from(BasicRunReader<run_key_type> &) { return false; }
+    bool append_records(std::string_view, std::uint32_t) { return false; }
+
+    void set_flush_size(std::size_t bytes) { inner_->set_flush_size(bytes); }
+
+    void flush() {
+        if (!held_) return;
+        held_ = false;
+        if (mode_ == DedupMode::Unique) return;
+        inner_->push(held_key_, held_record_, mode_ == DedupMode::Count ? held_count_ : 1);
+    }
+
+private:
+    void hold(run_key_type key, std::string_view record, std::uint64_t count) {
+        held_ = true;
+        held_key_ = key;
+        held_record_.assign(record.data(), record.size());
+        held_count_ = count;
+    }
+
+    bool same_key(run_key_type key, std::string_view record) const {
+        if (key != held_key_) return false;
+        if constexpr (KeyPolicy::run_key_exact) {
+            return true;
+        } else {
+            const auto a = KeyPolicy::extract(record);
+            const auto b = KeyPolicy::extract(held_record_);
+            return !KeyPolicy::less(a, b) && !KeyPolicy::less(b, a);
+        }
+    }
+
+    Sink *inner_;
+    DedupMode mode_;
+    bool held_ = false;
+    run_key_type held_key_{};
+    std::string held_record_;
+    std::uint64_t held_count_ = 0;
+};
+
+// Moves the rest of the current run of `idx` to the output when it is the only
+// input left in the group: records already in memory are pushed without heap
+// work, and whole blocks that merely continue the run are copied undecoded.
+// `files` is the number of inputs of the merge, which share the reader budget.
+template <class Key, class Sink>
+static void drain_sole_run(BasicRunReader<Key> &reader, InMemSegment<Key> &seg, Sink &out_writer,
+                           std::size_t files) {
+    while (true) {
+        while (seg.has_next() && !seg.peek_starts_run()) {
+            const Key key = seg.peek_key();
+            const std::uint64_t count = seg.peek_count();
+            out_writer.push(key, seg.pop(), count);
+        }
+        if (seg.has_next() || reader.is_end()) return;
+
+        while (out_writer.copy_block_from(reader)) {}
+        if (!refill_segment_from_reader(seg, reader, segment_budget(files))) return;
+    }
+}
+
+// Opens a reader on every file and loads its first segment.
+template <class Key>
+static void open_run_readers(std::vector<FileManager> &files, bool compressed,
+                             std::vector<std::unique_ptr<BasicRunReader<Key>>> &readers,
+                             std::vector<InMemSegment<Key>> &segments) {
+    const std::size_t prefetch =
+        compressed ? std::min(PREFETCH_BYTES_PER_READER, segment_budget(files.size()) / 4) : 0;
+    readers.clear();
+    readers.reserve(files.size());
+    for (auto &file : files) {
+        readers.push_back(std::make_unique<BasicRunReader<Key>>(file, BasicRunReader<Key>::DEFAULT_BUFFER_SIZE, prefetch));
+    }
+    segments.clear();
+    segments.resize(files.size());
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        refill_segment_from_reader(segments[i], *readers[i], segment_budget(files.size()));
+    }
+}
+
+// ---------- Record chunks ----------
+// Ingested records in one arena plus their run keys: a chunk of run formation or
+// the top-k candidates. Sorting and selection work on the small entries; record
+// bytes only move when the arena is compacted.
+template <class KeyPolicy>
+struct RecordChunk {
+    using run_key_type = typename KeyPolicy::run_key_type;
+    struct Entry {
+        run_key_type key;
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    std::string arena;
+    std::vector<Entry> entries;
+    // Set by plan(): what fits the chunk's budget without reallocating.
+    std::size_t arena_limit = 0;
+    std::size_t entry_limit = 0;
+    // DedupMode::Unique: equal keys are ordered by record, so copies end up adjacent.
+    bool by_record = false;
+
+    std::string_view record(const Entry &e) const { return std::string_view(arena.data() + e.offset, e.size); }
+    // Key order, equal keys in the order they were added, for a stable sort.
+    bool before(const Entry &a, const Entry &b) const {
+        if (a.key != b.key) return a.key < b.key;
+        if constexpr (!KeyPolicy::run_key_exact) {
+            const auto ka = KeyPolicy::extract(record(a));
+            const auto kb = KeyPolicy::extract(record(b));
+            if (KeyPolicy::less(ka, kb)) return true;
+            if (KeyPolicy::less(kb, ka)) return false;
+        }
+        if (by_record) {
+            const int c = record(a).compare(record(b));
+            if (c != 0) return c < 0;
+        }
+        return a.offset < b.offset;
+    }
+    void add(run_key_type key, std::string_view rec) {
+        entries.push_back(Entry{key, arena.size(), rec.size()});
+        arena.append(rec.data(), rec.size());
+    }
+    std::size_t memory_usage() const { return arena.size() + entries.size() * sizeof(Entry); }
+    // Sizes the empty chunk for about `budget` bytes, split between arena and
+    // entries by the average record size seen so far, and reserves both.
+    void plan(std::size_t budget, std::size_t average_record) {
+        entry_limit = std::max<std::size_t>(1, budget / (sizeof(Entry) + average_record));
+        arena_limit = budget > entry_limit * sizeof(Entry) ? budget - entry_limit * sizeof(Entry) : average_record;
+        // After a budget cut, give back what an earlier, larger plan reserved.
+        // reserve() would also grow a smaller arena to at least twice its capacity.
+        if (arena.capacity() > 2 * arena_limit || arena.capacity() < arena_limit) std::string().swap(arena);
+        if (entries.capacity() > 2 * entry_limit) std::vector<Entry>().swap(entries);
+        arena.reserve(arena_limit);
+        entries.reserve(entry_limit);
+    }
+    // Raises the plan of a chunk that must take more than planned by about
+    // `budget` bytes, split like plan() does, reserving exactly that much more:
+    // a plain reserve() would double the arena.
+    void extend(std::size_t budget, std::size_t average_record) {
+        const std::size_t more = std::max<std::size_t>(1, budget / (sizeof(Entry) + average_record));
+        entry_limit = entries.size() + more;
+        arena_limit = arena.size() + std::max(average_record, budget > more * sizeof(Entry) ? budget - more * sizeof(Entry) : 0);
+        if (arena.capacity() < arena_limit) {
+            std::string larger;
+            larger.reserve(arena_limit);
+            larger.append(arena);
+            arena.swap(larger);
+        }
+        entries.reserve(entry_limit);
+    }
+    // False once the planned chunk is full; a record longer than the whole arena
+    // still goes into an empty chunk.
+    bool has_room(std::size_t record_size) const {
+        return entries.empty() || (entries.size() < entry_limit && arena.size() + record_size <= arena_limit);
+    }
+    void clear() {
+        arena.clear();
+        entries.clear();
+    }
+    // Keeps the k first entries in before() order, with the last of them last, and
+    // compacts the arena in input order, so offsets still break ties.
+    void keep_smallest(std::size_t k) {
+        if (k == 0) {
+            clear();
+            return;
+        }
+        auto cmp = [this](const Entry &a, const Entry &b) { return before(a, b); };
+        if (entries.size() > k) {
+            std::nth_element(entries.begin(), entries.begin() + (k - 1), entries.end(), cmp);
+            entries.resize(k);
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.offset < b.offset; });
+        std::string compacted;
+        compacted.reserve(arena.capacity());
+        for (Entry &e : entries) {
+            const std::size_t offset = compacted.size();
+            compacted.append(arena, e.offset, e.size);
+            e.offset = offset;
+        }
+        arena.swap(compacted);
+        std::iter_swap(std::max_element(entries.begin(), entries.end(), cmp), entries.end() - 1);
+    }
+    void sort() {
+        std::sort(entries.begin(), entries.end(), [this](const Entry &a, const Entry &b) { return before(a, b); });
+    }
+};
+
+// ---------- Run formation ----------
+// Raw input on its way from the reader stage to the parser.
+struct InputBlock {
+    AlignedBuffer data;
+    std::size_t size = 0;
+};
+
+// Sorted chunks of consecutive input, in input order. The writer merges a set
+// into one piece of a run.
+template <class KeyPolicy>
+using ChunkSet = std::vector<RecordChunk<KeyPolicy>>;
+
+// Chunk sets going from the parser to the writer stage and back.
+template <class KeyPolicy>
+struct ChunkSetQueue {
+    SpscRing<ChunkSet<KeyPolicy>> sorted{RUN_CHUNKS};
+    SpscRing<ChunkSet<KeyPolicy>> emptied{RUN_CHUNKS};
+    std::size_t made = 0;
+    bool by_record = false; // RecordChunk::by_record of every chunk
+
+    // An empty set of `parts` chunks: a new one until RUN_CHUNKS exist, then one
+    // the writer gave back. False once the writer stopped.
+    bool take(ChunkSet<KeyPolicy> &set, std::size_t parts) {
+        if (made < RUN_CHUNKS) {
+            set.clear();
+            ++made;
+        } else if (!emptied.pop(set)) {
+            return false;
+        }
+        set.resize(parts);
+        for (auto &chunk : set) chunk.by_record = by_record;
+        return true;
+    }
+};
+
+// Splits input blocks into lines and adds them to a chunk as records. One per
+// parsing thread.
+template <class KeyPolicy>
+struct LineParser {
+    const KeyPolicy *policy = nullptr;
+    std::string scratch;
+    std::string carry; // start of a line that continues in the next block
+    std::uint64_t text_bytes = 0;
+    std::uint64_t records = 0;
+    std::uint64_t record_bytes = 0;
+
+    std::size_t average_record() const { return records > 0 ? static_cast<std::size_t>(record_bytes / records) : 64; }
+
+    // Adds one line, calling full() first when the chunk has no room for it;
+    // full() makes room or returns false to stop, which add_line() passes on.
+    template <class Full>
+    bool add_line(std::string_view line, RecordChunk<KeyPolicy> &chunk, Full &full) {
+        line = strip_carriage_return(line);
+        if (line.empty()) return true;
+        std::string_view record;
+        if (!policy->ingest(line, scratch, record)) {
+            throw std::runtime_error("Line does not match the sort spec: " + std::string(line));
+        }
+        text_bytes += line.size() + 1;
+        if (!chunk.has_room(record.size()) && !full()) return false;
+        chunk.add(KeyPolicy::run_key(KeyPolicy::extract(record)), record);
+        ++records;
+        record_bytes += record.size();
+        return true;
+    }
+
+    // Adds the complete lines of [p, end) and keeps the incomplete last one.
+    template <class Full>
+    bool add_block(const char *p, const char *end, RecordChunk<KeyPolicy> &chunk, Full &full) {
+        while (true) {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+            if (!nl) break;
+            bool ok;
+            if (carry.empty()) {
+                ok = add_line(std::string_view(p, static_cast<std::size_t>(nl - p)), chunk, full);
+            } else {
+                carry.append(p, nl);
+                ok = add_line(carry, chunk, full);
+                carry.clear();
+            }
+            if (!ok) return false;
+            p = nl + 1;
+        }
+        carry.append(p, end);
+        return true;
+    }
+
+    // Adds the last line of the input when it has no '\n'.
+    template <class Full>
+    bool finish(RecordChunk<KeyPolicy> &chunk, Full &full) {
+        if (carry.empty()) return true;
+        const bool ok = add_line(carry, chunk, full);
+        carry.clear();
+        return ok;
+    }
+};
+
+template <class KeyPolicy>
+static void sort_chunk(RecordChunk<KeyPolicy> &chunk, unsigned threads) {
+    using Entry = typename RecordChunk<KeyPolicy>::Entry;
+    parallel_sort(chunk.entries, threads, [&chunk](const Entry &a, const Entry &b) { return chunk.before(a, b); });
+}
+
+// One Reader over the whole input, for pipes and single-threaded parsing: a
+// reader thread fills raw blocks while the calling thread splits and parses
+// them, and each full chunk is sorted on the thread pool and shipped alone.
+// Returns the text bytes of the input.
+template <class KeyPolicy>
+static std::uint64_t parse_stream(FileManager &source, const KeyPolicy &policy, unsigned threads,
+                                  ChunkSetQueue<KeyPolicy> &queue) {
+    SpscRing<InputBlock> full_blocks(INPUT_BLOCKS);
+    SpscRing<InputBlock> free_blocks(INPUT_BLOCKS);
+    for (std::size_t i = 0; i < INPUT_BLOCKS; ++i) {
+        InputBlock block{AlignedBuffer(INPUT_BLOCK_SIZE), 0};
+        free_blocks.push(block);
+    }
+
+    std::exception_ptr read_error;
+    std::thread read_stage([&] {
+        metrics::count_thread();
+        try {
+            Reader reader(source);
+            InputBlock block;
+            while (free_blocks.pop(block)) {
+                block.size = reader.read_raw(block.data.data(), block.data.size());
+                if (block.size == 0 || !full_blocks.push(block)) break;
+            }
+        } catch (...) {
+            read_error = std::current_exception();
+        }
+        full_blocks.close();
+    });
+
+    LineParser<KeyPolicy> parser;
+    parser.policy = &policy;
+    // The parser fills `chunk`, which moves into a set only to be shipped, so
+    // references to it stay valid across ship().
+    RecordChunk<KeyPolicy> chunk;
+    chunk.by_record = queue.by_record;
+    ChunkSet<KeyPolicy> set;
+    auto plan = [&] {
+        // Two sets in flight plus the sort's scratch index share the reader budget.
+        chunk.plan(reader_budget() / (RUN_CHUNKS + 1), parser.average_record());
+    };
+    // Hands the full chunk to the writer and takes an empty one.
+    auto ship = [&] {
+        sort_chunk(chunk, threads);
+        set[0] = std::move(chunk);
+        if (!queue.sorted.push(set) || !queue.take(set, 1)) return false;
+        chunk = std::move(set[0]);
+        plan();
+        return true;
+    };
+
+    std::exception_ptr parse_error;
+    try {
+        queue.take(set, 1);
+        plan();
+        bool running = true;
+        InputBlock block;
+        while (running && full_blocks.pop(block)) {
+            running = parser.add_block(block.data.data(), block.data.data() + block.size, chunk, ship);
+            free_blocks.push(block);
+        }
+        if (running) running = parser.finish(chunk, ship);
+        if (running && !chunk.entries.empty()) {
+            sort_chunk(chunk, threads);
+            set[0] = std::move(chunk);
+            queue.sorted.push(set);
+        }
+    } catch (...) {
+        parse_error = std::current_exception();
+    }
+
+    free_blocks.close(); // stops the reader if parsing ended early
+    read_stage.join();
+    if (parse_error) std::rethrow_exception(parse_error);
+    if (read_error) std::rethrow_exception(read_error);
+    return parser.text_bytes;
+}
+
+// Parses the first block of a regular file into a scratch chunk, for what the
+// first window is planned with before any range has seen a record: the average
+// record size and the input bytes per byte of chunk memory. Left as they are
+// if the block holds no complete line.
+template <class KeyPolicy>
+static void sample_records(FileManager &source, const KeyPolicy &policy, AlignedBuffer &block,
+                           std::size_t &average_record, double &text_per_byte) {
+    LineParser<KeyPolicy> lines;
+    lines.policy = &policy;
+    RecordChunk<KeyPolicy> chunk;
+    auto grow = [] { return true; };
+    const std::size_t n = source.read_at(block.data(), static_cast<std::size_t>(std::min<std::uint64_t>(block.size(), source.size())), 0);
+    lines.add_block(block.data(), block.data() + n, chunk, grow);
+    if (lines.records == 0) return;
+    average_record = lines.average_record();
+    text_per_byte = static_cast<double>(lines.text_bytes) / static_cast<double>(chunk.memory_usage());
+}
+
+// Parallel positional reads of a regular file. Each step takes the next window
+// of the file, as much text as a chunk set of the budget holds, and cuts it
+// into line-aligned byte ranges, one per thread. The threads read their ranges
+// with read_at(), parse them and sort them, each into its own chunk, and the
+// writer merges the chunks. Returns the text bytes of the input.
+template <class KeyPolicy>
+static std::uint64_t parse_ranges(FileManager &source, const KeyPolicy &policy, unsigned threads,
+                                  ChunkSetQueue<KeyPolicy> &queue) {
+    struct RangeParser {
+        LineParser<KeyPolicy> lines;
+        AlignedBuffer block;
+    };
+    std::vector<RangeParser> parsers(threads);
+    for (RangeParser &p : parsers) {
+        p.lines.policy = &policy;
+        p.block = AlignedBuffer(INPUT_BLOCK_SIZE);
+    }
+
+    const std::uint64_t file_size = source.size();
+    // Input bytes per byte of chunk memory, measured on every window. A chunk
+    // planned too small outgrows its reservation, which briefly doubles it.
+    double text_per_byte = 0.7;
+    std::size_t first_average = 64;
+    sample_records(source, policy, parsers[0].block, first_average, text_per_byte);
+    std::uint64_t pos = 0;
+    std::vector<std::uint64_t> bounds;
+    ChunkSet<KeyPolicy> set;
+    while (pos < file_size) {
+        // Each range sorts in place, so the sets in flight have the reader budget to themselves.
+        const std::size_t budget = reader_budget() / RUN_CHUNKS;
+        const std::uint64_t end =
+            std::min(file_size, pos + std::max<std::uint64_t>(1, static_cast<std::uint64_t>(budget * text_per_byte)));
+        const std::uint64_t ranges = std::clamp<std::uint64_t>((end - pos) / RUN_RANGE_MIN_BYTES, 1, threads);
+        bounds.assign(1, pos);
+        for (std::uint64_t i = 1; i <= ranges; ++i) {
+            const std::uint64_t offset = pos + (end - pos) * i / ranges;
+            const std::uint64_t b = offset == file_size ? file_size : next_line_start(source, offset, file_size);
+            // Very long lines can swallow a whole nominal range.
+            if (b > bounds.back()) bounds.push_back(b);
+        }
+        const std::size_t parts = bounds.size() - 1;
+        const std::uint64_t window = bounds.back() - pos;
+        if (!queue.take(set, parts)) break;
+
+        std::uint64_t text_before = 0;
+        for (const RangeParser &p : parsers) text_before += p.lines.text_bytes;
+        parallel_for(parts, [&](std::size_t i) {
+            RangeParser &p = parsers[i];
+            RecordChunk<KeyPolicy> &chunk = set[i];
+            chunk.plan(static_cast<std::size_t>(budget * (bounds[i + 1] - bounds[i]) / window),
+                       p.lines.records > 0 ? p.lines.average_record() : first_average);
+            // The range is fixed: a chunk that outgrows its plan grows by what is
+            // left of the range from the current block on.
+            std::uint64_t at = bounds[i];
+            auto grow = [&] {
+                chunk.extend(static_cast<std::size_t>(static_cast<double>(bounds[i + 1] - at) / text_per_byte),
+                             p.lines.average_record());
+                return true;
+            };
+            while (at < bounds[i + 1]) {
+                metrics::ScopedOp op(metrics::Op::ReaderFill);
+                const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(p.block.size(), bounds[i + 1] - at));
+                const std::size_t n = source.read_at(p.block.data(), want, at);
+                if (n == 0) throw std::runtime_error("Short read while forming runs.");
+                op.add_bytes(n);
+                p.lines.add_block(p.block.data(), p.block.data() + n, chunk, grow);
+                at += n;
+            }
+            // Only the last range of the file can end without '\n'.
+            p.lines.finish(chunk, grow);
+            sort_chunk(chunk, 1);
+        });
+
+        std::uint64_t text = 0;
+        std::uint64_t memory = 0;
+        for (const RangeParser &p : parsers) text += p.lines.text_bytes;
+        for (const auto &chunk : set) memory += chunk.memory_usage();
+        if (text > text_before && memory > 0) text_per_byte = static_cast<double>(text - text_before) / memory;
+
+        if (!queue.sorted.push(set)) break;
+        pos = bounds.back();
+    }
+
+    std::uint64_t text = 0;
+    for (const RangeParser &p : parsers) text += p.lines.text_bytes;
+    return text;
+}
+
+// Writes chunk sets to the sinks as runs, round-robin. A set whose first record
+// is not below the last one written continues the current run. With by_record,
+// equal keys are ordered by record as in RecordChunk::before().
+template <class KeyPolicy, class Sink>
+class ChunkRunWriter {
+public:
+    ChunkRunWriter(std::vector<Sink *> &sinks, bool by_record) : sinks_(sinks), by_record_(by_record) {}
+
+    void write(const ChunkSet<KeyPolicy> &set) {
+        const std::size_t flush = writer_share(sinks_.size());
+        for (Sink *sink : sinks_) sink->set_flush_size(flush);
+
+        heap_.clear();
+        for (std::size_t i = 0; i < set.size(); ++i) {
+            if (!set[i].entries.empty()) heap_.push_back(Cursor{i, 0});
+        }
+        if (heap_.empty()) return;
+        // Min-heap; equal keys go to the earlier chunk, so they keep their input order.
+        auto after = [&](const Cursor &a, const Cursor &b) {
+            const auto &ea = set[a.part].entries[a.pos];
+            const auto &eb = set[b.part].entries[b.pos];
+            if (ea.key != eb.key) return eb.key < ea.key;
+            if constexpr (!KeyPolicy::run_key_exact) {
+                const auto ka = KeyPolicy::extract(set[a.part].record(ea));
+                const auto kb = KeyPolicy::extract(set[b.part].record(eb));
+                if (KeyPolicy::less(kb, ka)) return true;
+                if (KeyPolicy::less(ka, kb)) return false;
+            }
+            if (by_record_) {
+                const int c = set[a.part].record(ea).compare(set[b.part].record(eb));
+                if (c != 0) return c > 0;
+            }
+            return a.part > b.part;
+        };
+        std::make_heap(heap_.begin(), heap_.end(), after);
+
+        bool first = true;
+        std::string_view last;
+        while (!heap_.empty()) {
+            std::pop_heap(heap_.begin(), heap_.end(), after);
+            Cursor &c = heap_.back();
+            const RecordChunk<KeyPolicy> &chunk = set[c.part];
+            const auto &e = chunk.entries[c.pos];
+            last = chunk.record(e);
+            if (first) {
+                first = false;
+                if (have_last_ && starts_below_last(last)) {
+                    writer_idx_ = (writer_idx_ + 1) % sinks_.size();
+                    sinks_[writer_idx_]->begin_run();
+                }
+            }
+            sinks_[writer_idx_]->push(e.key, last);
+            if (++c.pos < chunk.entries.size()) {
+                std::push_heap(heap_.begin(), heap_.end(), after);
+            } else {
+                heap_.pop_back();
+            }
+        }
+        last_key_.assign(KeyPolicy::extract(last));
+        if (by_record_) last_record_.assign(last.data(), last.size());
+        have_last_ = true;
+    }
+
+private:
+    struct Cursor {
+        std::size_t part;
+        std::size_t pos;
+    };
+
+    bool starts_below_last(std::string_view record) const {
+        const auto key = KeyPolicy::extract(record);
+        if (KeyPolicy::less(key, last_key_.get())) return true;
+        return by_record_ && !KeyPolicy::less(last_key_.get(), key) && record < last_record_;
+    }
+
+    std::vector<Sink *> &sinks_;
+    bool by_record_;
+    std::vector<Cursor> heap_;
+    std::size_t writer_idx_ = 0;
+    KeyHolder<typename KeyPolicy::key_type> last_key_;
+    std::string last_record_; // by_record only
+    bool have_last_ = false;
+};
+
 // ---------- ModifiedSolution implementation ----------
-ModifiedSolution::ModifiedSolution(std::vector<FileManager> &first_bucket, std::vector<FileManager> &second_bucket)
-    : first_bucket_(first_bucket), second_bucket_(second_bucket) {
+template <class KeyPolicy>
+BasicModifiedSolution<KeyPolicy>::BasicModifiedSolution(std::vector<FileManager> &first_bucket,
+                                                         std::vector<FileManager> &second_bucket,
+                                                         SortOptions options,
+                                                         KeyPolicy policy)
+    : first_bucket_(first_bucket), second_bucket_(second_bucket), options_(options), policy_(std::move(policy)) {
     assert(first_bucket_.size() == second_bucket_.size());
 }
 
-void ModifiedSolution::load_initial_series(FileManager &source) {
+template <class KeyPolicy>
+void BasicModifiedSolution<KeyPolicy>::load_initial_series(FileManager &source) {
+    metrics::ScopedPhase phase("run_formation");
+    const size_t OUT_CNT = first_bucket_.size();
+    std::size_t per_writer_flush = writer_share(OUT_CNT);
+
+    std::vector<std::unique_ptr<RunWriter>> writers;
+    writers.reserve(OUT_CNT);
+    for (auto &file : first_bucket_) {
+        writers.push_back(std::make_unique<RunWriter>(file, options_.compress_runs, per_writer_flush));
+    }
+
+    if (options_.dedup == DedupMode::None) {
+        std::vector<RunWriter *> sinks;
+        for (auto &w : writers) sinks.push_back(w.get());
+        form_initial_runs(source, sinks);
+    } else {
+        // Each run is a sorted chunk set merged in order (by record in Unique
+        // mode), so duplicates inside a run reach the sink as neighbours.
+        std::vector<DedupSink<KeyPolicy, RunWriter>> dedup;
+        std::vector<DedupSink<KeyPolicy, RunWriter> *> sinks;
+        dedup.reserve(OUT_CNT);
+        for (auto &w : writers) dedup.emplace_back(*w, options_.dedup);
+        for (auto &d : dedup) sinks.push_back(&d);
+        form_initial_runs(source, sinks);
+        for (auto &d : dedup) d.flush();
+        // The collapsed size is unknown; skip preallocating the output.
+        total_text_bytes_ = 0;
+    }
+
+    initial_runs_.assign(OUT_CNT, 0);
+    for (size_t i = 0; i < OUT_CNT; ++i) {
+        writers[i]->flush();
+        initial_runs_[i] = writers[i]->runs();
+    }
+    phase.set_runs(std::accumulate(initial_runs_.begin(), initial_runs_.end(), std::uint64_t{0}));
+
+    for (auto &file : first_bucket_) file.reset_cursor();
+}
+
+// Two stages joined by SpscRings: the calling thread reads, parses and sorts
+// chunk sets, and a writer thread writes them out while the next set is parsed.
+// The writer blocks on its ring for the whole pass, so it gets a thread of its
+// own rather than a pool worker. Emptied sets travel back to the parser, so the
+// pipeline holds RUN_CHUNKS of them however long the input is.
+template <class KeyPolicy>
+template <class Sink>
+void BasicModifiedSolution<KeyPolicy>::form_initial_runs(FileManager &source, std::vector<Sink *> &sinks) {
+    ChunkSetQueue<KeyPolicy> queue;
+    queue.by_record = options_.dedup == DedupMode::Unique;
+
+    std::exception_ptr write_error;
+    std::thread write_stage([&] {
+        metrics::count_thread();
+        try {
+            ChunkRunWriter<KeyPolicy, Sink> writer(sinks, queue.by_record);
+            ChunkSet<KeyPolicy> set;
+            while (queue.sorted.pop(set)) {
+                writer.write(set);
+                for (auto &chunk : set) chunk.clear();
+                if (!queue.emptied.push(set)) break;
+            }
+        } catch (...) {
+            write_error = std::current_exception();
+            queue.sorted.close();
+        }
+        queue.emptied.close();
+    });
+
+    const unsigned threads = options_.threads > 0 ? options_.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::exception_ptr parse_error;
+    try {
+        // Positional reads need a regular file; one thread parses faster from a stream.
+        total_text_bytes_ = source.is_seekable() && threads > 1 ? parse_ranges(source, policy_, threads, queue)
+                                                                : parse_stream(source, policy_, threads, queue);
+    } catch (...) {
+        parse_error = std::current_exception();
+    }
+
+    queue.sorted.close(); // the writer drains what was shipped
+    write_stage.join();
+    if (parse_error) std::rethrow_exception(parse_error);
+    if (write_error) std::rethrow_exception(write_error);
+}
+
+template <class KeyPolicy>
+void BasicModifiedSolution<KeyPolicy>::sort(FileManager &source, FileManager &output) {
+    // Presorted input is copied as is, which would keep its duplicates. The check
+    // reads the input twice, so it also needs a regular file on both ends.
+    if (options_.dedup == DedupMode::None && source.is_seekable() && output.is_seekable()) {
+        metrics::ScopedPhase phase("presorted_check");
+        if (write_if_presorted(source, output, policy_)) return;
+    }
+    // Input that fits the budget is sorted in one buffer, again without temp files.
+    if (options_.dedup == DedupMode::None) {
+        metrics::ScopedPhase phase("in_memory_sort");
+        if (sort_in_memory(source, output, buffer_budget(), options_.threads, policy_)) return;
+    }
+    load_initial_series(source);
+    external_sort(output);
+}
+
+template <class KeyPolicy>
+void BasicModifiedSolution<KeyPolicy>::top_k(FileManager &source, FileManager &output, std::uint64_t k) {
+    if (options_.dedup != DedupMode::None) {
+        throw std::invalid_argument("top_k does not collapse duplicates; SortOptions::dedup must be None.");
+    }
+    if (output.is_seekable()) output.clear();
+    if (k == 0) return;
+
     Reader reader(source);
+    RecordChunk<KeyPolicy> candidates;
+    // In memory the buffer holds up to 2k entries, so each compaction to k is paid
+    // for by k new candidates.
+    const std::uint64_t compact_at = k > std::numeric_limits<std::uint64_t>::max() / 2 ? k : 2 * k;
 
-    const size_t OUT_CNT = first_bucket_.size();
-    std::vector<std::string> out_buffers(OUT_CNT);
+    // At least k earlier lines have a key up to the threshold, so a line with a key
+    // at or above it cannot be among the first k of the stable order.
+    KeyHolder<key_type> threshold;
+    bool have_threshold = false;
 
-    std::size_t per_writer_flush = std::max<std::size_t>(1 << 20, WRITER_BUFFER_BUDGET / std::max<size_t>(1, OUT_CNT));
-    for (auto &s : out_buffers) s.reserve(std::min<std::size_t>(per_writer_flush, 1 << 20));
+    // Spilled runs, once the candidates do not fit in memory.
+    struct SpilledRun {
+        KeyHolder<key_type> max_key;
+        std::size_t count;
+    };
+    std::vector<SpilledRun> spilled;
+    std::vector<std::unique_ptr<RunWriter>> writers;
+    std::size_t spill_idx = 0;
+    // Set once compacting to k no longer frees much memory.
+    bool compaction_stalled = false;
 
-    int series_count = 0;
-    int last_key = std::numeric_limits<int>::min();
+    auto spill = [&]() {
+        if (candidates.entries.empty()) return;
+        if (writers.empty()) {
+            const std::size_t per_writer_flush = writer_share(first_bucket_.size());
+            for (auto &file : first_bucket_) {
+                writers.push_back(std::make_unique<RunWriter>(file, options_.compress_runs, per_writer_flush));
+            }
+        }
+        // Only the k smallest of a run can reach the result.
+        candidates.sort();
+        if (candidates.entries.size() > k) candidates.entries.resize(static_cast<std::size_t>(k));
+        RunWriter &w = *writers[spill_idx];
+        spill_idx = (spill_idx + 1) % writers.size();
+        w.begin_run();
+        for (const auto &e : candidates.entries) {
+            w.push(e.key, candidates.record(e));
+        }
+        SpilledRun run{{}, candidates.entries.size()};
+        run.max_key.assign(KeyPolicy::extract(candidates.record(candidates.entries.back())));
+        spilled.push_back(std::move(run));
+        candidates.clear();
+
+        // The smallest run maximum that covers k spilled lines is a valid threshold.
+        std::vector<const SpilledRun *> by_max;
+        for (const auto &r : spilled) by_max.push_back(&r);
+        std::sort(by_max.begin(), by_max.end(), [](const SpilledRun *a, const SpilledRun *b) {
+            return KeyPolicy::less(a->max_key.get(), b->max_key.get());
+        });
+        std::uint64_t covered = 0;
+        for (const SpilledRun *r : by_max) {
+            covered += r->count;
+            if (covered >= k) {
+                threshold.assign(r->max_key.get());
+                have_threshold = true;
+                break;
+            }
+        }
+    };
 
     std::string_view line_view;
-    size_t writer_idx = 0;
+    std::string_view record;
+    std::string scratch;
+    // Memory the candidates may take, following the budget every 64K lines.
+    std::size_t candidate_budget = reader_budget();
+    std::size_t lines = 0;
     while (reader.get_line(line_view)) {
         if (line_view.empty()) continue;
-        int new_key = fast_get_key_sv(line_view);
-
-        if (new_key < last_key) ++series_count;
-        last_key = new_key;
-        writer_idx = series_count % OUT_CNT;
-
-        out_buffers[writer_idx].append(line_view.data(), line_view.size());
-        out_buffers[writer_idx].push_back('\n');
+        if ((++lines & 0xFFFF) == 0) candidate_budget = reader_budget();
+        if (!policy_.ingest(line_view, scratch, record)) {
+            throw std::runtime_error("Line does not match the sort spec: " + std::string(line_view));
+        }
+        const key_type key = KeyPolicy::extract(record);
+        if (have_threshold && !KeyPolicy::less(key, threshold.get())) continue;
+        candidates.add(KeyPolicy::run_key(key), record);
 
-        if (out_buffers[writer_idx].size() >= per_writer_flush) {
-            BufferedWriter writer(first_bucket_[writer_idx]);
-            writer.write(out_buffers[writer_idx]);
-            writer.flush();
-            out_buffers[writer_idx].clear();
+        const bool full = candidates.memory_usage() >= candidate_budget;
+        if (!full && candidates.entries.size() < compact_at) continue;
+        if (spilled.empty() && candidates.entries.size() >= k && !(full && compaction_stalled)) {
+            candidates.keep_smallest(static_cast<std::size_t>(k));
+            threshold.assign(KeyPolicy::extract(candidates.record(candidates.entries.back())));
+            have_threshold = true;
+            compaction_stalled = candidates.memory_usage() >= candidate_budget / 2;
+        } else if (full) {
+            spill();
         }
     }
 
-    for (size_t i = 0; i < OUT_CNT; ++i) {
-        if (!out_buffers[i].empty()) {
-            BufferedWriter writer(first_bucket_[i]);
-            writer.write(out_buffers[i]);
-            writer.flush();
-            out_buffers[i].clear();
+    if (spilled.empty()) {
+        candidates.keep_smallest(static_cast<std::size_t>(std::min<std::uint64_t>(k, candidates.entries.size())));
+        candidates.sort();
+        BufferedWriter bw(output);
+        FastWriterWrapper fastWriter(bw, writer_budget());
+        for (const auto &e : candidates.entries) {
+            fastWriter.push_line(KeyPolicy::record_text(candidates.record(e)));
         }
+        fastWriter.flush();
+        if (output.is_seekable()) output.reset_cursor();
+        return;
     }
 
+    spill();
+    initial_runs_.assign(first_bucket_.size(), 0);
+    for (std::size_t i = 0; i < writers.size(); ++i) {
+        writers[i]->flush();
+        initial_runs_[i] = writers[i]->runs();
+    }
     for (auto &file : first_bucket_) file.reset_cursor();
+
+    // Only the first k lines of the merged candidates are written, so nothing is
+    // preallocated.
+    total_text_bytes_ = 0;
+    output_limit_ = k;
+    try {
+        sort_into(&output);
+    } catch (...) {
+        output_limit_ = std::numeric_limits<std::uint64_t>::max();
+        throw;
+    }
+    output_limit_ = std::numeric_limits<std::uint64_t>::max();
+}
+
+template <class KeyPolicy>
+const FileManager &BasicModifiedSolution<KeyPolicy>::external_sort() {
+    return sort_into(nullptr);
+}
+
+template <class KeyPolicy>
+void BasicModifiedSolution<KeyPolicy>::external_sort(FileManager &output) {
+    if (output.is_seekable()) output.clear();
+    sort_into(&output);
+}
+
+template <class KeyPolicy>
+void BasicModifiedSolution<KeyPolicy>::external_sort(const std::string &output_path) {
+    FileManager output(output_path, true, 0644);
+    external_sort(output);
 }
 
-const FileManager &ModifiedSolution::external_sort() {
+template <class KeyPolicy>
+std::vector<FileManager> *BasicModifiedSolution<KeyPolicy>::merge_until_last_pass() {
     auto *cur_fileset = &first_bucket_;
     auto *opposite_fileset = &second_bucket_;
-    while (true) {
-        size_t files_with_content = 0;
-        int content_file_idx = -1;
-        for (size_t i = 0; i < cur_fileset->size(); ++i) {
-            if (!(*cur_fileset)[i].is_empty()) {
-                files_with_content++;
-                content_file_idx = static_cast<int>(i);
-            }
-        }
-        if (files_with_content <= 1) {
-            return (content_file_idx == -1) ? (*cur_fileset)[0] : (*cur_fileset)[content_file_idx];
-        }
-        merge_many_into_many(cur_fileset, opposite_fileset);
+
+    std::vector<std::size_t> runs = initial_runs_;
+    runs.resize(cur_fileset->size(), 0);
+
+    // Once every file holds at most one run, the next merge produces the result.
+    while (!std::all_of(runs.begin(), runs.end(), [](std::size_t r) { return r <= 1; })) {
+        runs = merge_many_into_many(cur_fileset, opposite_fileset, nullptr);
         for (auto &file : *opposite_fileset) { file.reset_cursor(); }
         for (auto &file : *cur_fileset) { file.clear(); }
         std::swap(cur_fileset, opposite_fileset);
     }
+    return cur_fileset;
+}
+
+template <class KeyPolicy>
+const FileManager &BasicModifiedSolution<KeyPolicy>::sort_into(FileManager *final_output) {
+    auto *cur_fileset = merge_until_last_pass();
+    auto *opposite_fileset = cur_fileset == &first_bucket_ ? &second_bucket_ : &first_bucket_;
+
+    FileManager *target = final_output != nullptr ? final_output : &(*opposite_fileset)[0];
+    merge_many_into_many(cur_fileset, opposite_fileset, target);
+    for (auto &file : *opposite_fileset) { file.reset_cursor(); }
+    for (auto &file : *cur_fileset) { file.clear(); }
+    if (target->is_seekable()) target->reset_cursor();
+    return *target;
 }
 
-void ModifiedSolution::merge_many_into_many(std::vector<FileManager> *cur_fileset,
-                                            std::vector<FileManager> *opposite_fileset) {
+template <class KeyPolicy>
+std::vector<std::size_t> BasicModifiedSolution<KeyPolicy>::merge_many_into_many(
+    std::vector<FileManager> *cur_fileset,
+    std::vector<FileManager> *opposite_fileset,
+    FileManager *final_output) {
+    metrics::ScopedPhase phase(final_output != nullptr ? "final_merge" : "merge_pass");
     const size_t FILE_COUNT = cur_fileset->size();
-    if (FILE_COUNT == 0) return;
+    std::vector<std::size_t> runs(opposite_fileset->size(), 0);
+    if (FILE_COUNT == 0) return runs;
 
-    std::size_t per_file_budget = std::max<std::size_t>(1 << 20, READER_BUDGET / FILE_COUNT);
+    std::vector<std::unique_ptr<RunReader>> readers;
+    std::vector<Segment> segments;
+    open_run_readers(*cur_fileset, options_.compress_runs, readers, segments);
 
-    std::vector<std::unique_ptr<Reader>> readers;
-    readers.reserve(FILE_COUNT);
-    for (size_t i = 0; i < FILE_COUNT; ++i) {
-        readers.push_back(std::make_unique<Reader>((*cur_fileset)[i]));
+    if (final_output != nullptr) {
+        final_output->preallocate(total_text_bytes_);
+        BufferedWriter bw(*final_output);
+        FastWriterWrapper fastWriter(bw, writer_budget());
+        TextSink<KeyPolicy> sink{fastWriter, output_limit_, options_.dedup == DedupMode::Count, {}};
+        if (options_.dedup == DedupMode::None) {
+            merge_many_into_one(readers, segments, sink, 1);
+        } else {
+            DedupSink<KeyPolicy, TextSink<KeyPolicy>> dedup(sink, options_.dedup);
+            merge_many_into_one(readers, segments, dedup, 1);
+            dedup.flush();
+        }
+        runs[0] = 1;
+        phase.set_runs(1);
+        return runs;
     }
 
-    std::vector<InMemSegment> segments(FILE_COUNT);
+    const size_t OUT_CNT = opposite_fileset->size();
+    std::size_t per_writer_flush = writer_share(OUT_CNT);
+    std::vector<std::unique_ptr<RunWriter>> writers;
+    writers.reserve(OUT_CNT);
+    for (auto &file : *opposite_fileset) {
+        writers.push_back(std::make_unique<RunWriter>(file, options_.compress_runs, per_writer_flush));
+    }
 
     size_t output_idx = 0;
 
-    for (size_t i = 0; i < FILE_COUNT; ++i) {
-        refill_segment_from_reader(segments[i], *readers[i], per_file_budget);
-    }
-
     while (true) {
         bool has_more = false;
         for (size_t i = 0; i < FILE_COUNT; ++i) {
-            if (segments[i].has_next() || !readers[i]->is_end()) { has_more = true; break; }
+            if (!segments[i].has_next() && !readers[i]->is_end()) {
+                refill_segment_from_reader(segments[i], *readers[i], segment_budget(FILE_COUNT));
+            }
+            if (segments[i].has_next()) has_more = true;
         }
         if (!has_more) break;
 
-        BufferedWriter bw((*opposite_fileset)[output_idx]);
-        FastWriterWrapper fastWriter(bw, WRITER_BUFFER_BUDGET);
-
-        merge_many_into_one(readers, segments, fastWriter, per_file_budget);
+        writers[output_idx]->begin_run();
+        if (options_.dedup == DedupMode::None) {
+            merge_many_into_one(readers, segments, *writers[output_idx], OUT_CNT);
+        } else {
+            DedupSink<KeyPolicy, RunWriter> dedup(*writers[output_idx], options_.dedup);
+            merge_many_into_one(readers, segments, dedup, OUT_CNT);
+            dedup.flush();
+        }
 
-        output_idx = (output_idx + 1) % opposite_fileset->size();
+        output_idx = (output_idx + 1) % OUT_CNT;
+    }
 
-        for (size_t i = 0; i < FILE_COUNT; ++i) {
-            if (!segments[i].has_next() && !readers[i]->is_end()) {
-                refill_segment_from_reader(segments[i], *readers[i], per_file_budget);
-            }
-        }
+    for (size_t i = 0; i < OUT_CNT; ++i) {
+        writers[i]->flush();
+        runs[i] = writers[i]->runs();
     }
+    phase.set_runs(std::accumulate(runs.begin(), runs.end(), std::uint64_t{0}));
+    return runs;
 }
 
+// Heap entry of the k-way merge. With an exact run key the cached integer decides
+// alone; otherwise equal run keys fall back to the policy on the full key.
+// ByRecord (DedupMode::Unique) orders equal keys by record before input, as run
+// formation does, so identical records meet as neighbours.
+template <class KeyPolicy, bool Exact = KeyPolicy::run_key_exact, bool ByRecord = false>
 struct PQEntry {
-    int key;
+    using run_key_type = typename KeyPolicy::run_key_type;
+    static constexpr bool run_key_decides = true;
+
+    run_key_type key;
     size_t file_idx;
-    size_t line_index;
+
+    static PQEntry at(const InMemSegment<run_key_type> &seg, size_t file_idx) {
+        return PQEntry{seg.peek_key(), file_idx};
+    }
+    static PQEntry at(const InMemSegment<run_key_type> &seg, size_t file_idx, size_t line) {
+        return PQEntry{seg.keys[line], file_idx};
+    }
     bool operator>(PQEntry const &o) const {
         return key > o.key || (key == o.key && file_idx > o.file_idx);
     }
 };
 
-void ModifiedSolution::merge_many_into_one(
-    std::vector<std::unique_ptr<Reader>> &readers,
-    std::vector<InMemSegment> &segments,
-    FastWriterWrapper &out_writer,
-    std::size_t per_file_budget) {
+template <class KeyPolicy>
+struct PQEntry<KeyPolicy, false, false> {
+    using run_key_type = typename KeyPolicy::run_key_type;
+    static constexpr bool run_key_decides = false;
+
+    run_key_type key;
+    std::string_view record; // stays valid: a segment is only refilled after its entry is popped
+    size_t file_idx;
+
+    static PQEntry at(const InMemSegment<run_key_type> &seg, size_t file_idx) {
+        return PQEntry{seg.peek_key(), seg.peek(), file_idx};
+    }
+    static PQEntry at(const InMemSegment<run_key_type> &seg, size_t file_idx, size_t line) {
+        return PQEntry{seg.keys[line], seg.lines[line], file_idx};
+    }
+    bool operator>(PQEntry const &o) const {
+        if (key != o.key) return key > o.key;
+        const auto a = KeyPolicy::extract(record);
+        const auto b = KeyPolicy::extract(o.record);
+        if (KeyPolicy::less(b, a)) return true;
+        if (KeyPolicy::less(a, b)) return false;
+        return file_idx > o.file_idx;
+    }
+};
+
+template <class KeyPolicy, bool Exact>
+struct PQEntry<KeyPolicy, Exact, true> {
+    using run_key_type = typename KeyPolicy::run_key_type;
+    static constexpr bool run_key_decides = false;
+
+    run_key_type key;
+    std::string_view record;
+    size_t file_idx;
+
+    static PQEntry at(const InMemSegment<run_key_type> &seg, size_t file_idx) {
+        return PQEntry{seg.peek_key(), seg.peek(), file_idx};
+    }
+    static PQEntry at(const InMemSegment<run_key_type> &seg, size_t file_idx, size_t line) {
+        return PQEntry{seg.keys[line], seg.lines[line], file_idx};
+    }
+    bool operator>(PQEntry const &o) const {
+        if (key != o.key) return key > o.key;
+        if constexpr (!Exact) {
+            const auto a = KeyPolicy::extract(record);
+            const auto b = KeyPolicy::extract(o.record);
+            if (KeyPolicy::less(b, a)) return true;
+            if (KeyPolicy::less(a, b)) return false;
+        }
+        const int c = record.compare(o.record);
+        if (c != 0) return c > 0;
+        return file_idx > o.file_idx;
+    }
+};
+
+// std::greater<> that counts its calls for the metrics report.
+struct CountingGreater {
+    std::uint64_t *count;
+
+    template <class T>
+    bool operator()(const T &a, const T &b) const {
+        ++*count;
+        return a > b;
+    }
+};
+
+// Consecutive wins of one input after which a merge starts galloping, as in TimSort.
+static constexpr unsigned MIN_GALLOP = 7;
+
+// Moves the records of `seg` that come before `runner_up`, the smallest head of
+// the other inputs, to the output at once and returns how many there were. An
+// exponential search, then a binary search over the current run finds the span;
+// a RunWriter takes it as encoded bytes, other sinks record by record, but
+// either way without heap work. Comparisons are counted like the heap's.
+template <class Entry, class Key, class Sink>
+static std::size_t gallop(InMemSegment<Key> &seg, std::size_t file_idx, const Entry &runner_up, Sink &out,
+                          std::uint64_t &comparisons) {
+    const std::size_t from = seg.next_index;
+    const std::size_t limit = seg.run_end();
+    auto comes_first = [&](std::size_t line) {
+        ++comparisons;
+        return !(Entry::at(seg, file_idx, line) > runner_up);
+    };
+    if (!comes_first(from)) return 0;
 
+    // lo comes first; hi does not, or is the limit.
+    std::size_t lo = from;
+    std::size_t hi = from + 1;
+    std::size_t step = 1;
+    while (hi < limit && comes_first(hi)) {
+        lo = hi;
+        step *= 2;
+        hi = std::min(limit, lo + step);
+    }
+    while (hi - lo > 1) {
+        const std::size_t mid = lo + (hi - lo) / 2;
+        if (comes_first(mid)) lo = mid;
+        else hi = mid;
+    }
+
+    const std::size_t to = lo + 1;
+    if (out.append_records(seg.encoded(from, to), static_cast<std::uint32_t>(to - from))) {
+        seg.next_index = to;
+    } else {
+        while (seg.next_index < to) {
+            const Key key = seg.peek_key();
+            const std::uint64_t count = seg.peek_count();
+            out.push(key, seg.pop(), count);
+        }
+    }
+    return to - from;
+}
+
+// Records per input that one merge_two_runs() call orders; bounds its scratch memory.
+static constexpr std::size_t TWO_WAY_WINDOW = std::size_t{1} << 16;
+
+// Merges the current runs of two inputs, `first` winning ties, until the loaded
+// part of either is used up, and returns how many records moved. The keys are
+// merged on their own by merge_two_runs(); the records then go to the output in
+// that order, so the payloads are touched once and no heap is involved.
+template <class Key, class Sink>
+static std::size_t merge_two_segments(InMemSegment<Key> &first, InMemSegment<Key> &second, Sink &out,
+                                      std::vector<std::uint32_t> &order) {
+    const std::size_t first_from = first.next_index;
+    const std::size_t second_from = second.next_index;
+    merge_two_runs(first.keys.data() + first_from, std::min(first.run_end() - first_from, TWO_WAY_WINDOW),
+                   second.keys.data() + second_from, std::min(second.run_end() - second_from, TWO_WAY_WINDOW),
+                   order);
+    std::size_t taken_second = 0;
+    for (const std::uint32_t o : order) {
+        const bool from_second = (o & FROM_SECOND) != 0;
+        const InMemSegment<Key> &seg = from_second ? second : first;
+        const std::size_t line = (from_second ? second_from : first_from) + (o & ~FROM_SECOND);
+        out.push(seg.keys[line], seg.lines[line], seg.counts.empty() ? 1 : seg.counts[line]);
+        taken_second += from_second;
+    }
+    first.next_index = first_from + (order.size() - taken_second);
+    second.next_index = second_from + taken_second;
+    return order.size();
+}
+
+// The body of merge_many_into_one() for one heap entry type.
+template <class Entry, class Key, class Sink>
+static void merge_runs(std::vector<std::unique_ptr<BasicRunReader<Key>>> &readers,
+                       std::vector<InMemSegment<Key>> &segments,
+                       Sink &out_writer,
+                       std::size_t sink_count) {
+    using Segment = InMemSegment<Key>;
     const size_t FILE_COUNT = readers.size();
-    std::priority_queue<PQEntry, std::vector<PQEntry>, std::greater<>> pq;
+    std::uint64_t comparisons = 0;
+    std::uint64_t heap_ops = 0;
+    std::uint64_t gallop_records = 0;
+    std::uint64_t two_way_records = 0;
+    std::vector<std::uint32_t> order;
+    std::priority_queue<Entry, std::vector<Entry>, CountingGreater> pq(CountingGreater{&comparisons});
+    size_t streak_idx = FILE_COUNT;
+    unsigned streak = 0;
 
+    // Every non-empty segment is positioned at the start of its next run.
     for (size_t i = 0; i < FILE_COUNT; ++i) {
         if (segments[i].has_next()) {
-            std::string_view sv = segments[i].peek();
-            int key = fast_get_key_sv(sv);
-            pq.push(PQEntry{key, i, segments[i].next_index});
+            pq.push(Entry::at(segments[i], i));
+            ++heap_ops;
         }
     }
 
-    if (pq.empty()) return;
-
-    int last_key_written = std::numeric_limits<int>::min();
+    auto refill_and_requeue = [&](std::size_t file_idx) {
+        Segment &seg = segments[file_idx];
+        if (!seg.has_next() && !readers[file_idx]->is_end()) {
+            refill_segment_from_reader(seg, *readers[file_idx], segment_budget(FILE_COUNT));
+            out_writer.set_flush_size(writer_share(sink_count));
+        }
+        // A run-start flag means this input's current run is finished.
+        if (seg.has_next() && !seg.peek_starts_run()) {
+            pq.push(Entry::at(seg, file_idx));
+            ++heap_ops;
+        }
+    };
 
     while (!pq.empty()) {
-        PQEntry e = pq.top(); pq.pop();
-
-        InMemSegment &seg = segments[e.file_idx];
-        assert(seg.next_index == e.line_index);
-        std::string_view line_sv = seg.pop();
-        out_writer.push_line(line_sv);
-        last_key_written = e.key;
-
-        if (seg.has_next()) {
-            std::string_view next_sv = seg.peek();
-            int next_key = fast_get_key_sv(next_sv);
-            // --- FIX 1: Corrected Logic ---
-            // A new key must be >= the last key to be part of the same sorted run.
-            if (next_key >= last_key_written) {
-                pq.push(PQEntry{next_key, e.file_idx, seg.next_index});
+        // Down to two inputs (the last pass, or a group where the third input ran
+        // out of runs) with keys that order alone: merge them without the heap.
+        if constexpr (Entry::run_key_decides) {
+            if (pq.size() == 2) {
+                const std::size_t a = pq.top().file_idx; pq.pop();
+                const std::size_t b = pq.top().file_idx; pq.pop();
+                heap_ops += 2;
+                const std::size_t first = std::min(a, b);
+                const std::size_t second = std::max(a, b);
+                const std::size_t first_from = segments[first].next_index;
+                const std::size_t second_from = segments[second].next_index;
+                two_way_records += merge_two_segments(segments[first], segments[second], out_writer, order);
+                streak = 0;
+                // An input that gave no record may still be at the record that opens
+                // its run; that flag does not mean the run is finished.
+                auto requeue = [&](std::size_t idx, std::size_t from) {
+                    if (segments[idx].next_index == from) {
+                        pq.push(Entry::at(segments[idx], idx));
+                        ++heap_ops;
+                    } else {
+                        refill_and_requeue(idx);
+                    }
+                };
+                requeue(first, first_from);
+                requeue(second, second_from);
+                continue;
             }
+        }
+
+        Entry e = pq.top(); pq.pop();
+        ++heap_ops;
+
+        Segment &seg = segments[e.file_idx];
+        const std::uint64_t count = seg.peek_count();
+        out_writer.push(e.key, seg.pop(), count);
+
+        if (pq.empty()) {
+            drain_sole_run(*readers[e.file_idx], seg, out_writer, FILE_COUNT);
+            break;
+        }
+
+        // An input that keeps winning is likely ahead of the others for a while.
+        if (e.file_idx == streak_idx) {
+            ++streak;
         } else {
-            size_t idx = e.file_idx;
-            if (!readers[idx]->is_end()) {
-                bool loaded = refill_segment_from_reader(seg, *readers[idx], per_file_budget);
-                if (loaded && seg.has_next()) {
-                    std::string_view head = seg.peek();
-                    int head_key = fast_get_key_sv(head);
-                    // --- FIX 2: Corrected Logic ---
-                    // Same logic applies after refilling a buffer.
-                    if (head_key >= last_key_written) {
-                        pq.push(PQEntry{head_key, idx, seg.next_index});
-                    }
-                }
+            streak_idx = e.file_idx;
+            streak = 1;
+        }
+        if (streak >= MIN_GALLOP && seg.has_next() && !seg.peek_starts_run()) {
+            gallop_records += gallop(seg, e.file_idx, pq.top(), out_writer, comparisons);
+        }
+        refill_and_requeue(e.file_idx);
+    }
+    if (metrics::enabled()) {
+        metrics::add(metrics::Counter::HeapOps, heap_ops);
+        metrics::add(metrics::Counter::Comparisons, comparisons);
+        metrics::add(metrics::Counter::GallopRecords, gallop_records);
+        metrics::add(metrics::Counter::TwoWayRecords, two_way_records);
+    }
+}
+
+template <class KeyPolicy>
+template <class Sink>
+void BasicModifiedSolution<KeyPolicy>::merge_many_into_one(
+    std::vector<std::unique_ptr<RunReader>> &readers,
+    std::vector<Segment> &segments,
+    Sink &out_writer,
+    std::size_t sink_count) {
+    if (options_.dedup == DedupMode::Unique) {
+        merge_runs<PQEntry<KeyPolicy, KeyPolicy::run_key_exact, true>>(readers, segments, out_writer, sink_count);
+    } else {
+        merge_runs<PQEntry<KeyPolicy>>(readers, segments, out_writer, sink_count);
+    }
+}
+
+// ---------- SortedStream ----------
+// The last merge pass, advanced one record per pop(). A popped record views into
+// its segment, so refilling that segment waits until the next pop().
+template <class KeyPolicy>
+struct BasicSortedStream<KeyPolicy>::State {
+    using run_key_type = typename KeyPolicy::run_key_type;
+    using Entry = PQEntry<KeyPolicy>;
+    using UniqueEntry = PQEntry<KeyPolicy, KeyPolicy::run_key_exact, true>;
+
+    // Receives the records that survive dedup, one at a time.
+    struct Slot {
+        bool full = false;
+        std::string text;
+        std::uint64_t count = 1;
+
+        void begin_run() {}
+        void push(run_key_type, std::string_view record, std::uint64_t n = 1) {
+            full = true;
+            text.assign(KeyPolicy::record_text(record));
+            count = n;
+        }
+        bool copy_block_from(BasicRunReader<run_key_type> &) { return false; }
+    };
+
+    explicit State(DedupMode mode) : dedup_mode(mode), dedup(slot, mode) {}
+
+    std::vector<std::unique_ptr<BasicRunReader<run_key_type>>> readers;
+    std::vector<InMemSegment<run_key_type>> segments;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> pq;
+    std::priority_queue<UniqueEntry, std::vector<UniqueEntry>, std::greater<>> unique_pq; // DedupMode::Unique
+    static constexpr std::size_t NO_PENDING = std::numeric_limits<std::size_t>::max();
+    std::size_t pending = NO_PENDING; // segment of the last popped record
+
+    DedupMode dedup_mode;
+    Slot slot;
+    DedupSink<KeyPolicy, Slot> dedup;
+    std::string_view line;
+    std::uint64_t line_count = 1;
+
+    void push(std::size_t file_idx) {
+        if (dedup_mode == DedupMode::Unique) unique_pq.push(UniqueEntry::at(segments[file_idx], file_idx));
+        else pq.push(Entry::at(segments[file_idx], file_idx));
+    }
+
+    bool pop(run_key_type &key, std::string_view &record, std::uint64_t &count) {
+        if (pending != NO_PENDING) {
+            auto &seg = segments[pending];
+            if (!seg.has_next() && !readers[pending]->is_end()) {
+                refill_segment_from_reader(seg, *readers[pending], segment_budget(readers.size()));
+            }
+            if (seg.has_next() && !seg.peek_starts_run()) push(pending);
+            pending = NO_PENDING;
+        }
+        return dedup_mode == DedupMode::Unique ? pop_from(unique_pq, key, record, count)
+                                               : pop_from(pq, key, record, count);
+    }
+
+    template <class Queue>
+    bool pop_from(Queue &queue, run_key_type &key, std::string_view &record, std::uint64_t &count) {
+        if (queue.empty()) return false;
+
+        const auto e = queue.top();
+        queue.pop();
+        auto &seg = segments[e.file_idx];
+        key = e.key;
+        count = seg.peek_count();
+        record = seg.pop();
+        pending = e.file_idx;
+        return true;
+    }
+};
+
+template <class KeyPolicy>
+BasicSortedStream<KeyPolicy>::BasicSortedStream(std::unique_ptr<State> state) : state_(std::move(state)) {}
+
+template <class KeyPolicy>
+BasicSortedStream<KeyPolicy>::BasicSortedStream(BasicSortedStream &&) noexcept = default;
+
+template <class KeyPolicy>
+BasicSortedStream<KeyPolicy> &BasicSortedStream<KeyPolicy>::operator=(BasicSortedStream &&) noexcept = default;
+
+template <class KeyPolicy>
+BasicSortedStream<KeyPolicy>::~BasicSortedStream() = default;
+
+template <class KeyPolicy>
+bool BasicSortedStream<KeyPolicy>::next(std::string_view &line) {
+    State &st = *state_;
+    typename State::run_key_type key{};
+    std::string_view record;
+    std::uint64_t count = 1;
+
+    if (st.dedup_mode == DedupMode::None) {
+        if (!st.pop(key, record, count)) return false;
+        st.line = KeyPolicy::record_text(record);
+        st.line_count = count;
+    } else {
+        st.slot.full = false;
+        while (!st.slot.full) {
+            if (st.pop(key, record, count)) {
+                st.dedup.push(key, record, count);
+            } else {
+                st.dedup.flush();
+                if (!st.slot.full) return false;
             }
         }
+        st.line = st.slot.text;
+        st.line_count = st.dedup_mode == DedupMode::Count ? st.slot.count : 1;
     }
+    line = st.line;
+    return true;
+}
+
+template <class KeyPolicy>
+std::uint64_t BasicSortedStream<KeyPolicy>::count() const {
+    return state_->line_count;
 }
+
+template <class KeyPolicy>
+BasicSortedStream<KeyPolicy> BasicModifiedSolution<KeyPolicy>::sorted_stream(FileManager &source) {
+    load_initial_series(source);
+    std::vector<FileManager> *fileset = merge_until_last_pass();
+
+    auto state = std::make_unique<typename SortedStream::State>(options_.dedup);
+    open_run_readers(*fileset, options_.compress_runs, state->readers, state->segments);
+    for (std::size_t i = 0; i < state->segments.size(); ++i) {
+        if (state->segments[i].has_next()) state->push(i);
+    }
+    return SortedStream(std::move(state));
+}
+
+template class BasicSortedStream<IntPrefixKey>;
+template class BasicSortedStream<Int64PrefixKey>;
+template class BasicSortedStream<DateFieldKey>;
+template class BasicSortedStream<WholeLineKey>;
+template class BasicSortedStream<NormalizedKey>;
+
+template class BasicModifiedSolution<IntPrefixKey>;
+template class BasicModifiedSolution<Int64PrefixKey>;
+template class BasicModifiedSolution<DateFieldKey>;
+template class BasicModifiedSolution<WholeLineKey>;
+template class BasicModifiedSolution<NormalizedKey>;
@@ -0,0 +1,241 @@
+#include "../../include/solution/presorted.h"
+#include "../../include/solution/key.h"
+#include "../../include/solution/sort_spec.h"
+#include "../../include/io/buffered_writer.h"
+#include "../../include/io/reader.h"
+#include "../../include/io/writer.h"
+#include "../../include/io/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+static constexpr std::size_t SCAN_CHUNK_SIZE = 1 << 20;
+// Ranges smaller than this are not worth a thread of their own.
+static constexpr std::uint64_t MIN_RANGE_BYTES = 8ull << 20;
+
+static const char *find_last_newline(const char *data, std::size_t len) {
+#if defined(__GLIBC__)
+    return static_cast<const char *>(memrchr(data, '\n', len));
+#else
+    for (std::size_t i = len; i > 0; --i) {
+        if (data[i - 1] == '\n') return data + i - 1;
+    }
+    return nullptr;
+#endif
+}
+
+namespace {
+
+template <class KeyPolicy>
+struct RangeScan {
+    using key_type = typename KeyPolicy::key_type;
+
+    const KeyPolicy *policy = nullptr;
+    bool any = false;
+    bool valid = true;
+    bool ascending = true;
+    bool descending = true;
+    KeyHolder<key_type> first_key;
+    KeyHolder<key_type> last_key;
+    std::string scratch;
+
+    // Returns false once the range can no longer be presorted.
+    bool on_line(std::string_view line) {
+        key_type key{};
+        std::string_view record;
+        if (line.empty() || line.back() == '\r' || !policy->ingest(line, scratch, record)
+            || !KeyPolicy::try_extract(record, key)) {
+            valid = false;
+            return false;
+        }
+        if (!any) {
+            any = true;
+            first_key.assign(key);
+        } else {
+            ascending = ascending && !KeyPolicy::less(key, last_key.get());
+            // Strictly: reversing a run of equal keys would reverse their input order.
+            descending = descending && KeyPolicy::less(key, last_key.get());
+        }
+        last_key.assign(key);
+        return ascending || descending;
+    }
+};
+
+} // namespace
+
+// Line splitting relies on memchr, which libc implements with SSE2/AVX2.
+template <class KeyPolicy>
+static void scan_range(const FileManager &source, std::uint64_t begin, std::uint64_t end,
+                       RangeScan<KeyPolicy> &scan, std::atomic<bool> &stop) {
+    std::vector<char> buffer(SCAN_CHUNK_SIZE);
+    std::string carry;
+    std::uint64_t pos = begin;
+
+    while (pos < end && !stop.load(std::memory_order_relaxed)) {
+        const std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(buffer.size(), end - pos));
+        const std::size_t n = source.read_at(buffer.data(), want, pos);
+        if (n == 0) break;
+        pos += n;
+
+        const char *p = buffer.data();
+        const char *chunk_end = p + n;
+        while (p < chunk_end) {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<std::size_t>(chunk_end - p)));
+            if (!nl) {
+                carry.append(p, chunk_end);
+                break;
+            }
+            bool ok;
+            if (!carry.empty()) {
+                carry.append(p, nl);
+                ok = scan.on_line(carry);
+                carry.clear();
+            } else {
+                ok = scan.on_line(std::string_view(p, static_cast<std::size_t>(nl - p)));
+            }
+            if (!ok) {
+                // One unordered range makes the whole input unsorted.
+                stop.store(true, std::memory_order_relaxed);
+                return;
+            }
+            p = nl + 1;
+        }
+    }
+    // Only the last range can end without a newline.
+    if (!carry.empty() && !scan.on_line(carry)) {
+        stop.store(true, std::memory_order_relaxed);
+    }
+}
+
+template <class KeyPolicy>
+InputOrder detect_input_order(FileManager &source, unsigned threads, const KeyPolicy &policy) {
+    const std::uint64_t file_size = source.size();
+
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    const std::uint64_t max_ranges = std::max<std::uint64_t>(1, file_size / MIN_RANGE_BYTES);
+    const std::size_t range_count = static_cast<std::size_t>(std::min<std::uint64_t>(threads, max_ranges));
+
+    std::vector<std::uint64_t> bounds;
+    bounds.reserve(range_count + 1);
+    for (std::size_t i = 0; i < range_count; ++i) {
+        bounds.push_back(next_line_start(source, file_size * i / range_count, file_size));
+    }
+    bounds.push_back(file_size);
+    // Very long lines can swallow a whole nominal range.
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    const std::size_t ranges = bounds.size() - 1;
+    std::vector<RangeScan<KeyPolicy>> scans(ranges);
+    for (auto &scan : scans) scan.policy = &policy;
+    std::atomic<bool> stop{false};
+
+    parallel_for(ranges, [&](std::size_t i) {
+        try {
+            scan_range(source, bounds[i], bounds[i + 1], scans[i], stop);
+        } catch (...) {
+            scans[i].valid = false;
+            stop.store(true, std::memory_order_relaxed);
+            throw;
+        }
+    });
+
+    // Stitch the ranges together: each must be ordered, and so must the seams.
+    bool ascending = true;
+    bool descending = true;
+    const RangeScan<KeyPolicy> *prev = nullptr;
+    for (const RangeScan<KeyPolicy> &scan : scans) {
+        if (!scan.valid) return InputOrder::Unsorted;
+        if (!scan.any) continue;
+        ascending = ascending && scan.ascending
+                    && (!prev || !KeyPolicy::less(scan.first_key.get(), prev->last_key.get()));
+        descending = descending && scan.descending
+                     && (!prev || KeyPolicy::less(scan.first_key.get(), prev->last_key.get()));
+        prev = &scan;
+    }
+    if (ascending) return InputOrder::Ascending;
+    if (descending) return InputOrder::Descending;
+    return InputOrder::Unsorted;
+}
+
+void write_reversed_lines(FileManager &source, FileManager &output) {
+    std::uint64_t pos = source.size();
+
+    BufferedWriter writer(output, SCAN_CHUNK_SIZE);
+    std::string buf;
+    std::string tail; // end of a line whose start lies before `pos`
+
+    while (pos > 0) {
+        const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(SCAN_CHUNK_SIZE, pos));
+        pos -= n;
+        buf.resize(n);
+        if (source.read_at(&buf[0], n, pos) != n) {
+            throw std::runtime_error("Short read while reversing input.");
+        }
+        buf.append(tail);
+
+        std::size_t end = buf.size();
+        while (true) {
+            std::size_t content_end = end;
+            if (content_end > 0 && buf[content_end - 1] == '\n') --content_end;
+            const char *nl = find_last_newline(buf.data(), content_end);
+            if (nl) {
+                const std::size_t start = static_cast<std::size_t>(nl - buf.data()) + 1;
+                writer.write(std::string_view(buf.data() + start, content_end - start));
+                writer.write(std::string_view("\n", 1));
+                end = start;
+            } else if (pos == 0) {
+                if (content_end > 0 || end > 0) {
+                    writer.write(std::string_view(buf.data(), content_end));
+                    writer.write(std::string_view("\n", 1));
+                }
+                break;
+            } else {
+                tail.assign(buf, 0, end);
+                break;
+            }
+        }
+    }
+    writer.flush();
+}
+
+template <class KeyPolicy>
+bool write_if_presorted(FileManager &source, FileManager &output, const KeyPolicy &policy) {
+    const InputOrder order = detect_input_order<KeyPolicy>(source, 0, policy);
+    if (order == InputOrder::Unsorted) return false;
+
+    if (order == InputOrder::Ascending) {
+        source.clone_to(output);
+        // The regular path terminates every line; so must the fast path.
+        char last = '\n';
+        const std::uint64_t size = source.size();
+        if (size > 0 && source.read_at(&last, 1, size - 1) == 1 && last != '\n') {
+            output.seek_to_end();
+            Writer(output).write_all("\n", 1);
+        }
+    } else {
+        output.clear();
+        write_reversed_lines(source, output);
+    }
+    source.reset_cursor();
+    output.reset_cursor();
+    return true;
+}
+
+#define INSTANTIATE_PRESORTED(Policy)                                                 \
+    template InputOrder detect_input_order<Policy>(FileManager &, unsigned, const Policy &); \
+    template bool write_if_presorted<Policy>(FileManager &, FileManager &, const Policy &);
+
+INSTANTIATE_PRESORTED(IntPrefixKey)
+INSTANTIATE_PRESORTED(Int64PrefixKey)
+INSTANTIATE_PRESORTED(DateFieldKey)
+INSTANTIATE_PRESORTED(WholeLineKey)
+INSTANTIATE_PRESORTED(NormalizedKey)
+
+#undef INSTANTIATE_PRESORTED
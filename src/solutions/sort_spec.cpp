@@ -0,0 +1,70 @@
+#include "../../include/solution/sort_spec.h"
+
+#include <stdexcept>
+
+SortSpec SortSpec::parse(std::string_view text) {
+    SortSpec spec;
+    while (!text.empty()) {
+        const std::size_t comma = text.find(',');
+        std::string_view item = text.substr(0, comma);
+        text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+
+        bool descending = false;
+        const std::size_t colon = item.find(':');
+        if (colon != std::string_view::npos) {
+            const std::string_view dir = item.substr(colon + 1);
+            if (dir == "desc") descending = true;
+            else if (dir != "asc") throw std::invalid_argument("Unknown sort direction: " + std::string(dir));
+            item = item.substr(0, colon);
+        }
+
+        Field field;
+        if (item == "num") field = Field::Number;
+        else if (item == "alpha") field = Field::Alpha;
+        else if (item == "date") field = Field::Date;
+        else throw std::invalid_argument("Unknown sort field: " + std::string(item));
+        spec.columns_.push_back(Column{field, descending});
+    }
+    if (spec.columns_.empty()) throw std::invalid_argument("Empty sort spec.");
+    return spec;
+}
+
+static void append_u32_be(std::string &out, std::uint32_t v) {
+    const char bytes[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                           static_cast<char>(v >> 8), static_cast<char>(v)};
+    out.append(bytes, 4);
+}
+
+bool SortSpec::encode(std::string_view line, std::string &out) const {
+    // Split NUM-alpha-YYYY/MM/DD; the number may carry its own leading '-'.
+    std::int32_t number = 0;
+    std::int32_t date = 0;
+    if (!try_parse_leading_int(line, number) || !DateFieldKey::try_extract(line, date)) return false;
+    const std::size_t num_end = line.find('-', line[0] == '-' ? 1 : 0);
+    const std::size_t date_start = line.size() - 10;
+    if (num_end == std::string_view::npos || num_end + 1 >= date_start) return false;
+    const std::string_view alpha = line.substr(num_end + 1, date_start - 1 - (num_end + 1));
+
+    for (const Column &col : columns_) {
+        const std::size_t start = out.size();
+        switch (col.field) {
+            case Field::Number:
+                append_u32_be(out, static_cast<std::uint32_t>(number) ^ 0x80000000u);
+                break;
+            case Field::Date:
+                append_u32_be(out, static_cast<std::uint32_t>(date));
+                break;
+            case Field::Alpha:
+                for (char c : alpha) {
+                    out.push_back(c);
+                    if (c == '\0') out.push_back('\1');
+                }
+                out.append(2, '\0');
+                break;
+        }
+        if (col.descending) {
+            for (std::size_t i = start; i < out.size(); ++i) out[i] = static_cast<char>(~out[i]);
+        }
+    }
+    return true;
+}
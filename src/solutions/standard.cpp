@@ -3,6 +3,7 @@
 #include "../../include/solution/standard.h"
 #include "io/reader.h"
 #include "io/buffered_writer.h"
+#include "io/metrics.h"
 #include <limits>
 #include <queue>
 #include <cassert>
@@ -11,48 +12,39 @@
 #include <optional>
 #include <memory>
 
-inline int fast_atoi(const char* str, size_t len) noexcept {
-    int val = 0;
-    for (size_t i = 0; i < len && str[i] >= '0' && str[i] <= '9'; ++i)
-        val = val * 10 + (str[i] - '0');
-    return val;
+template <class KeyPolicy>
+BasicStdSolution<KeyPolicy>::BasicStdSolution(std::vector<FileManager>& first_bucket,
+                                              std::vector<FileManager>& second_bucket)
+    : Solution(first_bucket, second_bucket) {
+    assert(first_.size() == second_.size());
 }
 
-inline int get_key(std::string_view s) {
-    if (s.empty()) throw std::runtime_error("Empty line");
-    return fast_atoi(s.data(), s.size());
-}
-
-
-StdSolution::StdSolution(std::vector<FileManager>& first_bucket,
-                         std::vector<FileManager>& second_bucket)
-    : first_bucket_(first_bucket), second_bucket_(second_bucket) {
-    assert(first_bucket_.size() == second_bucket_.size());
-}
-
-void StdSolution::load_initial_series(FileManager& source) {
-    Reader reader(source);
+template <class KeyPolicy>
+void BasicStdSolution<KeyPolicy>::load_initial_series(Reader& reader) {
+    metrics::ScopedPhase phase("run_formation");
 
     // Using unique_ptrs to manage writer lifetimes correctly.
     std::vector<std::unique_ptr<BufferedWriter>> writers;
-    for (FileManager& file : first_bucket_) {
+    for (FileManager& file : first_) {
         writers.push_back(std::make_unique<BufferedWriter>(file));
     }
 
     int series_count = 0;
-    int last_key = std::numeric_limits<int>::min();
+    KeyHolder<key_type> last_key;
+    bool have_last = false;
     std::string_view line_view;
 
     while (reader.get_line(line_view)) {
         if (line_view.empty()) {
             continue; // Skip empty lines
         }
-        const int new_key = get_key(std::string(line_view));
+        const key_type new_key = KeyPolicy::extract(line_view);
 
-        if (new_key < last_key) {
+        if (have_last && KeyPolicy::less(new_key, last_key.get())) {
             series_count++;
         }
-        last_key = new_key;
+        last_key.assign(new_key);
+        have_last = true;
 
         writers[series_count % writers.size()]->write(line_view);
         writers[series_count % writers.size()]->write(std::string("\n"));
@@ -62,14 +54,15 @@ void StdSolution::load_initial_series(FileManager& source) {
     for (auto& writer : writers) {
         writer->flush();
     }
-    for (auto& file : first_bucket_) {
+    for (auto& file : first_) {
         file.reset_cursor();
     }
 }
 
-const FileManager& StdSolution::external_sort() {
-    auto* cur_fileset = &first_bucket_;
-    auto* opposite_fileset = &second_bucket_;
+template <class KeyPolicy>
+FileManager& BasicStdSolution<KeyPolicy>::external_sort() {
+    auto* cur_fileset = &first_;
+    auto* opposite_fileset = &second_;
 
     while (true) {
         size_t files_with_content = 0;
@@ -98,8 +91,10 @@ const FileManager& StdSolution::external_sort() {
     }
 }
 
-void StdSolution::merge_many_into_many(std::vector<FileManager>* cur_fileset,
-                                       std::vector<FileManager>* opposite_fileset) {
+template <class KeyPolicy>
+void BasicStdSolution<KeyPolicy>::merge_many_into_many(std::vector<FileManager>* cur_fileset,
+                                                       std::vector<FileManager>* opposite_fileset) {
+    metrics::ScopedPhase phase("merge_pass");
     const size_t FILE_COUNT = cur_fileset->size();
     size_t output_idx = 0;
 
@@ -131,23 +126,33 @@ void StdSolution::merge_many_into_many(std::vector<FileManager>* cur_fileset,
 }
 
 
-void StdSolution::merge_many_into_one(
+template <class KeyPolicy>
+void BasicStdSolution<KeyPolicy>::merge_many_into_one(
     std::vector<std::unique_ptr<Reader>>& readers,
     std::vector<std::optional<std::string>>& lookahead_lines,
     BufferedWriter& out_file)
 {
     const size_t FILE_COUNT = readers.size();
-    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::less<>> pq;
+    // Keys may view into lookahead_lines; an entry's line is not touched until it is popped.
+    using Entry = std::pair<key_type, int>;
+    // Min-heap order: the smallest key is on top, equal keys from the lower file first.
+    struct EntryGreater {
+        bool operator()(const Entry& a, const Entry& b) const {
+            if (KeyPolicy::less(b.first, a.first)) return true;
+            if (KeyPolicy::less(a.first, b.first)) return false;
+            return a.second > b.second;
+        }
+    };
+    std::priority_queue<Entry, std::vector<Entry>, EntryGreater> pq;
 
-    for (int i = 0; i < FILE_COUNT; ++i) {
+    for (int i = 0; i < static_cast<int>(FILE_COUNT); ++i) {
         if (lookahead_lines[i].has_value()) {
-            pq.emplace(get_key(lookahead_lines[i].value()), i);
+            pq.emplace(KeyPolicy::extract(lookahead_lines[i].value()), i);
         } else {
             std::string_view view;
             if (!readers[i]->is_end() && readers[i]->get_line(view)) {
-                std::string line = std::string(view);
-                pq.emplace(get_key(line), i);
-                lookahead_lines[i] = std::move(line); // Store it in the lookahead buffer
+                lookahead_lines[i] = std::string(view); // Store it in the lookahead buffer
+                pq.emplace(KeyPolicy::extract(lookahead_lines[i].value()), i);
             }
         }
     }
@@ -156,7 +161,7 @@ void StdSolution::merge_many_into_one(
         return;
     }
 
-    int last_key_written = std::numeric_limits<int>::min();
+    KeyHolder<key_type> last_key_written;
 
     while (!pq.empty()) {
         auto [key, idx] = pq.top();
@@ -164,24 +169,26 @@ void StdSolution::merge_many_into_one(
 
         out_file.write(lookahead_lines[idx].value());
         out_file.write(std::string("\n"));
-        last_key_written = key;
+        last_key_written.assign(key);
         lookahead_lines[idx].reset();
 
         // Try to read the next line from the same file.
         std::string_view view;
         if (!readers[idx]->is_end() && readers[idx]->get_line(view)) {
-            std::string next_line = std::string(view);
-            int next_key = get_key(next_line);
+            lookahead_lines[idx] = std::string(view);
+            const key_type next_key = KeyPolicy::extract(lookahead_lines[idx].value());
 
             // If the next line is part of the current sorted run, add it to the queue.
-            if (next_key <= last_key_written) {
+            // Otherwise the run in this file has ended, and the line stays in the
+            // lookahead buffer for the *next* merge operation.
+            if (!KeyPolicy::less(next_key, last_key_written.get())) {
                 pq.emplace(next_key, idx);
-                lookahead_lines[idx] = std::move(next_line);
-            } else {
-                // The run in this file has ended. Store the line we just read
-                // in the lookahead buffer for the *next* merge operation.
-                lookahead_lines[idx] = std::move(next_line);
             }
         }
     }
 }
+
+template class BasicStdSolution<IntPrefixKey>;
+template class BasicStdSolution<Int64PrefixKey>;
+template class BasicStdSolution<DateFieldKey>;
+template class BasicStdSolution<WholeLineKey>;
@@ -0,0 +1,107 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "io/block_codec.h"
+#include "io/run_format.h"
+#include "io/run_reader.h"
+#include "io/run_writer.h"
+
+namespace {
+
+std::string round_trip(const std::string& src) {
+    std::string packed;
+    block_codec::compress(src.data(), src.size(), packed);
+    std::string back(src.size(), '\0');
+    block_codec::decompress(packed.data(), packed.size(), back.data(), back.size());
+    return back;
+}
+
+} // namespace
+
+TEST(BlockCodec, RoundTripsEmptyInput) {
+    EXPECT_EQ(round_trip(""), "");
+}
+
+TEST(BlockCodec, RoundTripsSingleSymbol) {
+    EXPECT_EQ(round_trip(std::string(5000, '7')), std::string(5000, '7'));
+    EXPECT_EQ(round_trip("x"), "x");
+}
+
+TEST(BlockCodec, RoundTripsGeneratorText) {
+    const std::string text = join_lines(make_lines(5000, -100000, 100000));
+    std::string packed;
+    block_codec::compress(text.data(), text.size(), packed);
+    // Digits, '-', '/' and a few letters: well under a byte per symbol.
+    EXPECT_LT(packed.size(), text.size() * 3 / 4);
+    EXPECT_EQ(round_trip(text), text);
+}
+
+TEST(BlockCodec, RoundTripsEveryByteValue) {
+    std::string bytes;
+    for (int round = 0; round < 4; ++round) {
+        for (int b = 0; b < 256; ++b) bytes.push_back(static_cast<char>(b));
+    }
+    EXPECT_EQ(round_trip(bytes), bytes);
+}
+
+TEST(BlockCodec, RoundTripsSkewedDistributions) {
+    // Long code lengths get clamped to MAX_CODE_BITS.
+    std::mt19937 rng(7);
+    std::string bytes;
+    for (int i = 0; i < 100000; ++i) {
+        const unsigned r = rng();
+        const int symbol = __builtin_ctz(r | 0x80000000u); // geometric: 0 half the time, 1 a quarter, ...
+        bytes.push_back(static_cast<char>('a' + symbol));
+    }
+    EXPECT_EQ(round_trip(bytes), bytes);
+}
+
+TEST(BlockCodec, MalformedInputThrows) {
+    const std::string text = join_lines(make_lines(100, 0, 1000));
+    std::string packed;
+    block_codec::compress(text.data(), text.size(), packed);
+    std::string out(text.size(), '\0');
+    EXPECT_THROW(block_codec::decompress(packed.data(), 0, out.data(), out.size()), std::runtime_error);
+    EXPECT_THROW(block_codec::decompress(packed.data(), packed.size() / 2, out.data(), out.size()),
+                 std::runtime_error);
+}
+
+TEST(BlockCodec, CompressedRunsRoundTrip) {
+    ScratchDir dir;
+    FileManager file(dir.file("run.bin"), true);
+    const std::vector<std::string> lines = stable_sorted(make_lines(3000, -500, 500));
+    {
+        RunWriter writer(file, true, RunWriter::DEFAULT_FLUSH_SIZE, 4096);
+        writer.begin_run();
+        for (std::size_t i = 0; i < lines.size(); ++i) {
+            if (i == 1500) writer.begin_run();
+            // Payloads that start with the key's digits have them elided; "x" lines do not.
+            const std::string payload = i % 10 == 0 ? "x" + lines[i] : lines[i];
+            writer.push(static_cast<std::int32_t>(leading_key(lines[i])), payload, i % 13 == 0 ? 4 : 1);
+        }
+        writer.flush();
+    }
+    file.reset_cursor();
+
+    RunReader reader(file);
+    std::string bytes;
+    std::uint32_t count = 0;
+    while (reader.read_block(bytes, count)) {
+    }
+    std::size_t i = 0;
+    const char* p = bytes.data();
+    const char* end = p + bytes.size();
+    while (p < end) {
+        run_format::Record<std::int32_t> rec{};
+        p = run_format::decode_record(p, end, rec);
+        ASSERT_LT(i, lines.size());
+        EXPECT_EQ(rec.key, leading_key(lines[i]));
+        EXPECT_EQ(rec.payload, i % 10 == 0 ? "x" + lines[i] : lines[i]);
+        EXPECT_EQ(rec.count, i % 13 == 0 ? 4u : 1u);
+        EXPECT_EQ(rec.run_start, i == 0 || i == 1500);
+        ++i;
+    }
+    EXPECT_EQ(i, lines.size());
+}
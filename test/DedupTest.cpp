@@ -0,0 +1,126 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <map>
+#include <set>
+#include <utility>
+
+#include "solution/modified.h"
+#include "solution/sort_spec.h"
+
+namespace {
+
+// Few distinct lines, each repeated many times and spread over the input, so
+// copies of one line land in different runs and the merges collapse them.
+std::vector<std::string> make_duplicates(std::size_t count, unsigned seed = 1) {
+    std::mt19937 rng(seed);
+    std::vector<std::string> distinct;
+    for (int i = 0; i < 3000; ++i) {
+        const int key = static_cast<int>(rng() % 700) - 350;
+        distinct.push_back(std::to_string(key) + "-" + static_cast<char>('a' + rng() % 3) +
+                           static_cast<char>('a' + rng() % 3) + "-2020/01/0" + std::to_string(1 + rng() % 3));
+    }
+    std::vector<std::string> lines;
+    for (std::size_t i = 0; i < count; ++i) lines.push_back(distinct[rng() % distinct.size()]);
+    return lines;
+}
+
+template <class KeyPolicy = IntPrefixKey>
+std::vector<std::string> sort_lines(const std::vector<std::string>& lines, DedupMode mode,
+                                    KeyPolicy policy = KeyPolicy{}) {
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), join_lines(lines));
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    FileManager out(dir.file("output.txt"), true);
+    SortOptions options;
+    options.dedup = mode;
+    BasicModifiedSolution<KeyPolicy> solution(b, c, options, std::move(policy));
+    solution.sort(in, out);
+    return split_lines(read_file(dir.file("output.txt")));
+}
+
+// Distinct lines by key, then bytes: the order of DedupMode::Unique.
+std::vector<std::string> unique_sorted(const std::vector<std::string>& lines) {
+    std::set<std::pair<long long, std::string>> distinct;
+    for (const auto& line : lines) distinct.emplace(leading_key(line), line);
+    std::vector<std::string> out;
+    for (const auto& entry : distinct) out.push_back(entry.second);
+    return out;
+}
+
+} // namespace
+
+TEST(Dedup, UniqueKeepsOneCopyOfEachLine) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_duplicates(200000);
+    EXPECT_EQ(sort_lines(lines, DedupMode::Unique), unique_sorted(lines));
+}
+
+TEST(Dedup, UniqueInOneRun) {
+    const std::vector<std::string> lines = {"2-b", "1-z", "2-a", "1-z", "2-b", "1-y", "2-a"};
+    EXPECT_EQ(sort_lines(lines, DedupMode::Unique), (std::vector<std::string>{"1-y", "1-z", "2-a", "2-b"}));
+}
+
+TEST(Dedup, UniqueByKeyKeepsTheFirstLineOfEachKey) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_duplicates(200000, 2);
+    std::vector<std::string> expected;
+    for (const auto& line : stable_sorted(lines)) {
+        if (expected.empty() || leading_key(expected.back()) != leading_key(line)) expected.push_back(line);
+    }
+    EXPECT_EQ(sort_lines(lines, DedupMode::UniqueByKey), expected);
+}
+
+TEST(Dedup, CountAppendsTheLinesPerKey) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_duplicates(200000, 3);
+    std::map<long long, std::uint64_t> counts;
+    for (const auto& line : lines) ++counts[leading_key(line)];
+
+    const std::vector<std::string> out = sort_lines(lines, DedupMode::Count);
+    ASSERT_EQ(out.size(), counts.size());
+    auto it = counts.begin();
+    for (const auto& line : out) {
+        EXPECT_EQ(leading_key(line), it->first);
+        EXPECT_EQ(line.substr(line.find('\t') + 1), std::to_string(it->second));
+        ++it;
+    }
+}
+
+TEST(Dedup, UniqueWithASortSpec) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_duplicates(100000, 4);
+    const SortSpec spec = SortSpec::parse("alpha");
+    const std::vector<std::string> out = sort_lines(lines, DedupMode::Unique, NormalizedKey(spec));
+
+    std::set<std::pair<std::string, std::string>> distinct;
+    for (const auto& line : lines) {
+        std::string key;
+        ASSERT_TRUE(spec.encode(line, key));
+        distinct.emplace(key, line);
+    }
+    ASSERT_EQ(out.size(), distinct.size());
+    auto it = distinct.begin();
+    for (const auto& line : out) EXPECT_EQ(line, (it++)->second);
+}
+
+TEST(Dedup, SortedStreamCollapsesLikeSort) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_duplicates(200000, 5);
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), join_lines(lines));
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    SortOptions options;
+    options.dedup = DedupMode::Unique;
+    ModifiedSolution solution(b, c, options);
+    SortedStream stream = solution.sorted_stream(in);
+
+    std::vector<std::string> out;
+    std::string_view line;
+    while (stream.next(line)) out.emplace_back(line);
+    EXPECT_EQ(out, unique_sorted(lines));
+}
@@ -5,5 +5,105 @@
 #ifndef INC_1_EXTERNALSORTTEST_H
 #define INC_1_EXTERNALSORTTEST_H
 
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "io/manager.h"
+#include "io/memory_budget.h"
+
+// Directory of one test, removed with everything in it when the test ends.
+class ScratchDir {
+public:
+    ScratchDir() {
+        std::random_device rd;
+        path_ = std::filesystem::temp_directory_path() / ("external_sort_test_" + std::to_string(rd()));
+        std::filesystem::create_directories(path_);
+    }
+    ~ScratchDir() {
+        std::error_code ec;
+        std::filesystem::remove_all(path_, ec);
+    }
+    ScratchDir(const ScratchDir&) = delete;
+    ScratchDir& operator=(const ScratchDir&) = delete;
+
+    std::string file(const std::string& name) const { return (path_ / name).string(); }
+
+    // Files <prefix>0.txt ... <prefix><count-1>.txt, empty.
+    std::vector<FileManager> bucket(const std::string& prefix, std::size_t count = 3) const {
+        std::vector<FileManager> files;
+        for (std::size_t i = 0; i < count; ++i) files.emplace_back(file(prefix + std::to_string(i) + ".txt"), true);
+        return files;
+    }
+
+private:
+    std::filesystem::path path_;
+};
+
+// Lowers the process's memory budget for one test, so small inputs take
+// several runs and merge passes.
+class BudgetCeiling {
+public:
+    explicit BudgetCeiling(std::uint64_t ceiling) { memory_budget().set_ceiling(ceiling); }
+    ~BudgetCeiling() { memory_budget().set_ceiling(MemoryBudget::DEFAULT_CEILING); }
+    BudgetCeiling(const BudgetCeiling&) = delete;
+    BudgetCeiling& operator=(const BudgetCeiling&) = delete;
+};
+
+inline void write_file(const std::string& path, const std::string& contents) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << contents;
+}
+
+inline std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+inline std::vector<std::string> split_lines(const std::string& text) {
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) lines.push_back(line);
+    return lines;
+}
+
+inline std::string join_lines(const std::vector<std::string>& lines) {
+    std::string text;
+    for (const auto& line : lines) text += line + '\n';
+    return text;
+}
+
+// Generator-style lines "<key>-<tag>-2020/01/01": keys in [lo, hi], the tag
+// numbering the lines, so the input order of equal keys is visible.
+inline std::vector<std::string> make_lines(std::size_t count, int lo, int hi, unsigned seed = 1) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> key(lo, hi);
+    std::vector<std::string> lines;
+    lines.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        lines.push_back(std::to_string(key(rng)) + "-line" + std::to_string(i) + "-2020/01/01");
+    }
+    return lines;
+}
+
+inline long long leading_key(const std::string& line) {
+    return std::stoll(line);
+}
+
+// What a stable sort by the leading integer makes of lines.
+inline std::vector<std::string> stable_sorted(std::vector<std::string> lines) {
+    std::stable_sort(lines.begin(), lines.end(), [](const std::string& a, const std::string& b) {
+        return leading_key(a) < leading_key(b);
+    });
+    return lines;
+}
 
 #endif //INC_1_EXTERNALSORTTEST_H
@@ -0,0 +1,60 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+
+#include "solution/in_memory.h"
+#include "solution/modified.h"
+
+namespace {
+
+// Sorts text with sort_in_memory(); false if it declined.
+bool in_memory_lines(const std::string& text, std::uint64_t budget, std::vector<std::string>& out) {
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), text);
+    write_file(dir.file("output.txt"), "untouched\n");
+    FileManager in(dir.file("input.txt"), false);
+    FileManager output(dir.file("output.txt"), true);
+    const bool sorted = sort_in_memory(in, output, budget, 2);
+    out = split_lines(read_file(dir.file("output.txt")));
+    return sorted;
+}
+
+// The same text through run formation and the merge passes.
+std::vector<std::string> external_lines(const std::string& text) {
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), text);
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    ModifiedSolution solution(b, c);
+    solution.load_initial_series(in);
+    solution.external_sort(dir.file("output.txt"));
+    return split_lines(read_file(dir.file("output.txt")));
+}
+
+} // namespace
+
+TEST(InMemory, KeepsEqualKeysInInputOrder) {
+    const std::vector<std::string> lines = make_lines(300000, -100, 100);
+    std::vector<std::string> out;
+    ASSERT_TRUE(in_memory_lines(join_lines(lines), 1ull << 30, out));
+    EXPECT_EQ(out, stable_sorted(lines));
+}
+
+TEST(InMemory, NormalisesLinesLikeRunFormation) {
+    // CRLF endings, an empty line, and a last line with a '\r' but no '\n'.
+    for (const std::string text : {"2-b\r\n\n1-a\r\n3-c\r", "3-c\r\n1-a\r", "1-a\n2-b"}) {
+        std::vector<std::string> out;
+        ASSERT_TRUE(in_memory_lines(text, 1 << 20, out));
+        EXPECT_EQ(out, external_lines(text)) << text;
+    }
+}
+
+TEST(InMemory, DeclinesWhenTheIndexWouldNotFit) {
+    // The buffer fits, the buffer and the index do not: nothing is written.
+    const std::string text = join_lines(make_lines(200000, -1000, 1000));
+    std::vector<std::string> out;
+    EXPECT_FALSE(in_memory_lines(text, text.size() + (1 << 20), out));
+    EXPECT_EQ(out, std::vector<std::string>{"untouched"});
+    EXPECT_FALSE(in_memory_lines(text, text.size() - 1, out));
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "solution/merge_kernel.h"
+
+namespace {
+
+// What merge_two_runs() should produce: a plain merge, ties to the first input,
+// stopping when either input is used up.
+template <class T>
+std::vector<std::uint32_t> reference_order(const std::vector<T>& a, const std::vector<T>& b) {
+    std::vector<std::uint32_t> order;
+    std::size_t i = 0;
+    std::size_t j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (b[j] < a[i]) order.push_back(static_cast<std::uint32_t>(j++) | FROM_SECOND);
+        else order.push_back(static_cast<std::uint32_t>(i++));
+    }
+    return order;
+}
+
+template <class T>
+std::vector<T> sorted_keys(std::mt19937& rng, std::size_t count, T lo, T hi) {
+    std::uniform_int_distribution<T> key(lo, hi);
+    std::vector<T> keys(count);
+    for (auto& k : keys) k = key(rng);
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+// Random lengths around the kernel's eight-record steps and key ranges from
+// all-equal to sparse, so ties, uneven inputs and the scalar tail all come up.
+template <class T>
+void check_against_reference(T lo_limit, T hi_limit) {
+    std::mt19937 rng(3);
+    std::vector<std::uint32_t> order;
+    for (int iteration = 0; iteration < 500; ++iteration) {
+        const std::size_t na = rng() % (iteration % 2 ? 40 : 5000);
+        const std::size_t nb = rng() % (iteration % 3 ? 40 : 5000);
+        const T span = static_cast<T>(1 + rng() % 600);
+        const T lo = iteration % 5 ? T{0} : lo_limit;
+        const T hi = iteration % 5 ? span : hi_limit;
+        const std::vector<T> a = sorted_keys(rng, na, lo, hi);
+        const std::vector<T> b = sorted_keys(rng, nb, lo, hi);
+        merge_two_runs(a.data(), a.size(), b.data(), b.size(), order);
+        ASSERT_EQ(order, reference_order(a, b)) << "na=" << na << " nb=" << nb;
+    }
+}
+
+} // namespace
+
+TEST(MergeKernel, Int32MatchesAPlainMerge) {
+    check_against_reference<std::int32_t>(std::numeric_limits<std::int32_t>::min(),
+                                          std::numeric_limits<std::int32_t>::max());
+}
+
+TEST(MergeKernel, Int64MatchesAPlainMerge) {
+    check_against_reference<std::int64_t>(std::numeric_limits<std::int64_t>::min(),
+                                          std::numeric_limits<std::int64_t>::max());
+}
+
+TEST(MergeKernel, StopsWhenAnInputIsUsedUp) {
+    const std::vector<std::int32_t> a = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+    const std::vector<std::int32_t> b = {5};
+    std::vector<std::uint32_t> order = {42};
+    merge_two_runs(a.data(), a.size(), b.data(), b.size(), order);
+    // Equal keys go to the first input, then the second is used up.
+    EXPECT_EQ(order, (std::vector<std::uint32_t>{0, 1, 2, 3, 4, FROM_SECOND}));
+
+    merge_two_runs(a.data(), a.size(), b.data(), 0, order);
+    EXPECT_TRUE(order.empty());
+}
@@ -0,0 +1,175 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include "io/metrics.h"
+#include "io/reader.h"
+#include "io/thread_pool.h"
+#include "solution/modified.h"
+#include "solution/standard.h"
+
+namespace {
+
+// Difference of one operation's stats across a sort.
+struct OpDelta {
+    std::uint64_t calls;
+    std::uint64_t bytes;
+};
+
+OpDelta op_delta(const metrics::Snapshot& before, const metrics::Snapshot& after, metrics::Op op) {
+    const auto i = static_cast<std::size_t>(op);
+    return {after.calls[i] - before.calls[i], after.bytes[i] - before.bytes[i]};
+}
+
+std::string report() {
+    std::ostringstream out;
+    metrics::write_report(out);
+    return out.str();
+}
+
+// ru_maxrss of this process in bytes.
+std::uint64_t max_rss() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+std::size_t count_of(const std::string& text, const std::string& needle) {
+    std::size_t n = 0;
+    for (std::size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + 1)) ++n;
+    return n;
+}
+
+} // namespace
+
+// Collection stays on for the rest of the test process; it only adds counting.
+TEST(Metrics, CountsWriterFlushes) {
+    metrics::enable();
+    BudgetCeiling ceiling(1 << 20);
+    ScratchDir dir;
+    const std::vector<std::string> lines = make_lines(200000, -1000000, 1000000);
+    const std::string input = join_lines(lines);
+    write_file(dir.file("input.txt"), input);
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    FileManager out(dir.file("output.txt"), true);
+
+    const metrics::Snapshot before = metrics::snapshot();
+    ModifiedSolution(b, c).sort(in, out);
+    const metrics::Snapshot after = metrics::snapshot();
+    ASSERT_EQ(split_lines(read_file(dir.file("output.txt"))), stable_sorted(lines));
+
+    // Runs and the output both pass through flushed buffers.
+    const OpDelta flushes = op_delta(before, after, metrics::Op::WriterFlush);
+    EXPECT_GT(flushes.calls, 0u);
+    EXPECT_GE(flushes.bytes, input.size());
+    EXPECT_LE(flushes.bytes, op_delta(before, after, metrics::Op::WriterWrite).bytes);
+
+    EXPECT_NE(report().find("\"writer_flush\""), std::string::npos);
+}
+
+TEST(Metrics, StdSolutionReportsItsPhases) {
+    const std::size_t counters = metrics::enable_hardware_counters();
+    const std::string before = report();
+    ScratchDir dir;
+    const std::vector<std::string> lines = make_lines(20000, -1000, 1000);
+    write_file(dir.file("input.txt"), join_lines(lines));
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    StdSolution solution(b, c);
+    Reader reader(in);
+    solution.load_initial_series(reader);
+    FileManager& result = solution.external_sort();
+    std::string sorted(result.size(), '\0');
+    result.read_at(sorted.data(), sorted.size(), 0);
+    // The Std solution is not stable: compare keys only.
+    std::vector<long long> keys;
+    for (const auto& line : split_lines(sorted)) keys.push_back(leading_key(line));
+    std::vector<long long> expected;
+    for (const auto& line : stable_sorted(lines)) expected.push_back(leading_key(line));
+    ASSERT_EQ(keys, expected);
+
+    const std::string after = report();
+    const auto added = [&](const std::string& needle) { return count_of(after, needle) - count_of(before, needle); };
+    EXPECT_EQ(added("\"name\": \"run_formation\""), 1u);
+    EXPECT_GT(added("\"name\": \"merge_pass\""), 0u);
+    // The phases of this sort carry the CPU counters that could be opened.
+    const std::string phases = after.substr(after.rfind("\"name\": \"run_formation\""));
+    if (counters > 0) {
+        EXPECT_EQ(count_of(phases, "\"hardware\": {"), count_of(phases, "\"name\": \""));
+    }
+}
+
+TEST(Metrics, PhasesKeepTheProcessPeak) {
+    metrics::enable();
+    constexpr std::size_t SPIKE = 64 << 20;
+    {
+        metrics::ScopedPhase phase("rss_spike");
+        std::unique_ptr<char[]> spike(new char[SPIKE]);
+        std::memset(spike.get(), 1, SPIKE);
+    }
+    const std::uint64_t peak = max_rss();
+    { metrics::ScopedPhase phase("after_spike"); }
+    // A phase starting must not lower the peak the kernel reports for the process.
+    EXPECT_GE(max_rss(), peak);
+
+    const std::string text = report();
+    const std::size_t at = text.rfind("\"name\": \"rss_spike\"");
+    ASSERT_NE(at, std::string::npos);
+    const std::string key = "\"peak_rss_bytes\": ";
+    EXPECT_GE(std::stoull(text.substr(text.find(key, at) + key.size())), SPIKE);
+}
+
+TEST(Metrics, HardwareCountersIncludeLiveWorkers) {
+    metrics::enable_hardware_counters();
+    const auto clock = static_cast<std::size_t>(metrics::Hw::TaskClock);
+    ThreadPool pool(1);
+    const metrics::Snapshot before = metrics::snapshot();
+    if (before.hardware[clock] == 0) GTEST_SKIP() << "no task-clock counter";
+
+    // The worker spins while this thread sleeps, and is still running at the second snapshot.
+    std::atomic<bool> done{false};
+    pool.submit([&] {
+        const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+        done.store(true);
+    });
+    while (!done.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const metrics::Snapshot after = metrics::snapshot();
+    EXPECT_GE(after.hardware[clock] - before.hardware[clock], 80000000u);
+}
+
+TEST(Metrics, MergeGallopsOverClusteredRuns) {
+    metrics::enable();
+    BudgetCeiling ceiling(1 << 20);
+    // Clusters of keys with disjoint spans, the later ones lower: runs formed
+    // from different clusters never interleave, so one input wins for long spans.
+    std::vector<std::string> lines;
+    for (int cluster = 9; cluster >= 0; --cluster) {
+        for (const auto& line : make_lines(20000, cluster * 100000, cluster * 100000 + 99999, cluster)) {
+            lines.push_back(line);
+        }
+    }
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), join_lines(lines));
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    FileManager out(dir.file("output.txt"), true);
+
+    const metrics::Snapshot before = metrics::snapshot();
+    ModifiedSolution(b, c).sort(in, out);
+    const metrics::Snapshot after = metrics::snapshot();
+    EXPECT_EQ(split_lines(read_file(dir.file("output.txt"))), stable_sorted(lines));
+
+    const auto gallop = static_cast<std::size_t>(metrics::Counter::GallopRecords);
+    EXPECT_GT(after.counters[gallop] - before.counters[gallop], 0u);
+}
@@ -0,0 +1,75 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+
+#include "solution/presorted.h"
+
+namespace {
+
+InputOrder order_of(const std::string& text, unsigned threads = 1) {
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), text);
+    FileManager in(dir.file("input.txt"), false);
+    return detect_input_order(in, threads);
+}
+
+// Runs write_if_presorted over text; false when it leaves the input to the sort.
+bool presorted_lines(const std::string& text, std::vector<std::string>& out) {
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), text);
+    FileManager in(dir.file("input.txt"), false);
+    FileManager output(dir.file("output.txt"), true);
+    if (!write_if_presorted(in, output)) return false;
+    out = split_lines(read_file(dir.file("output.txt")));
+    return true;
+}
+
+} // namespace
+
+TEST(Presorted, DetectsAscendingInput) {
+    EXPECT_EQ(order_of("-3-a\n1-b\n1-c\n7-d\n"), InputOrder::Ascending);
+    EXPECT_EQ(order_of("5-a\n5-b\n5-c\n"), InputOrder::Ascending);
+    EXPECT_EQ(order_of(""), InputOrder::Ascending);
+}
+
+TEST(Presorted, DetectsStrictlyDescendingInput) {
+    EXPECT_EQ(order_of("7-d\n1-b\n-3-a\n"), InputOrder::Descending);
+}
+
+TEST(Presorted, DescendingInputWithEqualKeysIsUnsorted) {
+    // Reversing it would put 1-b before 1-c.
+    EXPECT_EQ(order_of("7-d\n1-c\n1-b\n-3-a\n"), InputOrder::Unsorted);
+}
+
+TEST(Presorted, RejectsLinesTheRegularPathNormalises) {
+    EXPECT_EQ(order_of("1-a\n\n2-b\n"), InputOrder::Unsorted);
+    EXPECT_EQ(order_of("1-a\r\n2-b\r\n"), InputOrder::Unsorted);
+    EXPECT_EQ(order_of("1-a\nx-b\n"), InputOrder::Unsorted);
+    EXPECT_EQ(order_of("2-a\n1-b\n3-c\n"), InputOrder::Unsorted);
+}
+
+TEST(Presorted, ReversesDescendingInput) {
+    std::vector<std::string> out;
+    ASSERT_TRUE(presorted_lines("9-c\n4-b\n-2-a", out));
+    EXPECT_EQ(out, (std::vector<std::string>{"-2-a", "4-b", "9-c"}));
+}
+
+TEST(Presorted, LeavesDescendingDuplicatesToTheStableSort) {
+    std::vector<std::string> out;
+    EXPECT_FALSE(presorted_lines("9-c\n4-first\n4-second\n-2-a\n", out));
+}
+
+TEST(Presorted, StitchesRangesAcrossThreads) {
+    // Large enough for several scan ranges; the seams must be checked too.
+    std::vector<std::string> lines = stable_sorted(make_lines(1200000, -1000000, 1000000));
+    EXPECT_EQ(order_of(join_lines(lines), 4), InputOrder::Ascending);
+
+    std::swap(lines.front(), lines.back());
+    EXPECT_EQ(order_of(join_lines(lines), 4), InputOrder::Unsorted);
+
+    std::vector<std::string> descending;
+    for (int k = 2000000; k > 0; --k) descending.push_back(std::to_string(k) + "-line");
+    EXPECT_EQ(order_of(join_lines(descending), 4), InputOrder::Descending);
+    descending[descending.size() / 2] = descending[descending.size() / 2 - 1];
+    EXPECT_EQ(order_of(join_lines(descending), 4), InputOrder::Unsorted);
+}
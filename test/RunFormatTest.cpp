@@ -0,0 +1,146 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <limits>
+#include <stdexcept>
+
+#include "io/run_format.h"
+#include "io/run_reader.h"
+#include "io/run_writer.h"
+
+using namespace run_format;
+
+namespace {
+
+template <class Key>
+std::vector<Record<Key>> decode_all(const std::string& bytes) {
+    std::vector<Record<Key>> records;
+    const char* p = bytes.data();
+    const char* end = p + bytes.size();
+    while (p < end) {
+        Record<Key> rec{};
+        p = decode_record(p, end, rec);
+        records.push_back(rec);
+    }
+    return records;
+}
+
+} // namespace
+
+TEST(RunFormat, VarintRoundTrips) {
+    const std::uint64_t values[] = {0, 1, 127, 128, 300, 16383, 16384, std::uint64_t{1} << 35,
+                                    std::numeric_limits<std::uint64_t>::max()};
+    for (const std::uint64_t v : values) {
+        std::string bytes;
+        append_varint(bytes, v);
+        EXPECT_LE(bytes.size(), MAX_VARINT_SIZE);
+        std::uint64_t back = 0;
+        EXPECT_EQ(read_varint(bytes.data(), bytes.data() + bytes.size(), back), bytes.data() + bytes.size());
+        EXPECT_EQ(back, v);
+    }
+}
+
+TEST(RunFormat, VarintUsesOneBytePerSevenBits) {
+    std::string bytes;
+    append_varint(bytes, 127);
+    EXPECT_EQ(bytes.size(), 1u);
+    bytes.clear();
+    append_varint(bytes, 128);
+    EXPECT_EQ(bytes.size(), 2u);
+}
+
+TEST(RunFormat, TruncatedVarintThrows) {
+    std::string bytes;
+    append_varint(bytes, 1u << 20);
+    bytes.pop_back();
+    std::uint64_t v = 0;
+    EXPECT_THROW(read_varint(bytes.data(), bytes.data() + bytes.size(), v), std::runtime_error);
+}
+
+TEST(RunFormat, ZigzagRoundTrips) {
+    const std::int64_t values[] = {0, -1, 1, -2, 63, -64, std::numeric_limits<std::int64_t>::min(),
+                                   std::numeric_limits<std::int64_t>::max()};
+    for (const std::int64_t v : values) EXPECT_EQ(unzigzag(zigzag(v)), v);
+    EXPECT_EQ(zigzag(-1), 1u);
+    EXPECT_EQ(zigzag(1), 2u);
+}
+
+TEST(RunFormat, FormatsKeysCanonically) {
+    char buf[MAX_KEY_DIGITS];
+    EXPECT_EQ(std::string(buf, format_key(0, buf)), "0");
+    EXPECT_EQ(std::string(buf, format_key(-42, buf)), "-42");
+    EXPECT_EQ(std::string(buf, format_key(std::numeric_limits<std::int64_t>::min(), buf)),
+              "-9223372036854775808");
+}
+
+TEST(RunFormat, RecordsRoundTrip) {
+    std::string bytes;
+    append_record<std::int32_t>(bytes, -7, true, "-7-abc-2020/01/01");
+    append_record<std::int32_t>(bytes, 3, false, "3-x", 5);
+    append_record<std::int32_t>(bytes, 3, false, "");
+
+    const auto records = decode_all<std::int32_t>(bytes);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].key, -7);
+    EXPECT_TRUE(records[0].run_start);
+    EXPECT_EQ(records[0].count, 1u);
+    EXPECT_EQ(records[0].payload, "-7-abc-2020/01/01");
+    EXPECT_FALSE(records[1].run_start);
+    EXPECT_EQ(records[1].count, 5u);
+    EXPECT_EQ(records[1].payload, "3-x");
+    EXPECT_EQ(records[2].payload, "");
+}
+
+TEST(RunFormat, Int64RecordsRoundTrip) {
+    std::string bytes;
+    const std::int64_t key = std::numeric_limits<std::int64_t>::min();
+    append_record<std::int64_t>(bytes, key, true, "payload");
+    const auto records = decode_all<std::int64_t>(bytes);
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(records[0].key, key);
+}
+
+TEST(RunFormat, TruncatedPayloadThrows) {
+    std::string bytes;
+    append_record<std::int32_t>(bytes, 1, true, "0123456789");
+    bytes.resize(bytes.size() - 3);
+    Record<std::int32_t> rec{};
+    EXPECT_THROW(decode_record(bytes.data(), bytes.data() + bytes.size(), rec), std::runtime_error);
+}
+
+TEST(RunFormat, WriterAndReaderRoundTrip) {
+    ScratchDir dir;
+    FileManager file(dir.file("run.bin"), true);
+    {
+        // Small blocks, so the records span many of them.
+        RunWriter writer(file, false, RunWriter::DEFAULT_FLUSH_SIZE, 256);
+        for (int run = 0; run < 3; ++run) {
+            writer.begin_run();
+            for (int i = 0; i < 100; ++i) {
+                writer.push(i - 50, std::to_string(i - 50) + "-r" + std::to_string(run), i % 7 == 0 ? 3 : 1);
+            }
+        }
+        writer.flush();
+        EXPECT_EQ(writer.runs(), 3u);
+    }
+    file.reset_cursor();
+
+    RunReader reader(file);
+    std::string bytes;
+    std::uint32_t total = 0;
+    std::uint32_t count = 0;
+    while (reader.read_block(bytes, count)) total += count;
+    EXPECT_TRUE(reader.is_end());
+
+    const auto records = decode_all<std::int32_t>(bytes);
+    ASSERT_EQ(records.size(), 300u);
+    EXPECT_EQ(total, 300u);
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        const int run = static_cast<int>(i / 100);
+        const int k = static_cast<int>(i % 100) - 50;
+        EXPECT_EQ(records[i].key, k);
+        EXPECT_EQ(records[i].run_start, i % 100 == 0);
+        EXPECT_EQ(records[i].count, (k + 50) % 7 == 0 ? 3u : 1u);
+        EXPECT_EQ(records[i].payload, std::to_string(k) + "-r" + std::to_string(run));
+    }
+}
@@ -0,0 +1,128 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "solution/modified.h"
+#include "solution/sort_spec.h"
+
+namespace {
+
+std::string encoded(const SortSpec& spec, const std::string& line) {
+    std::string out;
+    EXPECT_TRUE(spec.encode(line, out)) << line;
+    return out;
+}
+
+// Generator-style lines with few distinct values per field, so every field
+// decides some comparisons and equal keys are common.
+std::vector<std::string> make_field_lines(std::size_t count, unsigned seed = 1) {
+    static const char* const words[] = {"a", "ab", "b", "ba", "zz", "abc"};
+    std::mt19937 rng(seed);
+    std::vector<std::string> lines;
+    for (std::size_t i = 0; i < count; ++i) {
+        const int num = static_cast<int>(rng() % 41) - 20;
+        const std::string day = std::to_string(10 + rng() % 3);
+        lines.push_back(std::to_string(num) + "-" + words[rng() % 6] + "-2020/0" + std::to_string(1 + rng() % 3)
+                        + "/" + day);
+    }
+    return lines;
+}
+
+} // namespace
+
+TEST(SortSpec, ParsesFieldsAndDirections) {
+    const SortSpec spec = SortSpec::parse("date,num:desc,alpha:asc");
+    ASSERT_EQ(spec.columns().size(), 3u);
+    EXPECT_EQ(spec.columns()[0].field, SortSpec::Field::Date);
+    EXPECT_FALSE(spec.columns()[0].descending);
+    EXPECT_EQ(spec.columns()[1].field, SortSpec::Field::Number);
+    EXPECT_TRUE(spec.columns()[1].descending);
+    EXPECT_EQ(spec.columns()[2].field, SortSpec::Field::Alpha);
+    EXPECT_FALSE(spec.columns()[2].descending);
+}
+
+TEST(SortSpec, RejectsUnknownFieldsAndEmptySpecs) {
+    EXPECT_THROW(SortSpec::parse(""), std::invalid_argument);
+    EXPECT_THROW(SortSpec::parse("size"), std::invalid_argument);
+    EXPECT_THROW(SortSpec::parse("num:down"), std::invalid_argument);
+}
+
+TEST(SortSpec, RejectsLinesOfAnotherShape) {
+    const SortSpec spec = SortSpec::parse("num");
+    std::string out;
+    EXPECT_FALSE(spec.encode("12-abc", out));
+    EXPECT_FALSE(spec.encode("x-abc-2020/01/01", out));
+    EXPECT_FALSE(spec.encode("12-2020/01/01", out));
+}
+
+TEST(SortSpec, EncodingOrdersLikeTheFields) {
+    const SortSpec num = SortSpec::parse("num");
+    EXPECT_LT(encoded(num, "-2147483648-a-2020/01/01"), encoded(num, "-1-a-2020/01/01"));
+    EXPECT_LT(encoded(num, "-1-a-2020/01/01"), encoded(num, "0-a-2020/01/01"));
+    EXPECT_LT(encoded(num, "9-a-2020/01/01"), encoded(num, "10-a-2020/01/01"));
+
+    const SortSpec alpha = SortSpec::parse("alpha");
+    EXPECT_LT(encoded(alpha, "1-ab-2020/01/01"), encoded(alpha, "1-abc-2020/01/01"));
+    EXPECT_LT(encoded(alpha, "1-abc-2020/01/01"), encoded(alpha, "1-b-2020/01/01"));
+
+    const SortSpec date = SortSpec::parse("date");
+    EXPECT_LT(encoded(date, "1-a-2019/12/31"), encoded(date, "1-a-2020/01/01"));
+    EXPECT_EQ(encoded(date, "1-a-2020/01/01"), encoded(date, "2-b-2020/01/01"));
+}
+
+TEST(SortSpec, DescendingFieldsReverseTheirOrderOnly) {
+    const SortSpec spec = SortSpec::parse("alpha:desc,num");
+    // A shorter word comes after the longer one it prefixes.
+    EXPECT_LT(encoded(spec, "1-abc-2020/01/01"), encoded(spec, "1-ab-2020/01/01"));
+    EXPECT_LT(encoded(spec, "1-b-2020/01/01"), encoded(spec, "1-a-2020/01/01"));
+    EXPECT_LT(encoded(spec, "-5-a-2020/01/01"), encoded(spec, "3-a-2020/01/01"));
+}
+
+TEST(NormalizedKey, RecordKeepsTheLineAndItsKey) {
+    const NormalizedKey policy(SortSpec::parse("date,num"));
+    const std::string line = "-7-word-2021/03/04";
+    std::string scratch;
+    std::string_view record;
+    ASSERT_TRUE(policy.ingest(line, scratch, record));
+    EXPECT_EQ(NormalizedKey::record_text(record), line);
+    NormalizedKey::key_type key;
+    ASSERT_TRUE(NormalizedKey::try_extract(record, key));
+    EXPECT_EQ(key, encoded(policy.spec(), line));
+}
+
+TEST(NormalizedKey, RunKeyAgreesWithTheFullKey) {
+    const SortSpec spec = SortSpec::parse("num,date");
+    const std::vector<std::string> lines = make_field_lines(500);
+    for (std::size_t i = 1; i < lines.size(); ++i) {
+        const std::string a = encoded(spec, lines[i - 1]);
+        const std::string b = encoded(spec, lines[i]);
+        if (NormalizedKey::run_key(a) < NormalizedKey::run_key(b)) {
+            EXPECT_LT(a, b);
+        }
+        if (NormalizedKey::run_key(b) < NormalizedKey::run_key(a)) {
+            EXPECT_LT(b, a);
+        }
+    }
+}
+
+TEST(NormalizedKey, ExternalSortFollowsTheSpecStably) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_field_lines(100000);
+    const SortSpec spec = SortSpec::parse("date:desc,alpha,num");
+
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), join_lines(lines));
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    BasicModifiedSolution<NormalizedKey> solution(b, c, SortOptions{}, NormalizedKey(spec));
+    solution.load_initial_series(in);
+    solution.external_sort(dir.file("output.txt"));
+
+    std::vector<std::string> expected = lines;
+    std::stable_sort(expected.begin(), expected.end(), [&](const std::string& x, const std::string& y) {
+        return encoded(spec, x) < encoded(spec, y);
+    });
+    EXPECT_EQ(split_lines(read_file(dir.file("output.txt"))), expected);
+}
@@ -0,0 +1,101 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+
+#include "io/temp_storage.h"
+#include "io/writer.h"
+#include "solution/modified.h"
+
+namespace {
+
+std::string contents(const FileManager& file) {
+    std::string out(file.size(), '\0');
+    EXPECT_EQ(file.read_at(out.data(), out.size(), 0), out.size());
+    return out;
+}
+
+} // namespace
+
+TEST(TempQuota, ChargesUpToTheLimit) {
+    TempQuota quota(100);
+    EXPECT_TRUE(quota.try_charge(60));
+    EXPECT_FALSE(quota.try_charge(41));
+    EXPECT_TRUE(quota.try_charge(40));
+    EXPECT_EQ(quota.used(), 100u);
+    quota.release(70);
+    EXPECT_EQ(quota.used(), 30u);
+}
+
+TEST(TemporaryFile, StaysInMemoryUnderTheQuota) {
+    ScratchDir dir;
+    auto quota = std::make_shared<TempQuota>(1 << 20);
+    FileManager file = FileManager::temporary(dir.file("t.txt"), quota);
+    // temporary() falls back to a disk file where memfd is unavailable.
+    if (!file.in_memory()) GTEST_SKIP() << "no memfd";
+
+    Writer(file).write_all(std::string(1000, 'a'));
+    EXPECT_TRUE(file.in_memory());
+    EXPECT_EQ(quota->used(), 1000u);
+    EXPECT_FALSE(std::filesystem::exists(dir.file("t.txt")));
+    EXPECT_EQ(contents(file), std::string(1000, 'a'));
+}
+
+TEST(TemporaryFile, SpillsToDiskPastTheQuota) {
+    ScratchDir dir;
+    auto quota = std::make_shared<TempQuota>(4096);
+    {
+        FileManager file = FileManager::temporary(dir.file("t.txt"), quota);
+        if (!file.in_memory()) GTEST_SKIP() << "no memfd";
+
+        Writer writer(file);
+        writer.write_all(std::string(3000, 'a'));
+        writer.write_all(std::string(3000, 'b'));
+        EXPECT_FALSE(file.in_memory());
+        EXPECT_EQ(quota->used(), 0u);
+        EXPECT_TRUE(std::filesystem::exists(dir.file("t.txt")));
+
+        // The handle and cursor survive the move.
+        writer.write_all(std::string(10, 'c'));
+        EXPECT_EQ(contents(file), std::string(3000, 'a') + std::string(3000, 'b') + std::string(10, 'c'));
+
+        file.clear();
+        EXPECT_TRUE(file.in_memory());
+        EXPECT_FALSE(std::filesystem::exists(dir.file("t.txt")));
+        writer.write_all(std::string(100, 'd'));
+        EXPECT_EQ(quota->used(), 100u);
+        EXPECT_EQ(contents(file), std::string(100, 'd'));
+    }
+    EXPECT_EQ(quota->used(), 0u);
+}
+
+TEST(TemporaryFile, SpilledFileGoesAwayWithItsManager) {
+    ScratchDir dir;
+    auto quota = std::make_shared<TempQuota>(16);
+    {
+        FileManager file = FileManager::temporary(dir.file("t.txt"), quota);
+        if (!file.in_memory()) GTEST_SKIP() << "no memfd";
+        Writer(file).write_all(std::string(100, 'x'));
+        EXPECT_TRUE(std::filesystem::exists(dir.file("t.txt")));
+    }
+    EXPECT_FALSE(std::filesystem::exists(dir.file("t.txt")));
+}
+
+TEST(TempStorage, SortsThroughMemoryBuckets) {
+    BudgetCeiling ceiling(1 << 20);
+    ScratchDir dir;
+    const std::vector<std::string> lines = make_lines(200000, -1000000, 1000000);
+    write_file(dir.file("input.txt"), join_lines(lines));
+
+    // Room for part of the runs only: some files spill, the rest stay in memory.
+    TempStorage temp({dir.file("")}, 2 << 20);
+    std::vector<FileManager> b = temp.make_bucket("b", 3);
+    std::vector<FileManager> c = temp.make_bucket("c", 3);
+    FileManager in(dir.file("input.txt"), false);
+    FileManager out(dir.file("output.txt"), true);
+    ModifiedSolution solution(b, c);
+    solution.sort(in, out);
+
+    EXPECT_EQ(split_lines(read_file(dir.file("output.txt"))), stable_sorted(lines));
+    EXPECT_LE(temp.memory_used(), 2u << 20);
+}
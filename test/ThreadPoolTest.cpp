@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "io/thread_pool.h"
+
+TEST(ThreadPool, RunsEverySubmittedTask) {
+    std::atomic<int> done{0};
+    {
+        ThreadPool pool(4);
+        EXPECT_EQ(pool.size(), 4u);
+        for (int i = 0; i < 1000; ++i) pool.submit([&done] { ++done; });
+    }
+    // The destructor runs what is still queued.
+    EXPECT_EQ(done.load(), 1000);
+}
+
+TEST(ThreadPool, RunOneTakesQueuedWork) {
+    ThreadPool pool(1);
+    // Keep the only worker busy so the next task stays queued.
+    std::atomic<bool> release{false};
+    std::atomic<bool> started{false};
+    pool.submit([&] {
+        started = true;
+        while (!release) std::this_thread::yield();
+    });
+    while (!started) std::this_thread::yield();
+    bool ran = false;
+    pool.submit([&ran] { ran = true; });
+    EXPECT_TRUE(pool.run_one());
+    EXPECT_TRUE(ran);
+    release = true;
+}
+
+TEST(TaskGroup, WaitsForAllItsTasks) {
+    ThreadPool pool(3);
+    TaskGroup group(TaskPriority::Normal, pool);
+    std::vector<int> slots(500, 0);
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        group.run([&slots, i] { slots[i] = static_cast<int>(i) + 1; });
+    }
+    group.wait();
+    EXPECT_TRUE(group.idle());
+    for (std::size_t i = 0; i < slots.size(); ++i) EXPECT_EQ(slots[i], static_cast<int>(i) + 1);
+}
+
+TEST(TaskGroup, NestedWaitsDoNotDeadlock) {
+    // One worker: each task waits for tasks it submitted, which only completes
+    // because waiting threads run queued work themselves.
+    ThreadPool pool(1);
+    std::atomic<int> leaves{0};
+    TaskGroup outer(TaskPriority::Normal, pool);
+    for (int i = 0; i < 8; ++i) {
+        outer.run([&] {
+            TaskGroup inner(TaskPriority::High, pool);
+            for (int j = 0; j < 8; ++j) inner.run([&leaves] { ++leaves; });
+            inner.wait();
+        });
+    }
+    outer.wait();
+    EXPECT_EQ(leaves.load(), 64);
+}
+
+TEST(TaskGroup, WaitRethrowsTheFirstException) {
+    ThreadPool pool(2);
+    TaskGroup group(TaskPriority::Normal, pool);
+    std::atomic<int> done{0};
+    group.run([] { throw std::runtime_error("task failed"); });
+    for (int i = 0; i < 10; ++i) group.run([&done] { ++done; });
+    EXPECT_THROW(group.wait(), std::runtime_error);
+    // The other tasks still ran to the end.
+    EXPECT_EQ(done.load(), 10);
+    EXPECT_TRUE(group.idle());
+}
+
+TEST(ParallelFor, VisitsEachIndexOnce) {
+    std::vector<std::atomic<int>> hits(1000);
+    parallel_for(hits.size(), [&hits](std::size_t i) { ++hits[i]; });
+    for (const auto& h : hits) EXPECT_EQ(h.load(), 1);
+    parallel_for(0, [](std::size_t) { FAIL() << "no index to visit"; });
+}
+
+TEST(ParallelFor, RethrowsAfterAllIndicesFinish) {
+    std::atomic<int> done{0};
+    EXPECT_THROW(parallel_for(64,
+                              [&done](std::size_t i) {
+                                  if (i == 5 || i == 0) throw std::invalid_argument("bad index");
+                                  ++done;
+                              }),
+                 std::invalid_argument);
+    EXPECT_EQ(done.load(), 62);
+}
@@ -0,0 +1,59 @@
+#include "ExternalSortTest.h"
+
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "solution/modified.h"
+
+namespace {
+
+std::vector<std::string> top_lines(const std::vector<std::string>& lines, std::uint64_t k, SortOptions options = {}) {
+    ScratchDir dir;
+    write_file(dir.file("input.txt"), join_lines(lines));
+    std::vector<FileManager> b = dir.bucket("b");
+    std::vector<FileManager> c = dir.bucket("c");
+    FileManager in(dir.file("input.txt"), false);
+    FileManager out(dir.file("output.txt"), true);
+    ModifiedSolution solution(b, c, options);
+    solution.top_k(in, out, k);
+    return split_lines(read_file(dir.file("output.txt")));
+}
+
+std::vector<std::string> first(const std::vector<std::string>& lines, std::size_t k) {
+    return std::vector<std::string>(lines.begin(), lines.begin() + static_cast<std::ptrdiff_t>(std::min(k, lines.size())));
+}
+
+} // namespace
+
+TEST(TopK, WritesTheSmallestLinesInOrder) {
+    const std::vector<std::string> lines = make_lines(20000, -1000, 1000);
+    EXPECT_EQ(top_lines(lines, 10), first(stable_sorted(lines), 10));
+    EXPECT_EQ(top_lines(lines, 1), first(stable_sorted(lines), 1));
+}
+
+TEST(TopK, ZeroAndOversizedK) {
+    const std::vector<std::string> lines = make_lines(100, -10, 10);
+    EXPECT_TRUE(top_lines(lines, 0).empty());
+    EXPECT_EQ(top_lines(lines, 1000), stable_sorted(lines));
+}
+
+TEST(TopK, KeepsEqualKeysInInputOrder) {
+    // Many more lines per key than k, so the cut falls inside a key.
+    const std::vector<std::string> lines = make_lines(50000, -5, 5);
+    EXPECT_EQ(top_lines(lines, 7000), first(stable_sorted(lines), 7000));
+}
+
+TEST(TopK, SpillsCandidatesThatOutgrowMemory) {
+    BudgetCeiling ceiling(1 << 20);
+    const std::vector<std::string> lines = make_lines(200000, -1000000, 1000000);
+    EXPECT_EQ(top_lines(lines, 150000), first(stable_sorted(lines), 150000));
+}
+
+TEST(TopK, RejectsDedupModes) {
+    const std::vector<std::string> lines = make_lines(100, -10, 10);
+    for (const DedupMode mode : {DedupMode::Unique, DedupMode::UniqueByKey, DedupMode::Count}) {
+        SortOptions options;
+        options.dedup = mode;
+        EXPECT_THROW(top_lines(lines, 5, options), std::invalid_argument);
+    }
+}